@@ -0,0 +1,211 @@
+/*************************************************
+ * Filename: bench_run.c
+ * Author: Jacob Pham (phamjac)
+ * Course: CS 374 - Operating Systems
+ *
+ * Description:
+ *   Runs one command a few times and prints a single JSON line with the
+ *   wall time (median and best), user/sys CPU and peak RSS of the
+ *   child. run_bench.sh uses it for every measurement so the results
+ *   file is one flat JSON object per line.
+ *
+ *   The child's stdout goes to /dev/null (the output is not what's being
+ *   measured), stdin can come from a file (for the menu programs), and
+ *   with -w every run starts in its own empty directory that gets
+ *   removed afterwards, so programs that write files (file_search) see
+ *   the same clean state each time.
+ *
+ * How to Compile:
+ *   gcc --std=gnu99 -Wall -O2 -o bench_run bench_run.c
+ *
+ * How to Run:
+ *   ./bench_run -r 5 -k bench=movies -k rows=1000 -- ./movies --query year=2008 movies_1k.csv
+ *   ./bench_run -r 3 -i menu.txt -w /tmp -k bench=file_search -- ./file_search
+ *   (-r runs, -i stdin file, -w scratch dir, -k key=value copied into the JSON)
+ *
+ *************************************************/
+
+ #define _GNU_SOURCE
+ #include <stdio.h>      // for printf, fprintf, snprintf
+ #include <stdlib.h>     // for qsort, atoi, EXIT_SUCCESS, EXIT_FAILURE
+ #include <string.h>     // for strchr, strspn
+ #include <unistd.h>     // for fork, execvp, dup2, chdir
+ #include <fcntl.h>      // for open
+ #include <ftw.h>        // for nftw (cleaning up the -w directories)
+ #include <time.h>       // for clock_gettime
+ #include <sys/stat.h>   // for mkdir
+ #include <sys/wait.h>   // for wait4
+ #include <sys/resource.h> // for struct rusage
+
+ #define MAX_RUNS 100
+ #define MAX_KEYS 32
+
+/* what one run of the child cost */
+typedef struct run_cost
+{
+    double wall;
+    double user;
+    double system;
+    long max_rss_kb;
+    int status;
+} run_cost_t;
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int remove_entry(const char * p_path, const struct stat * p_stat, int type, struct FTW * p_ftw)
+{
+    (void) p_stat;
+    (void) type;
+    (void) p_ftw;
+    return remove(p_path);
+}
+
+/* fork + exec the command once; -1 if it couldn't even be started */
+static int run_once(char ** pp_command, const char * p_stdin_path, const char * p_work_dir, run_cost_t * p_cost)
+{
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (0 == pid)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+            dup2(null_fd, STDOUT_FILENO);
+        if (NULL != p_stdin_path)
+        {
+            int in_fd = open(p_stdin_path, O_RDONLY);
+            if (in_fd < 0 || dup2(in_fd, STDIN_FILENO) < 0)
+                _exit(126);
+        }
+        if (NULL != p_work_dir && chdir(p_work_dir) != 0)
+            _exit(126);
+        execvp(pp_command[0], pp_command);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return -1;
+
+    p_cost->wall = now_seconds() - start;
+    p_cost->user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    p_cost->system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    p_cost->max_rss_kb = usage.ru_maxrss;
+    p_cost->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static int compare_walls(const void * p_left, const void * p_right)
+{
+    double left = ((const run_cost_t *) p_left)->wall;
+    double right = ((const run_cost_t *) p_right)->wall;
+    return (left > right) - (left < right);
+}
+
+/* key=value, with the value written as a number when it looks like one */
+static void print_key(const char * p_pair)
+{
+    const char * p_equals = strchr(p_pair, '=');
+    if (NULL == p_equals)
+        return;
+    const char * p_value = p_equals + 1;
+    int is_number = ('\0' != *p_value) && strspn(p_value, "0123456789.") == strlen(p_value);
+
+    printf("\"%.*s\":", (int) (p_equals - p_pair), p_pair);
+    if (is_number)
+    {
+        printf("%s,", p_value);
+        return;
+    }
+    putchar('"');
+    for (; '\0' != *p_value; p_value++)
+    {
+        if ('"' == *p_value || '\\' == *p_value)
+            putchar('\\');
+        putchar(*p_value);
+    }
+    printf("\",");
+}
+
+int main(int argc, char ** pp_args)
+{
+    int run_count = 3;
+    const char * p_stdin_path = NULL;
+    const char * p_scratch = NULL;
+    const char * pp_keys[MAX_KEYS];
+    int key_count = 0;
+    int option;
+
+    while ((option = getopt(argc, pp_args, "+r:i:w:k:")) != -1)
+    {
+        if ('r' == option)
+            run_count = atoi(optarg);
+        else if ('i' == option)
+            p_stdin_path = optarg;
+        else if ('w' == option)
+            p_scratch = optarg;
+        else if ('k' == option && key_count < MAX_KEYS)
+            pp_keys[key_count++] = optarg;
+        else
+            optind = argc + 1; // falls into the usage message below
+    }
+    if (optind >= argc || run_count < 1 || run_count > MAX_RUNS)
+    {
+        fprintf(stderr, "usage: %s [-r runs] [-i stdin file] [-w scratch dir] [-k key=value]... -- command [args]\n", pp_args[0]);
+        return EXIT_FAILURE;
+    }
+
+    run_cost_t costs[MAX_RUNS];
+    int failed_status = 0;
+    for (int run = 0; run < run_count; run++)
+    {
+        char work_dir[4096];
+        const char * p_work_dir = NULL;
+        if (NULL != p_scratch)
+        {
+            snprintf(work_dir, sizeof(work_dir), "%s/bench_run.%d.%d", p_scratch, (int) getpid(), run);
+            if (mkdir(work_dir, 0700) != 0)
+            {
+                perror(work_dir);
+                return EXIT_FAILURE;
+            }
+            p_work_dir = work_dir;
+        }
+
+        if (run_once(pp_args + optind, p_stdin_path, p_work_dir, &costs[run]) != 0)
+        {
+            perror(pp_args[optind]);
+            return EXIT_FAILURE;
+        }
+        if (0 != costs[run].status)
+            failed_status = costs[run].status;
+
+        if (NULL != p_work_dir)
+            nftw(p_work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // the peak RSS is the worst run's, the CPU times are the median run's
+    long max_rss_kb = 0;
+    for (int run = 0; run < run_count; run++)
+        if (costs[run].max_rss_kb > max_rss_kb)
+            max_rss_kb = costs[run].max_rss_kb;
+    qsort(costs, run_count, sizeof(run_cost_t), compare_walls);
+    const run_cost_t * p_median = &costs[run_count / 2];
+
+    putchar('{');
+    for (int index = 0; index < key_count; index++)
+        print_key(pp_keys[index]);
+    printf("\"runs\":%d,\"wall_s\":%.6f,\"wall_min_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f,\"max_rss_kb\":%ld,\"status\":%d}\n",
+           run_count, p_median->wall, costs[0].wall, p_median->user, p_median->system, max_rss_kb, failed_status);
+
+    return (0 == failed_status) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*** End of File ***/
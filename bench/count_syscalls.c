@@ -0,0 +1,276 @@
+/*************************************************
+ * Filename: count_syscalls.c
+ * Author: Jacob Pham (phamjac)
+ * Course: CS 374 - Operating Systems
+ *
+ * Description:
+ *   A tiny `strace -c -f`: runs one command under ptrace, counts every
+ *   system call it (and every thread or child it starts) makes, and
+ *   prints a single JSON line with the total plus the calls the file
+ *   programs care about (open/read/write/close/chmod and friends).
+ *   Same -i / -w / -k options and JSON shape as bench_run, so
+ *   run_bench.sh can put both kinds of lines in one results file.
+ *
+ *   Counting happens at syscall entry, so a call that fails still
+ *   counts. Tracing makes the command much slower; the counts are the
+ *   point here, not the time.
+ *
+ * How to Compile:
+ *   gcc --std=gnu99 -Wall -O2 -o count_syscalls count_syscalls.c
+ *
+ * How to Run:
+ *   ./count_syscalls -k bench=file_search -i menu.txt -w /tmp -- ./file_search
+ *   ./count_syscalls -- ./movies --query year=2008 movies_1k.csv
+ *   (-i stdin file, -w scratch dir, -k key=value copied into the JSON)
+ *
+ *************************************************/
+
+ #define _GNU_SOURCE
+ #include <stdio.h>      // for printf, fprintf, snprintf
+ #include <stdlib.h>     // for EXIT_SUCCESS, EXIT_FAILURE
+ #include <string.h>     // for strchr, strspn
+ #include <unistd.h>     // for fork, execvp, dup2, chdir
+ #include <fcntl.h>      // for open
+ #include <errno.h>      // for EINTR
+ #include <signal.h>     // for raise, SIGSTOP
+ #include <ftw.h>        // for nftw (cleaning up the -w directory)
+ #include <sys/ptrace.h> // for PTRACE_SYSCALL, PTRACE_GET_SYSCALL_INFO
+ #include <sys/stat.h>   // for mkdir
+ #include <sys/wait.h>   // for waitpid, __WALL
+ #include <sys/syscall.h> // for the SYS_ numbers
+
+ #define MAX_KEYS 32
+ #define MAX_SYSCALL 1024   // syscall numbers are well below this on every arch
+
+/* the calls worth reporting by name; everything else only goes into the total */
+typedef struct named_syscall
+{
+    long number;
+    const char * p_name;
+} named_syscall_t;
+
+static const named_syscall_t named_syscalls[] =
+{
+#ifdef SYS_open
+    { SYS_open, "open" },
+#endif
+    { SYS_openat, "openat" },
+    { SYS_read, "read" },
+    { SYS_write, "write" },
+    { SYS_pwrite64, "pwrite64" },
+    { SYS_close, "close" },
+#ifdef SYS_chmod
+    { SYS_chmod, "chmod" },
+#endif
+    { SYS_fchmod, "fchmod" },
+    { SYS_fchmodat, "fchmodat" },
+#ifdef SYS_stat
+    { SYS_stat, "stat" },
+#endif
+    { SYS_fstat, "fstat" },
+    { SYS_newfstatat, "newfstatat" },
+    { SYS_statx, "statx" },
+    { SYS_lseek, "lseek" },
+    { SYS_getdents64, "getdents64" },
+#ifdef SYS_mkdir
+    { SYS_mkdir, "mkdir" },
+#endif
+    { SYS_mkdirat, "mkdirat" },
+#ifdef SYS_rename
+    { SYS_rename, "rename" },
+#endif
+    { SYS_renameat2, "renameat2" },
+    { SYS_fsync, "fsync" },
+    { SYS_fdatasync, "fdatasync" },
+    { SYS_syncfs, "syncfs" },
+    { SYS_mmap, "mmap" },
+    { SYS_munmap, "munmap" },
+    { SYS_brk, "brk" },
+#ifdef SYS_io_uring_enter
+    { SYS_io_uring_enter, "io_uring_enter" },
+#endif
+    { SYS_clone, "clone" },
+};
+
+static int remove_entry(const char * p_path, const struct stat * p_stat, int type, struct FTW * p_ftw)
+{
+    (void) p_stat;
+    (void) type;
+    (void) p_ftw;
+    return remove(p_path);
+}
+
+/* key=value, with the value written as a number when it looks like one (same as bench_run) */
+static void print_key(const char * p_pair)
+{
+    const char * p_equals = strchr(p_pair, '=');
+    if (NULL == p_equals)
+        return;
+    const char * p_value = p_equals + 1;
+    int is_number = ('\0' != *p_value) && strspn(p_value, "0123456789.") == strlen(p_value);
+
+    printf("\"%.*s\":", (int) (p_equals - p_pair), p_pair);
+    if (is_number)
+    {
+        printf("%s,", p_value);
+        return;
+    }
+    putchar('"');
+    for (; '\0' != *p_value; p_value++)
+    {
+        if ('"' == *p_value || '\\' == *p_value)
+            putchar('\\');
+        putchar(*p_value);
+    }
+    printf("\",");
+}
+
+/* run the command under ptrace until every traced task is gone.
+   returns the command's exit status (128 + signal if it was killed), -1 if it couldn't start */
+static int trace_command(char ** pp_command, const char * p_stdin_path, const char * p_work_dir,
+                         unsigned long long * p_counts, unsigned long long * p_total)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (0 == pid)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+            dup2(null_fd, STDOUT_FILENO);
+        if (NULL != p_stdin_path)
+        {
+            int in_fd = open(p_stdin_path, O_RDONLY);
+            if (in_fd < 0 || dup2(in_fd, STDIN_FILENO) < 0)
+                _exit(126);
+        }
+        if (NULL != p_work_dir && chdir(p_work_dir) != 0)
+            _exit(126);
+
+        // stop so the parent can set the options before the exec
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execvp(pp_command[0], pp_command);
+        _exit(127);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+        return -1;
+
+    // follow every thread and child, and kill them all if we die
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK
+                 | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) options) != 0)
+        return -1;
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    int exit_status = -1;
+    while (1)
+    {
+        pid_t task = waitpid(-1, &status, __WALL);
+        if (task < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            break; // ECHILD: nothing left to trace
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            if (task == pid)
+                exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            continue;
+        }
+        if (!WIFSTOPPED(status))
+            continue;
+
+        int signal_number = WSTOPSIG(status);
+        int deliver = 0;
+
+        if ((SIGTRAP | 0x80) == signal_number)
+        {
+            // syscall stop: count it on the way in
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, task, (void *) sizeof(info), &info) > 0
+                && PTRACE_SYSCALL_INFO_ENTRY == info.op)
+            {
+                (*p_total)++;
+                if (info.entry.nr < MAX_SYSCALL)
+                    p_counts[info.entry.nr]++;
+            }
+        }
+        else if (SIGTRAP != signal_number && SIGSTOP != signal_number)
+        {
+            // a real signal for the program (the SIGTRAP/SIGSTOP ones come from the tracing itself)
+            deliver = signal_number;
+        }
+
+        ptrace(PTRACE_SYSCALL, task, NULL, (void *) (long) deliver);
+    }
+
+    return exit_status;
+}
+
+int main(int argc, char ** pp_args)
+{
+    const char * p_stdin_path = NULL;
+    const char * p_scratch = NULL;
+    const char * pp_keys[MAX_KEYS];
+    int key_count = 0;
+    int option;
+
+    while ((option = getopt(argc, pp_args, "+i:w:k:")) != -1)
+    {
+        if ('i' == option)
+            p_stdin_path = optarg;
+        else if ('w' == option)
+            p_scratch = optarg;
+        else if ('k' == option && key_count < MAX_KEYS)
+            pp_keys[key_count++] = optarg;
+        else
+            optind = argc + 1; // falls into the usage message below
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-i stdin file] [-w scratch dir] [-k key=value]... -- command [args]\n", pp_args[0]);
+        return EXIT_FAILURE;
+    }
+
+    char work_dir[4096];
+    const char * p_work_dir = NULL;
+    if (NULL != p_scratch)
+    {
+        snprintf(work_dir, sizeof(work_dir), "%s/count_syscalls.%d", p_scratch, (int) getpid());
+        if (mkdir(work_dir, 0700) != 0)
+        {
+            perror(work_dir);
+            return EXIT_FAILURE;
+        }
+        p_work_dir = work_dir;
+    }
+
+    static unsigned long long counts[MAX_SYSCALL];
+    unsigned long long total = 0;
+    int status = trace_command(pp_args + optind, p_stdin_path, p_work_dir, counts, &total);
+
+    if (NULL != p_work_dir)
+        nftw(p_work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (status < 0)
+    {
+        perror(pp_args[optind]);
+        return EXIT_FAILURE;
+    }
+
+    putchar('{');
+    for (int index = 0; index < key_count; index++)
+        print_key(pp_keys[index]);
+    printf("\"syscalls\":%llu", total);
+    for (size_t index = 0; index < sizeof(named_syscalls) / sizeof(named_syscalls[0]); index++)
+        printf(",\"%s\":%llu", named_syscalls[index].p_name, counts[named_syscalls[index].number]);
+    printf(",\"status\":%d}\n", status);
+
+    return (0 == status) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*** End of File ***/
@@ -0,0 +1,316 @@
+/*************************************************
+ * Filename: gen_movies.c
+ * Author: Jacob Pham (phamjac)
+ * Course: CS 374 - Operating Systems
+ *
+ * Description:
+ *   Makes synthetic movie catalogs in the same CSV format as
+ *   movies_sample_1.csv (Title,Year,Languages,Rating Value), anywhere
+ *   from a handful of rows to 100M+, so prog2 and prog3 can be timed at
+ *   sizes the sample files never reach.
+ *
+ *   The data is skewed the way a real catalog is: most movies are
+ *   recent (the year is drawn from a curve that piles up toward the
+ *   newest year), languages follow a Zipf-like curve with English far
+ *   ahead of the rest, ratings bunch up around 6.5, and a few titles are
+ *   long. A configurable share of titles need CSV quoting: a comma in
+ *   the title, "" escapes, or (off by default) a line break inside the
+ *   quotes.
+ *
+ *   The same seed always gives the same file, byte for byte.
+ *
+ * How to Compile:
+ *   gcc --std=gnu99 -Wall -O2 -o gen_movies gen_movies.c
+ *
+ * How to Run:
+ *   ./gen_movies -n 1000000 -o movies_1m.csv
+ *   ./gen_movies -n 100000 -q 5 -b 1 -s 7 > movies_quoted.csv
+ *   (-n rows, -s seed, -q % quoted titles, -b % titles with a line
+ *    break, -l % long titles, -y FIRST..LAST years, -o output file)
+ *
+ *************************************************/
+
+ #include <stdio.h>      // for fprintf, fwrite, fopen
+ #include <stdlib.h>     // for strtoll, atoi, EXIT_SUCCESS, EXIT_FAILURE
+ #include <string.h>     // for strlen, memcpy
+ #include <stdint.h>     // for uint64_t
+ #include <unistd.h>     // for getopt
+
+ #define OUTPUT_BUFFER_SIZE (1 << 20)
+ #define MAX_ROW_LENGTH 4096
+ #define MAX_LANGUAGES 5   // same cap as prog2
+ #define LONG_TITLE_WORDS 24
+
+/* what the command line asked for */
+typedef struct gen_options
+{
+    long long row_count;
+    uint64_t seed;
+    int quoted_percent;     // titles with a comma or a quote in them
+    int newline_percent;    // titles with a line break inside the quotes
+    int long_percent;       // titles LONG_TITLE_WORDS words long
+    int first_year;
+    int last_year;
+} gen_options_t;
+
+/* sorted by how often they show up */
+static const char * languages[] =
+{
+    "English", "French", "Spanish", "German", "Japanese", "Italian", "Mandarin", "Hindi",
+    "Russian", "Korean", "Portuguese", "Cantonese", "Arabic", "Swedish", "Danish", "Turkish",
+    "Polish", "Dutch", "Persian", "Hebrew", "Thai", "Greek", "Norwegian", "Czech",
+    "Hungarian", "Finnish", "Tamil", "Telugu", "Urdu", "Indonesian", "Romanian", "Vietnamese",
+    "Ukrainian", "Serbian", "Icelandic", "Tagalog", "Bengali", "Irish Gaelic", "Swahili", "Latin"
+};
+ #define LANGUAGE_COUNT ((int) (sizeof(languages) / sizeof(languages[0])))
+
+static const char * title_words[] =
+{
+    "The", "Last", "Night", "Dark", "Star", "Man", "Woman", "City", "Love", "War",
+    "King", "Queen", "Return", "Rise", "Fall", "Secret", "Lost", "World", "House", "Road",
+    "Ghost", "Shadow", "Blood", "Fire", "Ice", "Storm", "River", "Mountain", "Dream", "Game",
+    "Heart", "Story", "Life", "Death", "Moon", "Sun", "Island", "Ocean", "Empire", "Legend",
+    "Hunter", "Children", "Iron", "Silver", "Golden", "Red", "Blue", "Silent", "Wild", "Broken",
+    "Midnight", "Summer", "Winter", "Forgotten", "Hidden", "Final", "First", "Second", "Eternal", "Little",
+    "Big", "Long", "Short", "Great", "Strange", "Perfect", "Dangerous", "Crazy", "Sweet", "Cold"
+};
+ #define TITLE_WORD_COUNT ((int) (sizeof(title_words) / sizeof(title_words[0])))
+
+static double language_cumulative[LANGUAGE_COUNT];
+
+/* splitmix64: tiny, fast, and good enough for test data */
+static uint64_t next_random(uint64_t * p_state)
+{
+    uint64_t value = (*p_state += 0x9E3779B97F4A7C15ull);
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+/* uniform in [0, 1) */
+static double next_unit(uint64_t * p_state)
+{
+    return (double) (next_random(p_state) >> 11) / 9007199254740992.0;
+}
+
+/* uniform in [0, limit) */
+static int next_below(uint64_t * p_state, int limit)
+{
+    return (int) (next_unit(p_state) * limit);
+}
+
+/* Zipf weights (1/rank), summed up so a draw is a binary search */
+static void build_language_weights(void)
+{
+    double total = 0.0;
+    for (int index = 0; index < LANGUAGE_COUNT; index++)
+    {
+        total += 1.0 / (double) (index + 1);
+        language_cumulative[index] = total;
+    }
+    for (int index = 0; index < LANGUAGE_COUNT; index++)
+        language_cumulative[index] /= total;
+}
+
+static int pick_language(uint64_t * p_state)
+{
+    double draw = next_unit(p_state);
+    int low = 0;
+    int high = LANGUAGE_COUNT - 1;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (language_cumulative[middle] < draw)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/* recent years are much more common: u^3 piles up near 0, i.e. near last_year */
+static int pick_year(uint64_t * p_state, const gen_options_t * p_options)
+{
+    double draw = next_unit(p_state);
+    int span = p_options->last_year - p_options->first_year + 1;
+    return p_options->last_year - (int) (draw * draw * draw * span);
+}
+
+/* roughly bell shaped around 6.5 (sum of three uniforms), one decimal, 1.0 .. 9.9 */
+static int pick_rating_tenths(uint64_t * p_state)
+{
+    double sum = next_unit(p_state) + next_unit(p_state) + next_unit(p_state);
+    int tenths = (int) (65.0 + (sum - 1.5) * 30.0);
+    if (tenths < 10)
+        tenths = 10;
+    if (tenths > 99)
+        tenths = 99;
+    return tenths;
+}
+
+/* append text to a row buffer, doubling any '"' when the field is quoted */
+static size_t append_text(char * p_row, size_t length, const char * p_text, int is_quoted)
+{
+    for (const char * p_char = p_text; '\0' != *p_char && length < MAX_ROW_LENGTH - 8; p_char++)
+    {
+        if (is_quoted && '"' == *p_char)
+            p_row[length++] = '"';
+        p_row[length++] = *p_char;
+    }
+    return length;
+}
+
+/* one CSV row (with its '\n') into p_row, returns its length */
+static size_t make_row(char * p_row, long long row_number, uint64_t * p_state, const gen_options_t * p_options)
+{
+    size_t length = 0;
+
+    // title: a few words, sometimes many, sometimes a sequel number
+    int word_count = 1 + next_below(p_state, 4);
+    if (next_below(p_state, 100) < p_options->long_percent)
+        word_count = LONG_TITLE_WORDS + next_below(p_state, LONG_TITLE_WORDS);
+
+    int needs_newline = next_below(p_state, 100) < p_options->newline_percent;
+    int needs_quotes = needs_newline || next_below(p_state, 100) < p_options->quoted_percent;
+    if (needs_newline && word_count < 2)
+        word_count = 2; // somewhere to put the line break
+    int quote_kind = next_below(p_state, 3); // 0: comma, 1: "" escape, 2: both
+
+    if (needs_quotes)
+        p_row[length++] = '"';
+    for (int word = 0; word < word_count; word++)
+    {
+        if (word > 0)
+        {
+            if (needs_quotes && quote_kind != 1 && 1 == word)
+                length = append_text(p_row, length, ",", 1);
+            p_row[length++] = (needs_newline && word == word_count / 2) ? '\n' : ' ';
+        }
+        if (needs_quotes && quote_kind != 0 && word == word_count - 1)
+        {
+            length = append_text(p_row, length, "\"", 1);
+            length = append_text(p_row, length, title_words[next_below(p_state, TITLE_WORD_COUNT)], 1);
+            length = append_text(p_row, length, "\"", 1);
+        }
+        else
+            length = append_text(p_row, length, title_words[next_below(p_state, TITLE_WORD_COUNT)], needs_quotes);
+    }
+    // the row number keeps titles mostly unique without making them look generated
+    if (0 == row_number % 7)
+        length += (size_t) sprintf(p_row + length, " %lld", 2 + row_number % 5);
+    if (needs_quotes)
+        p_row[length++] = '"';
+
+    // year
+    length += (size_t) sprintf(p_row + length, ",%d,[", pick_year(p_state, p_options));
+
+    // languages: usually one or two, English first most of the time, no repeats
+    int language_count = 1;
+    int draw = next_below(p_state, 100);
+    if (draw >= 50)
+        language_count = (draw < 80) ? 2 : 3 + next_below(p_state, MAX_LANGUAGES - 2);
+    int picked[MAX_LANGUAGES];
+    int picked_count = 0;
+    for (int attempt = 0; picked_count < language_count && attempt < 4 * MAX_LANGUAGES; attempt++)
+    {
+        int language = pick_language(p_state);
+        int is_repeat = 0;
+        for (int index = 0; index < picked_count; index++)
+            is_repeat |= (picked[index] == language);
+        if (is_repeat)
+            continue;
+        if (picked_count > 0)
+            p_row[length++] = ';';
+        length = append_text(p_row, length, languages[language], 0);
+        picked[picked_count++] = language;
+    }
+
+    // rating, written like the sample file does: "7" rather than "7.0"
+    int tenths = pick_rating_tenths(p_state);
+    if (0 == tenths % 10)
+        length += (size_t) sprintf(p_row + length, "],%d\n", tenths / 10);
+    else
+        length += (size_t) sprintf(p_row + length, "],%d.%d\n", tenths / 10, tenths % 10);
+
+    return length;
+}
+
+/* "1990..2024" */
+static int parse_years(const char * p_text, gen_options_t * p_options)
+{
+    int first = 0;
+    int last = 0;
+    if (sscanf(p_text, "%d..%d", &first, &last) != 2 || first < 1000 || last > 9999 || first > last)
+        return -1;
+    p_options->first_year = first;
+    p_options->last_year = last;
+    return 0;
+}
+
+static void usage(const char * p_program)
+{
+    fprintf(stderr, "usage: %s [-n rows] [-s seed] [-q %%quoted] [-b %%line breaks] [-l %%long titles] "
+                    "[-y FIRST..LAST] [-o file]\n", p_program);
+}
+
+int main(int argc, char ** pp_args)
+{
+    gen_options_t options = { 1000, 374, 2, 0, 1, 1900, 2024 };
+    const char * p_out_path = NULL;
+    int option;
+
+    while ((option = getopt(argc, pp_args, "n:s:q:b:l:y:o:")) != -1)
+    {
+        if ('n' == option)
+            options.row_count = strtoll(optarg, NULL, 10);
+        else if ('s' == option)
+            options.seed = strtoull(optarg, NULL, 10);
+        else if ('q' == option)
+            options.quoted_percent = atoi(optarg);
+        else if ('b' == option)
+            options.newline_percent = atoi(optarg);
+        else if ('l' == option)
+            options.long_percent = atoi(optarg);
+        else if ('y' == option && parse_years(optarg, &options) == 0)
+            continue;
+        else if ('o' == option)
+            p_out_path = optarg;
+        else
+        {
+            usage(pp_args[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.row_count < 0 || optind != argc)
+    {
+        usage(pp_args[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE * p_out = stdout;
+    if (NULL != p_out_path && NULL == (p_out = fopen(p_out_path, "w")))
+    {
+        perror(p_out_path);
+        return EXIT_FAILURE;
+    }
+    setvbuf(p_out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    build_language_weights();
+    uint64_t state = options.seed;
+    char row[MAX_ROW_LENGTH];
+
+    fputs("Title,Year,Languages,Rating Value\n", p_out);
+    for (long long row_number = 0; row_number < options.row_count; row_number++)
+    {
+        size_t length = make_row(row, row_number, &state, &options);
+        fwrite(row, 1, length, p_out);
+    }
+
+    if (fflush(p_out) != 0 || (p_out != stdout && fclose(p_out) != 0))
+    {
+        perror("write");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+/*** End of File ***/
@@ -0,0 +1,250 @@
+#!/bin/bash
+#************************************************
+# Filename: run_bench.sh
+# Author: Jacob Pham (phamjac)
+# Course: CS 374 - Operating Systems
+#
+# Description:
+#   Benchmark suite for prog2 (movies) and prog3 (file_search) on
+#   synthetic catalogs made by gen_movies. For every catalog size it
+#   times, in each prog2 load mode (list, mmap, columnar, compact,
+#   threads, snapshot, stream):
+#     - the load by itself (a query that matches nothing)
+#     - each query the menu offers plus the top/rating ones, run
+#       QUERY_REPEAT times after the load; per_query_s is the time on
+#       top of the load divided by the repeats
+#   and it times file_search splitting the catalog into year files (from
+#   the menu and streamed from stdin with --input -), then runs the menu
+#   split once more under count_syscalls for its syscall counts.
+#
+#   Last, file_search --all splits MANY_FILES small catalogs into year,
+#   language and rating files with plain write() and with --uring;
+#   files_per_s is output files written per second of wall time.
+#
+#   Every measurement is one JSON line (see bench_run.c and
+#   count_syscalls.c) tagged with the
+#   commit, so results from two commits can be lined up with
+#   `run_bench.sh compare old.jsonl new.jsonl`.
+#
+#   Catalogs are cached in the data directory by size and seed, so only
+#   the first run pays for generating them.
+#
+# How to Run:
+#   bench/run_bench.sh -o results.jsonl
+#   bench/run_bench.sh -s "1000000 10000000 100000000" -r 5 -o big.jsonl
+#   bench/run_bench.sh compare before.jsonl after.jsonl
+#   (-s row counts, -r runs per measurement, -q query repeats,
+#    -d data/build dir, -o results file; -o - for stdout only)
+#
+#************************************************
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$BENCH_DIR/.." && pwd)
+
+SIZES="1000 10000 100000 1000000"
+RUNS=3
+QUERY_REPEAT=10
+SEED=374
+MANY_FILES=200                 # small catalogs for the --all output benchmark
+MANY_ROWS=2000
+DATA_DIR="${TMPDIR:-/tmp}/movies_bench"
+RESULTS="-"
+THRESHOLD=${THRESHOLD:-0.10}   # compare: flag anything this much slower (0.10 = 10%)
+
+# compare two results files: same bench/mode/rows/case, old vs new wall time
+# (or syscall count, for the count_syscalls lines)
+compare_results()
+{
+    awk -v threshold="$THRESHOLD" '
+        function field(line, name,    start, rest)
+        {
+            start = index(line, "\"" name "\":")
+            if (0 == start)
+                return ""
+            rest = substr(line, start + length(name) + 3)
+            sub(/^"/, "", rest)
+            sub(/["},].*$/, "", rest)
+            return rest
+        }
+        {
+            key = field($0, "bench") " " field($0, "mode") " " field($0, "rows") " " field($0, "case")
+            value = field($0, "wall_s")
+            if ("" == value)
+                value = field($0, "syscalls")
+            if (FILENAME == ARGV[1])
+                old[key] = value
+            else if (key in old)
+            {
+                ratio = (old[key] > 0) ? value / old[key] : 1
+                flag = (ratio > 1 + threshold) ? "SLOWER" : ((ratio < 1 - threshold) ? "faster" : "")
+                printf "%-60s %10.4f %10.4f %6.2fx %s\n", key, old[key], value, ratio, flag
+                if ("SLOWER" == flag)
+                    slower++
+            }
+        }
+        END { exit (slower > 0) }
+    ' "$1" "$2"
+}
+
+if [ "compare" = "$1" ]; then
+    if [ $# -ne 3 ]; then
+        echo "usage: $0 compare OLD.jsonl NEW.jsonl" >&2
+        exit 1
+    fi
+    compare_results "$2" "$3"
+    exit $?
+fi
+
+while getopts "s:r:q:d:o:" option; do
+    case $option in
+        s) SIZES="$OPTARG" ;;
+        r) RUNS="$OPTARG" ;;
+        q) QUERY_REPEAT="$OPTARG" ;;
+        d) DATA_DIR="$OPTARG" ;;
+        o) RESULTS="$OPTARG" ;;
+        *) echo "usage: $0 [-s \"rows ...\"] [-r runs] [-q query repeats] [-d dir] [-o results.jsonl]" >&2
+           exit 1 ;;
+    esac
+done
+
+BUILD_DIR="$DATA_DIR/build"
+SCRATCH_DIR="$DATA_DIR/scratch"
+mkdir -p "$BUILD_DIR" "$SCRATCH_DIR"
+
+# build everything with the same flags so commits are compared fairly
+echo "building into $BUILD_DIR" >&2
+gcc --std=gnu99 -Wall -O2 -o "$BUILD_DIR/gen_movies" "$BENCH_DIR/gen_movies.c"
+gcc --std=gnu99 -Wall -O2 -o "$BUILD_DIR/bench_run" "$BENCH_DIR/bench_run.c"
+gcc --std=gnu99 -Wall -O2 -o "$BUILD_DIR/count_syscalls" "$BENCH_DIR/count_syscalls.c"
+gcc --std=gnu99 -Wall -O2 -pthread -o "$BUILD_DIR/movies" "$REPO_DIR/prog2/phamjac_assignment2.c"
+gcc --std=gnu99 -Wall -O2 -pthread -o "$BUILD_DIR/file_search" "$REPO_DIR/prog3/phamjac_assignment3.c"
+
+COMMIT=$(git -C "$REPO_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+if ! git -C "$REPO_DIR" diff --quiet HEAD -- prog2 prog3 common 2>/dev/null; then
+    COMMIT="$COMMIT-dirty"
+fi
+THREADS=$(nproc)
+COMMON_KEYS=(-k "commit=$COMMIT" -k "cpus=$THREADS")
+
+if [ "-" != "$RESULTS" ]; then
+    : > "$RESULTS"
+fi
+
+# print a result line, and keep it in the results file too
+emit()
+{
+    echo "$1"
+    if [ "-" != "$RESULTS" ]; then
+        echo "$1" >> "$RESULTS"
+    fi
+}
+
+# wall_s out of a bench_run line
+wall_of()
+{
+    sed 's/.*"wall_s":\([0-9.]*\).*/\1/' <<< "$1"
+}
+
+# one measurement; a failing command is reported but doesn't stop the suite
+measure()
+{
+    "$BUILD_DIR/bench_run" -r "$RUNS" "${COMMON_KEYS[@]}" "$@" || true
+}
+
+MOVIE_MODES=("list:" "mmap:--mmap" "columnar:--columnar --mmap" "compact:--compact" "threads:--threads $THREADS"
+             "snapshot:--snapshot" "stream:--stream")
+QUERIES=("year=2008" "lang=French" "best-per-year" "top=100" "top-per-year=10" "rating=7.0..7.5")
+
+for ROWS in $SIZES; do
+    CSV="$DATA_DIR/movies_${ROWS}_${SEED}.csv"
+    if [ ! -s "$CSV" ]; then
+        echo "generating $ROWS rows" >&2
+        "$BUILD_DIR/gen_movies" -n "$ROWS" -s "$SEED" -o "$CSV"
+    fi
+    BYTES=$(stat -c %s "$CSV")
+    SIZE_KEYS=(-k "rows=$ROWS" -k "bytes=$BYTES")
+
+    for MODE in "${MOVIE_MODES[@]}"; do
+        NAME=${MODE%%:*}
+        read -r -a FLAGS <<< "${MODE#*:}"
+        echo "movies $NAME, $ROWS rows" >&2
+
+        # the snapshot is written by the first load; time the ones that reuse it
+        rm -f "$CSV.snap"
+        if [ "snapshot" = "$NAME" ]; then
+            "$BUILD_DIR/movies" "${FLAGS[@]}" --query year=1 "$CSV" > /dev/null
+        fi
+
+        LOAD=$(measure "${SIZE_KEYS[@]}" -k bench=movies -k "mode=$NAME" -k case=load \
+               -- "$BUILD_DIR/movies" "${FLAGS[@]}" --query year=1 "$CSV")
+        emit "$LOAD"
+        LOAD_WALL=$(wall_of "$LOAD")
+
+        for QUERY in "${QUERIES[@]}"; do
+            # the top/rating queries need the loaded indexes
+            if [ "stream" = "$NAME" ] && [[ "$QUERY" == top* || "$QUERY" == rating* ]]; then
+                continue
+            fi
+            # no query cache, or every repeat after the first is a copy: time the scans themselves
+            QUERY_ARGS=(--cache-size 0)
+            for ((repeat = 0; repeat < QUERY_REPEAT; repeat++)); do
+                QUERY_ARGS+=(--query "$QUERY")
+            done
+            LINE=$(measure "${SIZE_KEYS[@]}" -k bench=movies -k "mode=$NAME" -k "case=$QUERY" \
+                   -k "queries=$QUERY_REPEAT" -- "$BUILD_DIR/movies" "${FLAGS[@]}" "${QUERY_ARGS[@]}" "$CSV")
+            PER_QUERY=$(awk -v total="$(wall_of "$LINE")" -v load="$LOAD_WALL" -v count="$QUERY_REPEAT" \
+                        'BEGIN { cost = (total - load) / count; printf "%.6f", (cost > 0) ? cost : 0 }')
+            emit "${LINE%\}},\"per_query_s\":$PER_QUERY}"
+        done
+        rm -f "$CSV.snap"
+    done
+
+    # file_search: menu 1 (pick a file), 3 (by name), then 2 (exit)
+    echo "file_search, $ROWS rows" >&2
+    MENU="$SCRATCH_DIR/menu_$ROWS.txt"
+    printf '1\n3\n%s\n2\n' "$CSV" > "$MENU"
+    emit "$(measure "${SIZE_KEYS[@]}" -k bench=file_search -k mode=menu -k case=split-by-year \
+            -i "$MENU" -w "$SCRATCH_DIR" -- "$BUILD_DIR/file_search")"
+    # the same split with the csv on stdin, read in blocks as it comes
+    emit "$(measure "${SIZE_KEYS[@]}" -k bench=file_search -k mode=stdin -k case=split-by-year \
+            -i "$CSV" -w "$SCRATCH_DIR" -- "$BUILD_DIR/file_search" --input - --no-sync)"
+    emit "$("$BUILD_DIR/count_syscalls" "${COMMON_KEYS[@]}" "${SIZE_KEYS[@]}" -k bench=file_search -k mode=syscalls \
+            -k case=split-by-year -i "$MENU" -w "$SCRATCH_DIR" -- "$BUILD_DIR/file_search" || true)"
+done
+
+# file_search --all over lots of small catalogs: output-bound, thousands of small files
+MANY_DIR="$DATA_DIR/many_${MANY_FILES}_${MANY_ROWS}_${SEED}"
+mkdir -p "$MANY_DIR"
+for ((file = 1; file <= MANY_FILES; file++)); do
+    if [ ! -s "$MANY_DIR/movies_$file.csv" ]; then
+        "$BUILD_DIR/gen_movies" -n "$MANY_ROWS" -s "$((SEED + file))" -o "$MANY_DIR/movies_$file.csv"
+    fi
+done
+MANY_KEYS=(-k "rows=$((MANY_FILES * MANY_ROWS))" -k "inputs=$MANY_FILES")
+SPLIT_ARGS="--all --jobs 1 --no-sync --by year,language,rating" # scratch output, the write path is what is measured
+
+# how many files one split writes, so the wall time can be turned into files/s
+COUNT_DIR="$SCRATCH_DIR/count.$$"
+mkdir -p "$COUNT_DIR"
+(cd "$COUNT_DIR" && ln -s "$MANY_DIR"/movies_*.csv . && "$BUILD_DIR/file_search" $SPLIT_ARGS > /dev/null)
+OUTPUT_FILES=$(find "$COUNT_DIR" -path '*/phamjac.movies.*' -type f | wc -l)
+rm -rf "$COUNT_DIR"
+
+for BACKEND in posix uring; do
+    echo "file_search --all, $MANY_FILES files, $BACKEND" >&2
+    BACKEND_ARGS=""
+    if [ "uring" = "$BACKEND" ]; then
+        BACKEND_ARGS="--uring"
+    fi
+    LINE=$(measure "${MANY_KEYS[@]}" -k bench=file_search -k "mode=$BACKEND" -k case=many-small-files \
+           -k "files=$OUTPUT_FILES" -w "$SCRATCH_DIR" -- /bin/sh -c \
+           "ln -s '$MANY_DIR'/movies_*.csv . && exec '$BUILD_DIR/file_search' $SPLIT_ARGS $BACKEND_ARGS")
+    FILES_PER_S=$(awk -v wall="$(wall_of "$LINE")" -v files="$OUTPUT_FILES" \
+                  'BEGIN { printf "%.1f", (wall > 0) ? files / wall : 0 }')
+    emit "${LINE%\}},\"files_per_s\":$FILES_PER_S}"
+    emit "$("$BUILD_DIR/count_syscalls" "${COMMON_KEYS[@]}" "${MANY_KEYS[@]}" -k bench=file_search \
+            -k "mode=$BACKEND-syscalls" -k case=many-small-files -w "$SCRATCH_DIR" -- /bin/sh -c \
+            "ln -s '$MANY_DIR'/movies_*.csv . && exec '$BUILD_DIR/file_search' $SPLIT_ARGS $BACKEND_ARGS" || true)"
+done
@@ -0,0 +1,457 @@
+/*************************************************
+ * Filename: csv_tokenizer.h
+ * Author: Jacob Pham (phamjac)
+ * Course: CS 374 - Operating Systems
+ *
+ * Description:
+ *   RFC 4180 CSV tokenizer shared by the movies programs (prog2, prog3).
+ *   Header only, so every program keeps its one-file compile line:
+ *
+ *     #include "../common/csv_tokenizer.h"
+ *
+ *   Splitting a record happens in two steps:
+ *     csv_record_end()   finds the newline that ends a record, skipping
+ *                        newlines inside quoted fields
+ *     csv_split_record() cuts the record into field views (no copies)
+ *
+ *   Both look at 16 (SSE2) or 32 (AVX2) bytes per step: compare the
+ *   block against '\n' / '"' / ',' and walk the set bits of the masks.
+ *   A record without quotes (nearly all of them) never leaves that fast
+ *   path; only records with a quote go through the byte-by-byte state
+ *   machine. Quoted fields come back without their quotes and with
+ *   has_escapes set if they hold doubled quotes ("") that still need
+ *   csv_unescape().
+ *
+ *   Call csv_pick_kernels() once to use SSE2/AVX2 when the CPU has them.
+ *   Compile with -DCSV_NO_SIMD to force the plain C paths.
+ *   csv_tokenizer_bench.c measures all of this in GB/s.
+ *
+ *************************************************/
+
+ #ifndef CSV_TOKENIZER_H
+ #define CSV_TOKENIZER_H
+
+ #include <stdio.h>      // for FILE, getline
+ #include <stdlib.h>     // for realloc, free
+ #include <string.h>     // for memchr, memcpy
+ #include <sys/types.h>  // for ssize_t
+
+ #if (defined(__x86_64__) || defined(__i386__)) && !defined(CSV_NO_SIMD)
+ #define CSV_X86_SIMD
+ #include <immintrin.h>  // for the SSE2 / AVX2 kernels
+ #endif
+
+/* one field of a record. p_data points into the record: for a quoted field
+   it's the text between the quotes, which still has "" doubled if has_escapes */
+typedef struct csv_field
+{
+    const char * p_data;
+    size_t length;
+    int has_escapes;
+} csv_field_t;
+
+/* 0 = plain C, 1 = SSE2, 2 = AVX2. set by csv_pick_kernels() */
+static int csv_simd_level = 0;
+
+/* ---- finding the end of a record ---- */
+
+/* byte at a time: the first '\n' that isn't inside quotes, or p_end.
+   *p_in_quotes says whether p_begin is already inside a quoted field and
+   comes back as the state at the returned position */
+static inline const char * csv_record_end_scalar(const char * p_begin, const char * p_end, int * p_in_quotes)
+{
+    int in_quotes = *p_in_quotes;
+
+    for (const char * p_curr = p_begin; p_curr < p_end; p_curr++)
+    {
+        if ('"' == *p_curr)
+            in_quotes = !in_quotes; // "" inside a quoted field flips twice, so it works out
+        else if ('\n' == *p_curr && !in_quotes)
+        {
+            *p_in_quotes = 0;
+            return p_curr;
+        }
+    }
+
+    *p_in_quotes = in_quotes;
+    return p_end;
+}
+
+ #ifdef CSV_X86_SIMD
+/* walks the quote / newline bits of one block in order. returns the offset of
+   the ending newline, or -1 if the record keeps going past this block */
+static inline int csv_walk_record_bits(unsigned int newlines, unsigned int quotes, int * p_in_quotes)
+{
+    unsigned int bits = newlines | quotes;
+
+    while (bits)
+    {
+        int offset = __builtin_ctz(bits);
+        unsigned int bit = 1u << offset;
+
+        if (quotes & bit)
+            *p_in_quotes = !*p_in_quotes;
+        else if (!*p_in_quotes)
+            return offset;
+        bits &= bits - 1;
+    }
+    return -1;
+}
+
+static inline const char * csv_record_end_sse2(const char * p_begin, const char * p_end, int * p_in_quotes)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i quote = _mm_set1_epi8('"');
+    const char * p_curr = p_begin;
+
+    for (; p_curr + 16 <= p_end; p_curr += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *) p_curr);
+        unsigned int newlines = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        unsigned int quotes = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, quote));
+
+        // the usual case: no quotes around, first newline ends it
+        if (0 == quotes && !*p_in_quotes)
+        {
+            if (newlines)
+                return p_curr + __builtin_ctz(newlines);
+            continue;
+        }
+
+        int offset = csv_walk_record_bits(newlines, quotes, p_in_quotes);
+        if (offset >= 0)
+            return p_curr + offset;
+    }
+
+    return csv_record_end_scalar(p_curr, p_end, p_in_quotes);
+}
+
+__attribute__((target("avx2")))
+static inline const char * csv_record_end_avx2(const char * p_begin, const char * p_end, int * p_in_quotes)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const char * p_curr = p_begin;
+
+    for (; p_curr + 32 <= p_end; p_curr += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *) p_curr);
+        unsigned int newlines = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+        unsigned int quotes = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, quote));
+
+        if (0 == quotes && !*p_in_quotes)
+        {
+            if (newlines)
+                return p_curr + __builtin_ctz(newlines);
+            continue;
+        }
+
+        int offset = csv_walk_record_bits(newlines, quotes, p_in_quotes);
+        if (offset >= 0)
+            return p_curr + offset;
+    }
+
+    return csv_record_end_scalar(p_curr, p_end, p_in_quotes);
+}
+ #endif
+
+/* end of the record that starts at p_begin: its '\n' (not inside quotes), or p_end.
+   p_in_quotes may be NULL when p_begin is the start of a record */
+static inline const char * csv_record_end(const char * p_begin, const char * p_end, int * p_in_quotes)
+{
+    int in_quotes = 0;
+    if (NULL == p_in_quotes)
+        p_in_quotes = &in_quotes;
+
+ #ifdef CSV_X86_SIMD
+    if (2 == csv_simd_level)
+        return csv_record_end_avx2(p_begin, p_end, p_in_quotes);
+    if (1 == csv_simd_level)
+        return csv_record_end_sse2(p_begin, p_end, p_in_quotes);
+ #endif
+    return csv_record_end_scalar(p_begin, p_end, p_in_quotes);
+}
+
+/* how many '"' there are in [p_begin, p_begin + length). an odd count means
+   a quoted field is still open at the end (that's how the parallel loader
+   finds out whether a chunk cut landed inside quotes) */
+static inline size_t csv_count_quotes(const char * p_begin, size_t length)
+{
+    const char * p_curr = p_begin;
+    const char * p_end = p_begin + length;
+    size_t count = 0;
+
+ #ifdef CSV_X86_SIMD
+    if (csv_simd_level >= 1)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        for (; p_curr + 16 <= p_end; p_curr += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *) p_curr);
+            count += (size_t) __builtin_popcount((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, quote)));
+        }
+    }
+ #endif
+
+    for (; p_curr < p_end; p_curr++)
+        count += ('"' == *p_curr);
+    return count;
+}
+
+/* ---- splitting a record into fields ---- */
+
+/* the slow path: any record with a quote in it. a field that starts with '"'
+   runs to the matching closing quote ("" is an escaped quote, not the end);
+   anything between that and the next comma is ignored. a quote in the middle
+   of an unquoted field is just a character */
+static inline int csv_split_quoted(const char * p_record, size_t length, csv_field_t * p_fields, int max_fields)
+{
+    const char * p_curr = p_record;
+    const char * p_end = p_record + length;
+    int count = 0;
+
+    while (count < max_fields)
+    {
+        csv_field_t * p_field = &p_fields[count++];
+        p_field->has_escapes = 0;
+
+        if (p_curr < p_end && '"' == *p_curr)
+        {
+            p_curr++;
+            p_field->p_data = p_curr;
+            while (p_curr < p_end)
+            {
+                if ('"' == *p_curr)
+                {
+                    if (p_curr + 1 < p_end && '"' == p_curr[1])
+                    {
+                        p_field->has_escapes = 1;
+                        p_curr += 2;
+                        continue;
+                    }
+                    break;
+                }
+                p_curr++;
+            }
+            p_field->length = (size_t) (p_curr - p_field->p_data);
+
+            const char * p_comma = memchr(p_curr, ',', (size_t) (p_end - p_curr));
+            p_curr = (NULL == p_comma) ? p_end : p_comma;
+        }
+        else
+        {
+            const char * p_comma = memchr(p_curr, ',', (size_t) (p_end - p_curr));
+            p_field->p_data = p_curr;
+            p_curr = (NULL == p_comma) ? p_end : p_comma;
+            p_field->length = (size_t) (p_curr - p_field->p_data);
+        }
+
+        // no comma after this field, it was the last one
+        if (p_curr >= p_end)
+            break;
+        p_curr++;
+    }
+
+    return count;
+}
+
+/* fast path for a record with no quotes: every comma is a field break */
+static inline int csv_split_plain_scalar(const char * p_record, size_t length, csv_field_t * p_fields, int max_fields)
+{
+    const char * p_curr = p_record;
+    const char * p_end = p_record + length;
+    int count = 0;
+
+    while (count < max_fields)
+    {
+        const char * p_comma = memchr(p_curr, ',', (size_t) (p_end - p_curr));
+        const char * p_field_end = (NULL == p_comma) ? p_end : p_comma;
+
+        p_fields[count].p_data = p_curr;
+        p_fields[count].length = (size_t) (p_field_end - p_curr);
+        p_fields[count].has_escapes = 0;
+        count++;
+
+        if (NULL == p_comma)
+            break;
+        p_curr = p_comma + 1;
+    }
+
+    return count;
+}
+
+ #ifdef CSV_X86_SIMD
+/* fast path, 16 bytes a step: one compare finds every comma in the block,
+   then each set bit closes a field. returns -1 if it ran into a quote after all */
+static inline int csv_split_plain_sse2(const char * p_record, size_t length, csv_field_t * p_fields, int max_fields)
+{
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const char * p_end = p_record + length;
+    const char * p_block = p_record;
+    const char * p_field = p_record;
+    int count = 0;
+
+    for (; p_block + 16 <= p_end; p_block += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *) p_block);
+        unsigned int commas = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, comma));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, quote)))
+            return -1;
+
+        while (commas)
+        {
+            const char * p_comma = p_block + __builtin_ctz(commas);
+            p_fields[count].p_data = p_field;
+            p_fields[count].length = (size_t) (p_comma - p_field);
+            p_fields[count].has_escapes = 0;
+            p_field = p_comma + 1;
+            if (++count == max_fields)
+                return count;
+            commas &= commas - 1;
+        }
+    }
+
+    // fewer than 16 bytes left
+    if (NULL != memchr(p_block, '"', (size_t) (p_end - p_block)))
+        return -1;
+    return count + csv_split_plain_scalar(p_field, (size_t) (p_end - p_field), p_fields + count, max_fields - count);
+}
+
+/* same thing, 32 bytes a step */
+__attribute__((target("avx2")))
+static inline int csv_split_plain_avx2(const char * p_record, size_t length, csv_field_t * p_fields, int max_fields)
+{
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const char * p_end = p_record + length;
+    const char * p_block = p_record;
+    const char * p_field = p_record;
+    int count = 0;
+
+    for (; p_block + 32 <= p_end; p_block += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *) p_block);
+        unsigned int commas = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, comma));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, quote)))
+            return -1;
+
+        while (commas)
+        {
+            const char * p_comma = p_block + __builtin_ctz(commas);
+            p_fields[count].p_data = p_field;
+            p_fields[count].length = (size_t) (p_comma - p_field);
+            p_fields[count].has_escapes = 0;
+            p_field = p_comma + 1;
+            if (++count == max_fields)
+                return count;
+            commas &= commas - 1;
+        }
+    }
+
+    // the rest is under 32 bytes, SSE2 can take a 16 byte bite of it
+    int rest = csv_split_plain_sse2(p_block, (size_t) (p_end - p_block), p_fields + count, max_fields - count);
+    if (rest < 0)
+        return -1;
+
+    // the first field of the rest really started back at p_field
+    if (rest > 0)
+    {
+        p_fields[count].length += (size_t) (p_fields[count].p_data - p_field);
+        p_fields[count].p_data = p_field;
+    }
+    return count + rest;
+}
+ #endif
+
+/* split one record (no trailing newline) into at most max_fields fields.
+   returns how many it found. fields past max_fields are ignored */
+static inline int csv_split_record(const char * p_record, size_t length, csv_field_t * p_fields, int max_fields)
+{
+    if (max_fields < 1)
+        return 0;
+
+ #ifdef CSV_X86_SIMD
+    int count = -1;
+    if (2 == csv_simd_level)
+        count = csv_split_plain_avx2(p_record, length, p_fields, max_fields);
+    else if (1 == csv_simd_level)
+        count = csv_split_plain_sse2(p_record, length, p_fields, max_fields);
+    else if (NULL == memchr(p_record, '"', length))
+        count = csv_split_plain_scalar(p_record, length, p_fields, max_fields);
+    if (count >= 0)
+        return count;
+ #else
+    if (NULL == memchr(p_record, '"', length))
+        return csv_split_plain_scalar(p_record, length, p_fields, max_fields);
+ #endif
+
+    return csv_split_quoted(p_record, length, p_fields, max_fields);
+}
+
+/* copy a field to p_out with "" turned back into ". p_out needs field length
+   bytes; it may be the field's own text (unescaping in place only shrinks it).
+   returns the new length */
+static inline size_t csv_unescape(const csv_field_t * p_field, char * p_out)
+{
+    size_t out_length = 0;
+
+    for (size_t index = 0; index < p_field->length; index++)
+    {
+        p_out[out_length++] = p_field->p_data[index];
+        if ('"' == p_field->p_data[index] && index + 1 < p_field->length && '"' == p_field->p_data[index + 1])
+            index++;
+    }
+    return out_length;
+}
+
+/* getline() for CSV: keeps reading lines while a quoted field is still open,
+   so one call returns one whole record (newline included, like getline) */
+static inline ssize_t csv_getline(char ** pp_line, size_t * p_capacity, FILE * p_file)
+{
+    ssize_t length = getline(pp_line, p_capacity, p_file);
+    if (length <= 0)
+        return length;
+
+    size_t quotes = csv_count_quotes(*pp_line, (size_t) length);
+    if (0 == (quotes & 1))
+        return length;
+
+    // rare: a quoted field spans lines, glue the next ones on until the quotes balance
+    char * p_more = NULL;
+    size_t more_capacity = 0;
+    ssize_t more;
+    while ((quotes & 1) && (more = getline(&p_more, &more_capacity, p_file)) > 0)
+    {
+        if ((size_t) (length + more) + 1 > *p_capacity)
+        {
+            char * p_grown = realloc(*pp_line, (size_t) (length + more) + 1);
+            if (NULL == p_grown)
+                break;
+            *pp_line = p_grown;
+            *p_capacity = (size_t) (length + more) + 1;
+        }
+        memcpy(*pp_line + length, p_more, (size_t) more + 1);
+        quotes += csv_count_quotes(p_more, (size_t) more);
+        length += more;
+    }
+    free(p_more);
+    return length;
+}
+
+/* use SSE2 / AVX2 from here on if the CPU has them */
+static inline void csv_pick_kernels(void)
+{
+ #ifdef CSV_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        csv_simd_level = 2;
+    else if (__builtin_cpu_supports("sse2"))
+        csv_simd_level = 1;
+ #else
+    csv_simd_level = 0; // -DCSV_NO_SIMD: plain C only
+ #endif
+}
+
+ #endif // CSV_TOKENIZER_H
+/*** End of File ***/
@@ -0,0 +1,197 @@
+/*************************************************
+ * Filename: csv_tokenizer_bench.c
+ * Author: Jacob Pham (phamjac)
+ * Course: CS 374 - Operating Systems
+ *
+ * Description:
+ *   Throughput benchmark for csv_tokenizer.h. Maps a CSV, then splits
+ *   every record into fields over and over with each kernel (plain C,
+ *   SSE2, AVX2 -- whichever the CPU has) and with the old
+ *   line-copy + strtok_r loop, and prints GB/s for each. Every kernel
+ *   has to come up with the same record / field counts, so it doubles
+ *   as a quick check that the SIMD paths agree with the plain one.
+ *
+ * How to Compile:
+ *   gcc --std=gnu99 -Wall -O2 -o csv_tokenizer_bench csv_tokenizer_bench.c
+ *
+ * How to Run:
+ *   ./csv_tokenizer_bench ../prog2/movies_sample_1.csv 200
+ *   (second argument = passes over the file per kernel, default 20)
+ *
+ *************************************************/
+
+ #include <stdio.h>      // for printf, fprintf
+ #include <stdlib.h>     // for malloc, free, atoi, EXIT_SUCCESS, EXIT_FAILURE
+ #include <string.h>     // for memcpy, strtok_r
+ #include <fcntl.h>      // for open
+ #include <unistd.h>     // for close
+ #include <time.h>       // for clock_gettime
+ #include <sys/mman.h>   // for mmap
+ #include <sys/stat.h>   // for fstat
+ #include "csv_tokenizer.h"
+
+ #define MAX_FIELDS 16
+
+/* what one pass found, so the kernels can be checked against each other */
+typedef struct pass_totals
+{
+    long long records;
+    long long fields;
+    long long field_bytes;
+} pass_totals_t;
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* one pass with the tokenizer at whatever csv_simd_level is set to */
+static void tokenize_pass(const char * p_data, size_t length, pass_totals_t * p_totals)
+{
+    const char * p_curr = p_data;
+    const char * p_end = p_data + length;
+    csv_field_t fields[MAX_FIELDS];
+
+    while (p_curr < p_end)
+    {
+        const char * p_record_end = csv_record_end(p_curr, p_end, NULL);
+        int count = csv_split_record(p_curr, (size_t) (p_record_end - p_curr), fields, MAX_FIELDS);
+
+        p_totals->records++;
+        p_totals->fields += count;
+        for (int index = 0; index < count; index++)
+            p_totals->field_bytes += (long long) fields[index].length;
+
+        p_curr = p_record_end + 1;
+    }
+}
+
+/* one pass the way the loaders used to do it: copy the line out, strtok_r on ',' */
+static void strtok_pass(const char * p_data, size_t length, char * p_line, pass_totals_t * p_totals)
+{
+    const char * p_curr = p_data;
+    const char * p_end = p_data + length;
+
+    while (p_curr < p_end)
+    {
+        const char * p_newline = memchr(p_curr, '\n', (size_t) (p_end - p_curr));
+        const char * p_line_end = (NULL == p_newline) ? p_end : p_newline;
+        size_t line_length = (size_t) (p_line_end - p_curr);
+
+        memcpy(p_line, p_curr, line_length);
+        p_line[line_length] = '\0';
+
+        char * p_save_ptr = NULL;
+        p_totals->records++;
+        for (char * p_token = strtok_r(p_line, ",", &p_save_ptr); NULL != p_token; p_token = strtok_r(NULL, ",", &p_save_ptr))
+        {
+            p_totals->fields++;
+            p_totals->field_bytes += (long long) strlen(p_token);
+        }
+
+        p_curr = p_line_end + 1;
+    }
+}
+
+static void report(const char * p_name, size_t length, int repeats, double best, const pass_totals_t * p_totals)
+{
+    printf("%-16s %8.3f GB/s  %10.2f ms/pass  %lld records  %lld fields\n", p_name,
+           (double) length / best / 1e9, best * 1e3, p_totals->records / repeats, p_totals->fields / repeats);
+}
+
+int main(int argc, char ** pp_args)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s FILE.csv [passes]\n", pp_args[0]);
+        return EXIT_FAILURE;
+    }
+    int repeats = (argc > 2) ? atoi(pp_args[2]) : 20;
+    if (repeats < 1)
+        repeats = 1;
+
+    int fd = open(pp_args[1], O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || 0 == file_stat.st_size)
+    {
+        fprintf(stderr, "couldn't open %s (or it's empty)\n", pp_args[1]);
+        return EXIT_FAILURE;
+    }
+    size_t length = (size_t) file_stat.st_size;
+    const char * p_data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == (void *) p_data)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    // the longest line bounds the strtok_r copy buffer
+    char * p_line = malloc(length + 1);
+    if (NULL == p_line)
+    {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %zu bytes, %d passes per kernel, best pass shown\n", pp_args[1], length, repeats);
+
+    // which kernels this CPU can run
+    csv_pick_kernels();
+    int best_level = csv_simd_level;
+    static const char * kernel_names[] = { "tokenizer C", "tokenizer SSE2", "tokenizer AVX2" };
+
+    pass_totals_t reference;
+    memset(&reference, 0, sizeof(reference));
+    int mismatch = 0;
+
+    for (int level = 0; level <= best_level; level++)
+    {
+        pass_totals_t totals;
+        memset(&totals, 0, sizeof(totals));
+        double best = 1e30;
+
+        csv_simd_level = level;
+        for (int pass = 0; pass < repeats; pass++)
+        {
+            double start = now_seconds();
+            tokenize_pass(p_data, length, &totals);
+            double elapsed = now_seconds() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+        report(kernel_names[level], length, repeats, best, &totals);
+
+        if (0 == level)
+            reference = totals;
+        else if (totals.records != reference.records || totals.fields != reference.fields
+                 || totals.field_bytes != reference.field_bytes)
+            mismatch = 1;
+    }
+
+    pass_totals_t totals;
+    memset(&totals, 0, sizeof(totals));
+    double best = 1e30;
+    for (int pass = 0; pass < repeats; pass++)
+    {
+        double start = now_seconds();
+        strtok_pass(p_data, length, p_line, &totals);
+        double elapsed = now_seconds() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    report("strtok_r", length, repeats, best, &totals);
+
+    free(p_line);
+    munmap((void *) p_data, length);
+
+    if (mismatch)
+    {
+        fprintf(stderr, "the SIMD kernels disagree with the plain C one!\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+/*** End of File ***/
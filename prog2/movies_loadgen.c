@@ -0,0 +1,272 @@
+/*************************************************
+ * Filename: movies_loadgen.c
+ * Author: Jacob Pham (phamjac)
+ * Course: CS 374 - Operating Systems
+ * Assignment: Programming Assignment 2 - Movies (server load generator)
+ *
+ * Description:
+ *   Hammers a `./movies --serve PATH` server with queries and reports
+ *   throughput (QPS) and latency percentiles. Every connection runs on
+ *   its own thread and keeps up to --depth requests in flight (pipelined
+ *   on the one socket), cycling through the queries given with -q.
+ *
+ * How to Compile:
+ *   gcc --std=gnu99 -Wall -pthread -o movies_loadgen movies_loadgen.c
+ *
+ * How to Run:
+ *   ./movies --serve /tmp/movies.sock movies_sample_1.csv &
+ *   ./movies_loadgen -c 8 -n 20000 -d 16 -q year=2008 -q lang=French /tmp/movies.sock
+ *
+ *************************************************/
+
+ #define _GNU_SOURCE
+ #include <stdio.h>      // for printf, fprintf
+ #include <stdlib.h>     // for calloc, qsort, atoi, EXIT_SUCCESS, EXIT_FAILURE
+ #include <string.h>     // for strlen, memchr, memmove
+ #include <unistd.h>     // for getopt, read, write, close
+ #include <errno.h>      // for EINTR
+ #include <time.h>       // for clock_gettime
+ #include <pthread.h>    // one thread per connection
+ #include <sys/socket.h> // for socket, connect
+ #include <sys/un.h>     // for sockaddr_un
+
+ #define MAX_QUERIES 64
+ #define READ_BUFFER_SIZE (64 * 1024)
+
+/* what one connection thread needs, and what it reports back */
+typedef struct connection_run
+{
+    const char * p_socket_path;
+    const char ** pp_queries;
+    int query_count;
+    int request_count;      // requests to send on this connection
+    int depth;              // max requests in flight at once
+    int first_query;        // so the connections don't all send the same query at once
+    double * p_latencies;   // microseconds, one per request
+    int completed;
+    int error_replies;      // replies that came back with an "error" field
+    int failed;             // couldn't connect / connection dropped
+} connection_run_t;
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* write all of it (short writes happen on sockets) */
+static int write_all(int fd, const char * p_data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, p_data, length);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        p_data += written;
+        length -= (size_t) written;
+    }
+    return 0;
+}
+
+/* thread body: keep the pipeline full until every request has its reply */
+static void * run_connection(void * p_arg)
+{
+    connection_run_t * p_run = p_arg;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, p_run->p_socket_path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        perror("connect");
+        if (fd >= 0)
+            close(fd);
+        p_run->failed = 1;
+        return NULL;
+    }
+
+    double * p_sent_at = calloc(p_run->request_count, sizeof(double));
+    char * p_buffer = malloc(READ_BUFFER_SIZE);
+    size_t buffered = 0;
+    int sent = 0;
+
+    while (NULL != p_sent_at && NULL != p_buffer && p_run->completed < p_run->request_count)
+    {
+        // top the pipeline back up
+        while (sent < p_run->request_count && sent - p_run->completed < p_run->depth)
+        {
+            const char * p_query = p_run->pp_queries[(p_run->first_query + sent) % p_run->query_count];
+            char line[512];
+            int length = snprintf(line, sizeof(line), "%s\n", p_query);
+
+            p_sent_at[sent] = now_seconds();
+            if (write_all(fd, line, (size_t) length) != 0)
+            {
+                p_run->failed = 1;
+                break;
+            }
+            sent++;
+        }
+        if (p_run->failed)
+            break;
+
+        // a big reply (best-per-year) might not fit, so the buffer only keeps the unfinished tail
+        ssize_t got = read(fd, p_buffer + buffered, READ_BUFFER_SIZE - buffered);
+        if (got < 0 && EINTR == errno)
+            continue;
+        if (got <= 0)
+        {
+            p_run->failed = 1;
+            break;
+        }
+        buffered += (size_t) got;
+
+        double now = now_seconds();
+        char * p_line = p_buffer;
+        char * p_end = p_buffer + buffered;
+        char * p_newline;
+        while ((p_newline = memchr(p_line, '\n', (size_t) (p_end - p_line))) != NULL)
+        {
+            // replies come back in request order, so reply n belongs to request n
+            if (memmem(p_line, (size_t) (p_newline - p_line), "\"error\"", 7) != NULL)
+                p_run->error_replies++;
+            p_run->p_latencies[p_run->completed] = (now - p_sent_at[p_run->completed]) * 1e6;
+            p_run->completed++;
+            p_line = p_newline + 1;
+        }
+
+        // keep the partial line; if one line fills the whole buffer just keep its last byte
+        buffered = (size_t) (p_end - p_line);
+        if (buffered == READ_BUFFER_SIZE)
+        {
+            p_line = p_end - 1;
+            buffered = 1;
+        }
+        memmove(p_buffer, p_line, buffered);
+    }
+
+    free(p_sent_at);
+    free(p_buffer);
+    close(fd);
+    return NULL;
+}
+
+static int compare_doubles(const void * p_left, const void * p_right)
+{
+    double left = *(const double *) p_left;
+    double right = *(const double *) p_right;
+    return (left > right) - (left < right);
+}
+
+/* value at a percentile of an already sorted array */
+static double percentile(const double * p_sorted, int count, double fraction)
+{
+    int index = (int) (fraction * (count - 1) + 0.5);
+    return p_sorted[index];
+}
+
+int main(int argc, char ** pp_args)
+{
+    int connection_count = 4;
+    int request_count = 10000;
+    int depth = 8;
+    const char * pp_queries[MAX_QUERIES];
+    int query_count = 0;
+    int option;
+
+    while ((option = getopt(argc, pp_args, "c:n:d:q:")) != -1)
+    {
+        if ('c' == option)
+            connection_count = atoi(optarg);
+        else if ('n' == option)
+            request_count = atoi(optarg);
+        else if ('d' == option)
+            depth = atoi(optarg);
+        else if ('q' == option && query_count < MAX_QUERIES)
+            pp_queries[query_count++] = optarg;
+        else
+        {
+            fprintf(stderr, "usage: %s [-c connections] [-n requests per connection] [-d pipeline depth] [-q query]... SOCKET\n", pp_args[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || connection_count < 1 || request_count < 1 || depth < 1)
+    {
+        fprintf(stderr, "usage: %s [-c connections] [-n requests per connection] [-d pipeline depth] [-q query]... SOCKET\n", pp_args[0]);
+        return EXIT_FAILURE;
+    }
+
+    // default mix: the two cheap lookups the dashboards fire most
+    if (0 == query_count)
+    {
+        pp_queries[query_count++] = "year=2008";
+        pp_queries[query_count++] = "lang=English";
+    }
+
+    connection_run_t * p_runs = calloc(connection_count, sizeof(connection_run_t));
+    pthread_t * p_threads = calloc(connection_count, sizeof(pthread_t));
+    double * p_all = calloc((size_t) connection_count * request_count, sizeof(double));
+    if (NULL == p_runs || NULL == p_threads || NULL == p_all)
+    {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    double start = now_seconds();
+    for (int index = 0; index < connection_count; index++)
+    {
+        p_runs[index].p_socket_path = pp_args[optind];
+        p_runs[index].pp_queries = pp_queries;
+        p_runs[index].query_count = query_count;
+        p_runs[index].request_count = request_count;
+        p_runs[index].depth = depth;
+        p_runs[index].first_query = index;
+        p_runs[index].p_latencies = p_all + (size_t) index * request_count;
+        pthread_create(&p_threads[index], NULL, run_connection, &p_runs[index]);
+    }
+
+    int completed = 0;
+    int errors = 0;
+    int failed = 0;
+    for (int index = 0; index < connection_count; index++)
+    {
+        pthread_join(p_threads[index], NULL);
+
+        // pack the finished latencies together for sorting
+        memmove(p_all + completed, p_runs[index].p_latencies, p_runs[index].completed * sizeof(double));
+        completed += p_runs[index].completed;
+        errors += p_runs[index].error_replies;
+        failed += p_runs[index].failed;
+    }
+    double elapsed = now_seconds() - start;
+
+    if (0 == completed)
+    {
+        fprintf(stderr, "no replies received\n");
+        return EXIT_FAILURE;
+    }
+
+    qsort(p_all, completed, sizeof(double), compare_doubles);
+
+    printf("connections %d  depth %d  requests %d  error replies %d  failed connections %d\n",
+           connection_count, depth, completed, errors, failed);
+    printf("elapsed %.3f s  qps %.0f\n", elapsed, completed / elapsed);
+    printf("latency us  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(p_all, completed, 0.50), percentile(p_all, completed, 0.90),
+           percentile(p_all, completed, 0.99), p_all[completed - 1]);
+
+    free(p_runs);
+    free(p_threads);
+    free(p_all);
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*** End of File ***/
@@ -9,15 +9,114 @@
  *   linked list of `movie_t` structs dynamically. It then offers a menu 
  *   interface for querying by release year, language, or by best-rated
  *   movie per year
+ *
+ *   While loading, every movie is also filed into a per-year index
+ *   (year_index_t) so the year queries don't rescan the whole list.
+ *   Languages are interned in a dictionary (lang_dict_t): each distinct
+ *   language is stored once, movies keep small ids, and every language
+ *   has a posting list of the movies that list it.
+ *
+ *   With --columnar the movies are stored column by column instead
+ *   (movie_columns_t: year[], rating[], title offsets, language ids)
+ *   and the year / language filters are SIMD scans over those columns
+ *   (AVX2 or SSE2 when the CPU has them, plain C otherwise).
+ *
+ *   With --compact every movie is one fixed-width 20-byte record
+ *   (compact_movie_t: 16-bit year, rating in tenths in one byte, language
+ *   ids, 32-bit offset into a title pool) in a single array, no pointers.
+ *   The year / language filters are straight scans over that array.
+ *   Ratings are kept to one decimal, which is all the data has.
+ *   --stats reports the bytes each layout holds as storage_bytes, and
+ *   bench/run_bench.sh times the queries in all three.
+ *
+ *   With --mmap the CSV is memory-mapped instead of read with getline,
+ *   and titles are (pointer, length) views into the mapping rather than
+ *   copies, so loading costs roughly the page faults and concurrent runs
+ *   share the page cache.
+ *
+ *   With --threads N the mapping is cut into N chunks at line breaks,
+ *   each chunk is parsed by its own thread into a partial store, and the
+ *   partial stores are merged in chunk order so the result (and every
+ *   query's output) is the same as a single-threaded load.
+ *
+ *   With --snapshot the columnar store is saved next to the CSV as
+ *   <file>.snap (columns, title pool, language names, year index) after
+ *   the first load. Later runs mmap the snapshot and skip parsing until
+ *   the CSV's size or mtime changes.
+ *
+ *   With --query / --batch there's no menu: every query (year=YYYY,
+ *   best-per-year, lang=NAME, top=N, top-per-year=K, rating=LO..HI) runs
+ *   against the one loaded dataset and the results come out as TSV
+ *   (default) or JSON lines (--format json) through one big buffered writer.
+ *   The top/rating queries come from a rating-sorted copy of the row
+ *   numbers built at load time plus a small top-32 heap per year, so they
+ *   never scan the whole dataset.
+ *
+ *   With --serve PATH it loads once and answers the same queries over a
+ *   unix socket instead: one request per line, one JSON line back per
+ *   request, in order, pipelining allowed. An epoll loop handles the
+ *   sockets and a pool of --workers threads runs the queries.
+ *   movies_loadgen.c is a load generator for it. Add --watch and the
+ *   server follows the CSV with inotify: rows appended to it are parsed
+ *   (just the new bytes) into a new version of the indexes that then
+ *   replaces the current one, while queries already running finish on the
+ *   old one. The versions share the row table and posting lists (new rows
+ *   only go past the end) and the rating index gets the new rows merged
+ *   in, so an append costs about its own size plus one copy of the rating
+ *   index. A line without its newline yet is left for the next append to
+ *   finish. A truncated or replaced file gets loaded again from scratch.
+ *   All of it runs on a thread of its own, never on the epoll loop.
+ *
+ *   With --stream (or --stream-over SIZE when the file is bigger than
+ *   SIZE) nothing is loaded: the menu and the year=, lang= and
+ *   best-per-year queries each make one pass over the file, holding one
+ *   line at a time plus one best movie per year. Memory stays flat no
+ *   matter how big the file is. The top/rating queries need the loaded
+ *   indexes and are refused in this mode, and so is --serve.
+ *
+ *   With --stats (or MOVIES_STATS=1 in the environment) the run is timed
+ *   phase by phase -- the load, reading records, parse_movie_view, the
+ *   language parsing inside it, store_movie_row, create_movie_node, the
+ *   rating sort, snapshots and every query kind -- with counts of rows
+ *   parsed, bytes read, allocations and nodes visited, and it all goes to
+ *   stderr as one JSON object at exit (--stats=FILE / MOVIES_STATS=FILE to
+ *   write it to a file instead). Times are inclusive and summed over
+ *   threads. The per-row phases read the clock for every row, which makes
+ *   a load about twice as slow, so compare the phases with each other, not
+ *   with a run that didn't have --stats.
+ *
+ *   Query results are cached (query_cache_t): the rendered bytes of the
+ *   last queries asked, keyed by output format and query text, least
+ *   recently used ones dropped once --cache-size (64M by default, 0 turns
+ *   it off) is spent. A repeat menu choice is a single write of the cached
+ *   bytes, a repeat --query / server request one copy into the output.
+ *   The cache belongs to the loaded data, so every --watch reload starts a
+ *   fresh one. Hits and misses show up in --stats and in the server's
+ *   shutdown message. Streaming loads nothing and caches nothing.
  *   
  *   It demonstrates core C concepts such as file I/O,
  *   pointers, structs, linked lists, and dynamic memory.
  *
  * How to Compile:
- *   gcc --std=gnu99 -Wall -o movies phamjac_assignment2.c
+ *   gcc --std=gnu99 -Wall -pthread -o movies phamjac_assignment2.c
  *
  * How to Run:
  *   ./movies movies_sample_1.csv
+ *   ./movies --columnar movies_sample_1.csv   (struct-of-arrays layout)
+ *   ./movies --compact movies_sample_1.csv    (20-byte fixed-width records)
+ *   ./movies --mmap movies_sample_1.csv       (zero-copy loader, either layout)
+ *   ./movies --threads 8 movies_sample_1.csv  (parallel parse, implies --mmap)
+ *   ./movies --snapshot movies_sample_1.csv   (reuse/write movies_sample_1.csv.snap, implies --columnar)
+ *   ./movies --query year=2008 --query lang=French --format json movies_sample_1.csv
+ *   ./movies --query top=100 --query top-per-year=10 --query rating=7.5..8.0 movies_sample_1.csv
+ *   ./movies --batch queries.txt movies_sample_1.csv   (one query per line, - for stdin)
+ *   ./movies --serve /tmp/movies.sock --workers 4 movies_sample_1.csv
+ *   ./movies --serve /tmp/movies.sock --watch catalog.csv   (picks up rows appended to catalog.csv)
+ *   ./movies --stream-over 8G --query best-per-year huge_export.csv   (stream if it's over 8 GiB)
+ *   ./movies --stats --query lang=French movies_sample_1.csv   (per-phase timings as JSON on stderr)
+ *   ./movies --cache-size 0 movies_sample_1.csv   (no query result cache)
+ *
+ *   Add -DMOVIES_NO_SIMD to the compile line to force the plain C scans.
  * 
  * Notes:
  *   - Used syntax tips from BARR C i.e. p_ pp_ fp_ for pointers:
@@ -29,334 +128,5116 @@
  *
  *************************************************/
 
+ #define _GNU_SOURCE    // for accept4 (server mode)
  #include <stdio.h>      // for printf, scanf, getline
- #include <stdlib.h>     // for calloc, free, EXIT_SUCCESS, EXIT_FAILURE
- #include <string.h>     // for strtok_r, strdup, strcmp
+ #include <stdlib.h>     // for calloc, malloc, free, EXIT_SUCCESS, EXIT_FAILURE
+ #include <stdint.h>     // for the fixed-width snapshot fields
+ #include <limits.h>     // for INT_MAX
+ #include <math.h>       // for isfinite (rating= bounds)
+ #include <string.h>     // for strtok_r, strdup, strcmp, memchr
+ #include <fcntl.h>      // for open, posix_fadvise
+ #include <unistd.h>     // for close, write
+ #include <errno.h>      // for EINTR, EAGAIN
+ #include <signal.h>     // for sigaction (server shutdown)
+ #include <sys/socket.h> // for the server's unix socket
+ #include <sys/un.h>     // for sockaddr_un
+ #include <sys/epoll.h>  // for the server event loop
+ #include <sys/eventfd.h> // for waking the event loop from worker threads
+ #include <sys/inotify.h> // for --watch
+ #include <poll.h>       // for the --watch thread
+ #include <sys/mman.h>   // for mmap, madvise, munmap
+ #include <sys/stat.h>   // for fstat
+ #include <sys/resource.h> // for getrusage (--stats)
+ #include <pthread.h>    // for the parser threads
+ #include <time.h>       // for clock_gettime (--stats)
+ #include "../common/csv_tokenizer.h" // shared CSV splitter (SIMD fast path, quoted fields)
+ 
+ #if (defined(__x86_64__) || defined(__i386__)) && !defined(MOVIES_NO_SIMD)
+ #define MOVIES_X86_SIMD 1
+ #include <immintrin.h>  // for the SSE2 / AVX2 scan kernels
+ #endif
  
  #define MAX_LANGUAGES 5
  #define MAX_LANGUAGE_LENGTH 20
+ #define ARENA_BLOCK_SIZE (1 << 20) // each arena block is 1 MiB, plenty of rows per malloc
+ #define SCAN_BLOCK_ROWS 4096       // rows a column scan handles before printing its matches
+ #define NO_LANGUAGE 0xFFFF         // empty slot in a language column
+ #define TOP_PER_YEAR 32            // each year keeps its best this many movies (top-per-year=K, K <= this)
+ #define MAX_LOAD_THREADS 256       // upper bound for --threads
+ #define SNAPSHOT_MAGIC "MOVSNAP"   // first 8 bytes of a .snap file (with the '\0')
+ #define SNAPSHOT_VERSION 2         // bump whenever the layout below changes
+ #define SNAPSHOT_ALIGN 64          // every section starts on a cache line
+ #define OUT_BUFFER_SIZE (1 << 20)  // batch output goes out in 1 MiB writes
+ #define SERVER_MAX_LINE (64 * 1024) // longest request line the server accepts
+ #define SERVER_MAX_EVENTS 64       // epoll events handled per wakeup
+ #define SERVER_DEFAULT_WORKERS 4   // --workers when not given
+ #define STREAM_BUFFER_SIZE (1 << 20) // stdio buffer for the streaming reader
+ #define WATCH_EVENT_BUFFER 4096      // inotify events are read this much at a time
+ #define QUERY_CACHE_SLOTS 256        // hash chains in the query result cache
+ #define QUERY_CACHE_MAX_KEY 256      // queries longer than this aren't cached
+ #define QUERY_CACHE_DEFAULT (64 << 20) // --cache-size when not given: 64 MiB of rendered results
  
+/* small integer handed out by the language dictionary, one per distinct language */
+typedef unsigned short lang_id_t;
+
 /* Each movie with all its attributes much like an Object in Python*/  
  typedef struct movie
  {
-     char * p_title;
+     const char * p_title;  // not '\0' terminated with --mmap, always use title_length
+     unsigned int title_length;
      int release_year;
-     char * pp_languages[MAX_LANGUAGES]; // list of languages, like [English;Spanish]
+     lang_id_t lang_ids[MAX_LANGUAGES]; // list of languages as dictionary ids, like [English;Spanish] -> {0, 3}
+     unsigned char lang_count;          // how many of lang_ids are filled in
      float rating;
      struct movie * p_next; // next node in the list
+     struct movie * p_next_in_year; // next node with the same release year (see year_index_t)
  } movie_t;
+
+/* one parsed CSV row on its way into whichever layout we're using.
+   p_title points into the line being parsed (getline buffer or the mapping) */
+typedef struct movie_row
+{
+    const char * p_title;
+    size_t title_length;
+    int release_year;
+    lang_id_t lang_ids[MAX_LANGUAGES];
+    int lang_count;
+    float rating;
+} movie_row_t;
+
+/* one bucket per release year that actually shows up in the file.
+   the bucket chains its movies through p_next_in_year so option 1 is
+   just a walk down one short chain instead of the whole list */
+typedef struct year_bucket
+{
+    int year;
+    int movie_count;        // how many movies came out this year
+    int best_ties;          // how many of them share the best rating
+    movie_t * p_best;       // first movie (file order) with the best rating (list layout)
+    int best_row;           // row number of that same movie (works for every layout)
+    float best_rating;
+    movie_t * p_first;      // head of this year's chain
+    movie_t * p_last;       // tail of this year's chain so appends stay in file order
+    int top_count;          // bounded min-heap of the year's best TOP_PER_YEAR rows:
+    int top_rows[TOP_PER_YEAR];      // the root is the weakest one still in,
+    float top_ratings[TOP_PER_YEAR]; // so a new row only has to beat the root
+} year_bucket_t;
+
+/* growable array of buckets kept sorted by year, so lookups are a binary
+   search and option 2 is one walk over the years we actually have */
+typedef struct year_index
+{
+    year_bucket_t * p_buckets;
+    int bucket_count;
+    int bucket_capacity;
+} year_index_t;
+
+/* one distinct language: the only copy of its name plus every movie
+   (file order) that lists it -- the posting list option 3 walks */
+typedef struct lang_entry
+{
+    char * p_name;
+    unsigned int hash;
+    movie_t ** pp_postings;
+    int posting_count;
+    int posting_capacity;
+    int postings_shared;    // --watch: an older version reads pp_postings too, so it grows by copying
+    int postings_moved;     // --watch: a newer version took pp_postings over and frees it
+} lang_entry_t;
+
+/* interns language strings. entries are indexed by lang_id_t, and an
+   open-addressing hash table (linear probing, power of two size) maps a
+   name to its id. a slot holds id + 1 so that 0 can mean empty */
+typedef struct lang_dict
+{
+    lang_entry_t * p_entries;
+    int lang_count;
+    int lang_capacity;
+    unsigned int * p_slots;
+    unsigned int slot_count;
+} lang_dict_t;
+
+/* gnu99 has no max_align_t, so this stands in for "the most aligned type" */
+typedef union arena_align
+{
+    long double ld;
+    long long ll;
+    void * p;
+} arena_align_t;
+
+/* one big chunk of heap the arena carves movies and titles out of.
+   blocks are chained backwards so releasing is a short walk */
+typedef struct arena_block
+{
+    struct arena_block * p_prev;
+    size_t used;
+    size_t size;
+    arena_align_t data[];  // flexible array member, typed so the payload starts aligned
+} arena_block_t;
+
+/* bump allocator: allocation is a pointer bump inside the current block,
+   and everything it handed out goes away together in arena_release() */
+typedef struct arena
+{
+    arena_block_t * p_current;
+    size_t bytes_reserved;  // total malloc'd for blocks (handy for sizing)
+} arena_t;
+
+/* struct-of-arrays copy of the movie data: row i of the file is
+   p_years[i], p_ratings[i], the title at p_title_pool + p_title_offsets[i]
+   and p_lang_cols[0..MAX_LANGUAGES-1][i] (NO_LANGUAGE if unused).
+   the hot columns sit back to back so a filter streams through memory */
+typedef struct movie_columns
+{
+    int row_count;
+    int row_capacity;
+    int * p_years;
+    float * p_ratings;
+    size_t * p_title_offsets;
+    unsigned int * p_title_lengths;
+    lang_id_t * p_lang_cols[MAX_LANGUAGES];
+    const char * p_title_pool; // every title back to back (or the mmap'd file itself)
+    size_t pool_used;
+    size_t pool_capacity;
+    int borrows_pool;          // pool is the mapping, don't copy into it or free it
+    int is_mapped;             // the columns themselves live in a snapshot mapping
+} movie_columns_t;
+
+/* one movie in the compact layout. fixed width and pointer free: 18 bytes
+   of fields, 20 with the padding, against 48 for a movie_t before its
+   row table entry and postings. titles sit back to back in the store's
+   pool, so a title ends where the next row's starts */
+typedef struct compact_movie
+{
+    uint32_t title_offset;      // into compact_store_t.p_title_pool
+    int16_t year;
+    uint8_t rating_tenths;      // 7.5 -> 75
+    uint8_t lang_count;
+    lang_id_t lang_ids[MAX_LANGUAGES];
+} compact_movie_t;
+
+/* every row of the file as a compact_movie_t, in file order */
+typedef struct compact_store
+{
+    compact_movie_t * p_records;
+    int row_count;
+    int row_capacity;
+    char * p_title_pool;
+    size_t pool_used;
+    size_t pool_capacity;
+} compact_store_t;
+
+/* how the movies are stored */
+typedef enum movie_layout
+{
+    LAYOUT_LIST = 0,   // linked list of movie_t + year chains + language postings
+    LAYOUT_COLUMNAR,   // movie_columns_t, filters are column scans
+    LAYOUT_COMPACT     // compact_store_t, filters are scans over the records
+} movie_layout_t;
+
+/* how main() asked for the file to be loaded */
+typedef struct load_options
+{
+    movie_layout_t layout;
+    int use_mmap;       // --mmap: zero-copy loader instead of getline
+    int thread_count;   // --threads: parser threads for the mmap loader (1 = no extra threads)
+    int use_snapshot;   // --snapshot: load from / save to <file>.snap
+    int use_stream;     // --stream: don't load, every query reads the file once
+    long long stream_over; // --stream-over: stream only if the file is bigger than this (0 = off)
+    size_t cache_bytes; // --cache-size: room for rendered query results (0 = no cache)
+    int whole_records_only; // --watch: a last line without its newline is left for the appends to finish
+} load_options_t;
+
+/* every row sorted by rating, best first (ties stay in file order).
+   p_ratings[i] is the rating of p_rows[i], kept separately so the
+   binary searches for a rating range only touch 4 bytes a row */
+typedef struct rating_index
+{
+    int * p_rows;
+    float * p_ratings;
+    int count;
+    int is_mapped;          // lives in a snapshot mapping, nothing to free
+} rating_index_t;
+
+/* one rendered query result in the cache */
+typedef struct cached_output
+{
+    char * p_key;           // format tag + query text, '\0' terminated
+    size_t key_length;
+    unsigned int hash;
+    char * p_data;          // exactly the bytes the query wrote out
+    size_t length;
+    int refs;               // readers still copying p_data out
+    int is_evicted;         // already out of the cache, the last reader frees it
+    struct cached_output * p_newer; // LRU list, newest at the front
+    struct cached_output * p_older;
+    struct cached_output * p_next_in_slot;
+} cached_output_t;
+
+/* recently rendered results, least recently used ones dropped first once
+   byte_limit is spent. locked because the server's workers share it */
+typedef struct query_cache
+{
+    pthread_mutex_t lock;
+    cached_output_t * p_slots[QUERY_CACHE_SLOTS];
+    cached_output_t * p_newest;
+    cached_output_t * p_oldest;
+    size_t bytes_used;
+    size_t byte_limit;
+    int entry_count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} query_cache_t;
+
+/* everything load_movies_from_csv() builds in one place */
+typedef struct movie_db
+{
+    movie_layout_t layout;
+    arena_t arena;          // owns every movie_t node and title string
+    movie_columns_t columns; // only filled in for LAYOUT_COLUMNAR
+    compact_store_t compact; // only filled in for LAYOUT_COMPACT
+    movie_t * p_head;       // the linked list itself (file order)
+    movie_t * p_tail;       // end of the list so appends are O(1)
+    movie_t ** pp_rows;     // row number -> node, so indexes can store rows in either layout
+    int row_capacity;
+    int rows_shared;        // --watch: an older version reads pp_rows too, so it grows by copying
+    int rows_moved;         // --watch: a newer version took pp_rows over and frees it
+    const char * p_map;     // the mmap'd CSV with --mmap (titles point into it), else NULL
+    size_t map_length;
+    int total_count;        // how many movies made it into the list
+    year_index_t year_index;
+    lang_dict_t lang_dict;  // distinct languages + who speaks them
+    rating_index_t rating_index; // built once loading is done
+    const char * p_stream_path; // set instead of all the above when streaming
+    size_t parsed_bytes;    // how much of the file the rows came from (--watch picks up from here)
+    int storage_moved;      // a newer version took over the nodes, titles, names and mapping
+    query_cache_t * p_cache; // rendered query results for this data, NULL = not caching
+} movie_db_t;
  
+/* ---- run statistics (--stats / MOVIES_STATS) ----
+   off unless asked for, and then every thread counts into its own
+   stats_block_t (no sharing, no atomics) and the blocks get added up when
+   the report is written at exit. a phase is whatever runs between
+   stats_begin() and stats_end(); phases nest, times are inclusive (the load
+   includes its parsing), and a count is charged to the innermost phase
+   running when it's made. the per-row phases only read the wall clock,
+   a CPU clock read per row would cost more than the row does */
+
+typedef enum stats_phase
+{
+    PHASE_LOAD = 0,         // load_movies_from_csv, start to finish
+    PHASE_READ,             // finding the next record: getline, or the scan through the mapping
+    PHASE_PARSE,            // parse_movie_view, one record into a row
+    PHASE_LANGUAGES,        // the [English;French] part of that (what parse_languages used to do)
+    PHASE_STORE,            // store_movie_row, the row into the layout and the indexes
+    PHASE_CREATE_NODE,      // create_movie_node, list layout only
+    PHASE_RATING_INDEX,     // build_rating_index
+    PHASE_SNAPSHOT_LOAD,
+    PHASE_SNAPSHOT_WRITE,
+    PHASE_WATCH_APPEND,     // --watch parsing appended rows into a new version
+    PHASE_QUERY_YEAR,       // print_movies_by_year, year=
+    PHASE_QUERY_BEST,       // print_highest_rated_by_year, best-per-year
+    PHASE_QUERY_LANGUAGE,   // print_movies_by_language, lang=
+    PHASE_QUERY_TOP,        // top=
+    PHASE_QUERY_TOP_PER_YEAR, // top-per-year=
+    PHASE_QUERY_RATING,     // rating=
+    PHASE_COUNT             // also "no phase" / "not timing"
+} stats_phase_t;
+
+typedef enum stats_counter
+{
+    COUNT_ROWS_PARSED = 0,
+    COUNT_ROWS_SKIPPED,     // records with fields missing
+    COUNT_BYTES_READ,
+    COUNT_ARENA_ALLOCS,     // nodes and titles carved out of the arena
+    COUNT_HEAP_ALLOCS,      // malloc/realloc calls made while building: arena blocks, index growth
+    COUNT_NODES_VISITED,    // nodes, postings, buckets and rows a query walked or scanned
+    COUNT_HITS,             // results the queries handed out
+    COUNT_CACHE_HITS,       // queries answered from the query cache
+    COUNT_CACHE_MISSES,     // queries that had to be rendered (and then went into it)
+    COUNT_STORAGE_BYTES,    // heap the loaded data holds, layout plus indexes (once per load)
+    COUNT_KINDS
+} stats_counter_t;
+
+static const char * stats_phase_names[PHASE_COUNT] =
+{
+    "load_movies_from_csv", "read_record", "parse_movie_view", "parse_languages",
+    "store_movie_row", "create_movie_node", "build_rating_index", "load_snapshot",
+    "write_snapshot", "watch_append", "query_year", "query_best_per_year",
+    "query_language", "query_top", "query_top_per_year", "query_rating_range"
+};
+
+static const char * stats_counter_names[COUNT_KINDS] =
+{
+    "rows_parsed", "rows_skipped", "bytes_read", "arena_allocs", "heap_allocs", "nodes_visited", "hits",
+    "cache_hits", "cache_misses", "storage_bytes"
+};
+
+/* which CPU clock a phase reads. the load can run parser threads, so it takes
+   the whole process; the per-row phases take none */
+ #define STATS_CPU_NONE 0
+ #define STATS_CPU_THREAD 1
+ #define STATS_CPU_PROCESS 2
+static const unsigned char stats_phase_cpu[PHASE_COUNT] =
+{
+    STATS_CPU_PROCESS, STATS_CPU_NONE, STATS_CPU_NONE, STATS_CPU_NONE,
+    STATS_CPU_NONE, STATS_CPU_NONE, STATS_CPU_THREAD, STATS_CPU_THREAD,
+    STATS_CPU_THREAD, STATS_CPU_THREAD, STATS_CPU_THREAD, STATS_CPU_THREAD,
+    STATS_CPU_THREAD, STATS_CPU_THREAD, STATS_CPU_THREAD, STATS_CPU_THREAD
+};
+
+/* one thread's numbers. counts[PHASE_COUNT] holds what was counted outside any phase */
+typedef struct stats_block
+{
+    uint64_t calls[PHASE_COUNT];
+    uint64_t wall_ns[PHASE_COUNT];
+    uint64_t cpu_ns[PHASE_COUNT];
+    uint64_t counts[PHASE_COUNT + 1][COUNT_KINDS];
+    int current_phase;      // innermost phase running on this thread, PHASE_COUNT if none
+    struct stats_block * p_next;
+} stats_block_t;
+
+/* one running phase; lives on the caller's stack */
+typedef struct stats_timer
+{
+    int phase;              // PHASE_COUNT when this one isn't being timed
+    int outer_phase;        // what was running before, put back by stats_end()
+    uint64_t wall_start;
+    uint64_t cpu_start;
+} stats_timer_t;
+
+static int stats_enabled = 0;               // set once in main(), before any threads
+static const char * p_stats_path = NULL;    // report file, NULL for stderr
+static uint64_t stats_started_ns = 0;
+static stats_block_t * p_stats_blocks = NULL; // every thread's block, for the report
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread stats_block_t * p_thread_stats = NULL;
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+/* this thread's block, made the first time it counts anything.
+   NULL if that calloc failed (the thread just goes uncounted) */
+static stats_block_t * thread_stats(void)
+{
+    if (NULL == p_thread_stats)
+    {
+        stats_block_t * p_block = calloc(1, sizeof(stats_block_t));
+        if (NULL == p_block)
+            return NULL;
+        p_block->current_phase = PHASE_COUNT;
+
+        pthread_mutex_lock(&stats_lock);
+        p_block->p_next = p_stats_blocks;
+        p_stats_blocks = p_block;
+        pthread_mutex_unlock(&stats_lock);
+        p_thread_stats = p_block;
+    }
+    return p_thread_stats;
+}
+
+/* add amount to a counter (a no-op unless --stats is on) */
+static inline void stats_count(stats_counter_t counter, uint64_t amount)
+{
+    if (!stats_enabled)
+        return;
+    stats_block_t * p_stats = thread_stats();
+    if (NULL != p_stats)
+        p_stats->counts[p_stats->current_phase][counter] += amount;
+}
+
+static uint64_t stats_cpu_ns(int phase)
+{
+    if (STATS_CPU_PROCESS == stats_phase_cpu[phase])
+        return clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    if (STATS_CPU_THREAD == stats_phase_cpu[phase])
+        return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    return 0;
+}
+
+/* start timing phase (PHASE_COUNT means don't) */
+static inline void stats_begin(stats_timer_t * p_timer, stats_phase_t phase)
+{
+    *p_timer = (stats_timer_t) { PHASE_COUNT, PHASE_COUNT, 0, 0 };
+    if (!stats_enabled || PHASE_COUNT == phase)
+        return;
+    stats_block_t * p_stats = thread_stats();
+    if (NULL == p_stats)
+        return;
+
+    p_timer->phase = phase;
+    p_timer->outer_phase = p_stats->current_phase;
+    p_stats->current_phase = phase;
+    p_timer->cpu_start = stats_cpu_ns(phase);
+    p_timer->wall_start = clock_ns(CLOCK_MONOTONIC);
+}
+
+static inline void stats_end(stats_timer_t * p_timer)
+{
+    if (PHASE_COUNT == p_timer->phase)
+        return;
+    stats_block_t * p_stats = p_thread_stats;
+    int phase = p_timer->phase;
+
+    p_stats->wall_ns[phase] += clock_ns(CLOCK_MONOTONIC) - p_timer->wall_start;
+    if (STATS_CPU_NONE != stats_phase_cpu[phase])
+        p_stats->cpu_ns[phase] += stats_cpu_ns(phase) - p_timer->cpu_start;
+    p_stats->calls[phase]++;
+    p_stats->current_phase = p_timer->outer_phase;
+}
+
+/* atexit: add up every thread's block and write the report as one JSON object */
+static void write_stats_report(void)
+{
+    uint64_t calls[PHASE_COUNT] = {0};
+    uint64_t wall_ns[PHASE_COUNT] = {0};
+    uint64_t cpu_ns[PHASE_COUNT] = {0};
+    uint64_t counts[PHASE_COUNT + 1][COUNT_KINDS];
+    uint64_t totals[COUNT_KINDS] = {0};
+    int thread_count = 0;
+    memset(counts, 0, sizeof(counts));
+
+    pthread_mutex_lock(&stats_lock);
+    for (const stats_block_t * p_block = p_stats_blocks; NULL != p_block; p_block = p_block->p_next)
+    {
+        thread_count++;
+        for (int phase = 0; phase <= PHASE_COUNT; phase++)
+        {
+            if (phase < PHASE_COUNT)
+            {
+                calls[phase] += p_block->calls[phase];
+                wall_ns[phase] += p_block->wall_ns[phase];
+                cpu_ns[phase] += p_block->cpu_ns[phase];
+            }
+            for (int counter = 0; counter < COUNT_KINDS; counter++)
+            {
+                counts[phase][counter] += p_block->counts[phase][counter];
+                totals[counter] += p_block->counts[phase][counter];
+            }
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    FILE * p_out = stderr;
+    if (NULL != p_stats_path && NULL == (p_out = fopen(p_stats_path, "w")))
+    {
+        perror(p_stats_path);
+        return;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(p_out, "{\"program\":\"movies\",\"wall_ms\":%.3f,\"user_ms\":%.3f,\"sys_ms\":%.3f,"
+                   "\"max_rss_kb\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld,\"threads_counted\":%d,\n \"totals\":{",
+            (clock_ns(CLOCK_MONOTONIC) - stats_started_ns) / 1e6,
+            usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3,
+            usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3,
+            usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt, thread_count);
+    for (int counter = 0; counter < COUNT_KINDS; counter++)
+        fprintf(p_out, "%s\"%s\":%llu", (counter > 0) ? "," : "", stats_counter_names[counter],
+                (unsigned long long) totals[counter]);
+
+    // only the phases that ran, each with the counts made inside it
+    fprintf(p_out, "},\n \"phases\":[");
+    int is_first = 1;
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        if (0 == calls[phase])
+            continue;
+        fprintf(p_out, "%s\n  {\"phase\":\"%s\",\"calls\":%llu,\"wall_ms\":%.3f", is_first ? "" : ",",
+                stats_phase_names[phase], (unsigned long long) calls[phase], wall_ns[phase] / 1e6);
+        if (STATS_CPU_NONE != stats_phase_cpu[phase])
+            fprintf(p_out, ",\"cpu_ms\":%.3f", cpu_ns[phase] / 1e6);
+        for (int counter = 0; counter < COUNT_KINDS; counter++)
+            if (0 != counts[phase][counter])
+                fprintf(p_out, ",\"%s\":%llu", stats_counter_names[counter], (unsigned long long) counts[phase][counter]);
+        fputc('}', p_out);
+        is_first = 0;
+    }
+    fprintf(p_out, "]}\n");
+
+    if (stderr != p_out)
+        fclose(p_out);
+}
+
+/* --stats (stderr), --stats=FILE, or MOVIES_STATS=1 / MOVIES_STATS=FILE in the environment */
+static void enable_stats(const char * p_path)
+{
+    if (stats_enabled)
+        return;
+    stats_enabled = 1;
+    p_stats_path = (NULL == p_path || '\0' == *p_path || strcmp(p_path, "1") == 0 || strcmp(p_path, "-") == 0) ? NULL : p_path;
+    stats_started_ns = clock_ns(CLOCK_MONOTONIC);
+    atexit(write_stats_report);
+}
+
+/* carve size bytes out of the arena. memory is zeroed like calloc would do.
+   returns NULL only if a new block couldn't be malloc'd */
+void * arena_alloc(arena_t * p_arena, size_t size)
+{
+    // round up so every allocation starts suitably aligned for any type
+    size_t align = sizeof(arena_align_t);
+    size = (size + align - 1) & ~(align - 1);
+
+    arena_block_t * p_block = p_arena->p_current;
+
+    if (NULL == p_block || p_block->used + size > p_block->size)
+    {
+        // oversized requests (a giant title) get a block of their own
+        size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+
+        p_block = malloc(sizeof(arena_block_t) + block_size);
+        if (NULL == p_block)
+            return NULL;
+        stats_count(COUNT_HEAP_ALLOCS, 1);
+
+        p_block->p_prev = p_arena->p_current;
+        p_block->used = 0;
+        p_block->size = block_size;
+        p_arena->p_current = p_block;
+        p_arena->bytes_reserved += block_size;
+    }
+
+    void * p_memory = (char *) p_block->data + p_block->used;
+    p_block->used += size;
+    memset(p_memory, 0, size);
+    stats_count(COUNT_ARENA_ALLOCS, 1);
+
+    return p_memory;
+}
+
+/* strndup, but the copy lives in the arena */
+char * arena_strndup(arena_t * p_arena, const char * p_source, size_t length)
+{
+    char * p_copy = arena_alloc(p_arena, length + 1);
+    if (NULL == p_copy)
+        return NULL;
+
+    memcpy(p_copy, p_source, length);
+    p_copy[length] = '\0';
+    return p_copy;
+}
+
+/* hand every block back to the heap in one go -- no node-by-node walk */
+void arena_release(arena_t * p_arena)
+{
+    arena_block_t * p_block = p_arena->p_current;
+
+    while (NULL != p_block)
+    {
+        arena_block_t * p_prev = p_block->p_prev;
+        free(p_block);
+        p_block = p_prev;
+    }
+
+    p_arena->p_current = NULL;
+    p_arena->bytes_reserved = 0;
+}
+
  /* same deal as malloc example in exploration 
- setting up a node with heap mem 
+ setting up a node, except the node and its title come out of the arena
+ instead of their own calloc/strdup. with copy_title == 0 the node just
+ points at the title where it already sits (the mmap'd file).
  Return a pointer to movie node after creation*/
- movie_t * create_movie_node(char * p_title, int release_year, char ** pp_languages, float rating)
+ movie_t * create_movie_node(arena_t * p_arena, const movie_row_t * p_row, int copy_title)
  {
-     movie_t * p_new_movie = calloc(1, sizeof(movie_t));
+     stats_timer_t timer;
+     stats_begin(&timer, PHASE_CREATE_NODE);
+ 
+     movie_t * p_new_movie = arena_alloc(p_arena, sizeof(movie_t));
      if (NULL == p_new_movie)
      {
          fprintf(stderr, "couldn’t make space for a new movie node\n");
+         stats_end(&timer);
          return NULL;
      }
  
-     p_new_movie->p_title = strdup(p_title);
-     p_new_movie->release_year = release_year;
+     p_new_movie->p_title = copy_title ? arena_strndup(p_arena, p_row->p_title, p_row->title_length) : p_row->p_title;
+     if (NULL == p_new_movie->p_title)
+     {
+         fprintf(stderr, "couldn’t make space for a movie title\n");
+         stats_end(&timer);
+         return NULL;
+     }
+     p_new_movie->title_length = (unsigned int) p_row->title_length;
+     p_new_movie->release_year = p_row->release_year;
  
-     for (int index = 0; index < MAX_LANGUAGES && pp_languages[index] != NULL; index++)
+     // just the ids get copied, the language names live once in the dictionary
+     for (int index = 0; index < p_row->lang_count && index < MAX_LANGUAGES; index++)
      {
-         p_new_movie->pp_languages[index] = strdup(pp_languages[index]);
+         p_new_movie->lang_ids[index] = p_row->lang_ids[index];
      }
+     p_new_movie->lang_count = (unsigned char) p_row->lang_count;
  
-     p_new_movie->rating = rating;
+     p_new_movie->rating = p_row->rating;
      p_new_movie->p_next = NULL;
  
+     stats_end(&timer);
      return p_new_movie;
  }
  
-/* this rips out the [English;French] and gives us a clean array of strings */
-void parse_languages(char * p_lang_field, char ** pp_output_langs)
+/* FNV-1a over the bytes of a language name, good enough for a few hundred keys */
+static unsigned int hash_language(const char * p_name, size_t length)
 {
-    // strdup makes a copy of the original string (heap-allocated) so we don't mess up the original
-    // strdup is short for "string duplicate"  allocates memory and copies the content
-    char * p_copy = strdup(p_lang_field);
+    unsigned int hash = 2166136261u;
 
-    // strtok_r needs this to save where it left off between calls (it's re-entrant version of strtok safe in loops)
-    char * p_save_ptr = NULL;
+    for (size_t index = 0; index < length; index++)
+    {
+        hash ^= (unsigned char) p_name[index];
+        hash *= 16777619u;
+    }
 
-    // strcspn returns the index of the first '[' in the string — we replace it with '\0' to cut it off
-    // basically, this makes sure p_copy doesn't contain any leading bracket
-    p_copy[strcspn(p_copy, "[")] = '\0';
+    return hash;
+}
 
-    // strchr finds the first '[' in the original string, then we jump one char forward to skip it
-    char * p_start = strchr(p_lang_field, '[') + 1;
+/* walk the probe sequence for a name. returns the slot that either holds it
+   or is the empty slot where it would go */
+static unsigned int find_language_slot(const lang_dict_t * p_dict, const char * p_name, size_t length, unsigned int hash)
+{
+    unsigned int mask = p_dict->slot_count - 1;
+    unsigned int slot = hash & mask;
 
-    // strchr again to find the closing bracket ']'
-    char * p_end = strchr(p_start, ']');
+    while (0 != p_dict->p_slots[slot])
+    {
+        const lang_entry_t * p_entry = &p_dict->p_entries[p_dict->p_slots[slot] - 1];
 
-    // if we found the end bracket, replace it with null terminator to cut off the rest
-    if (p_end != NULL)
-        *p_end = '\0';
+        if (p_entry->hash == hash && strncmp(p_entry->p_name, p_name, length) == 0 && '\0' == p_entry->p_name[length])
+            break;
 
-    // strtok_r splits the string using ';' as the delimiter
-    // returns the first chunk before the first semicolon
-    // p_save_ptr remembers where we left off so we can get the next token later
-    char * p_token = strtok_r(p_start, ";", &p_save_ptr);
+        slot = (slot + 1) & mask;
+    }
 
-    int lang_index = 0;
+    return slot;
+}
 
-    // loop through each token and copy it into the output array
-    // we make a separate strdup so each language has its own memory on the heap
-    while ((NULL != p_token) && (lang_index < MAX_LANGUAGES))
+/* double the hash table and re-slot every language we already know */
+static int grow_language_slots(lang_dict_t * p_dict)
+{
+    unsigned int new_count = (0 == p_dict->slot_count) ? 64 : p_dict->slot_count * 2;
+    unsigned int * p_new_slots = calloc(new_count, sizeof(unsigned int));
+    if (NULL == p_new_slots)
     {
-        // strdup allocates a new copy of the language string so it doesn't rely on temp memory
-        pp_output_langs[lang_index] = strdup(p_token);
-        lang_index++;
-
-        // get the next token (next language)
-        p_token = strtok_r(NULL, ";", &p_save_ptr);
+        fprintf(stderr, "couldn't grow the language table\n");
+        return -1;
     }
 
-    // cleanup: we free the string we strdup’d earlier (p_copy)
-    // even though we didn't use it for parsing, we allocated it so we have to clean it up
-    free(p_copy);
-}
- 
- /* this clears out all the memory in the list. again, 
- just like exploration example. 
- avoid memory leaks on program shut down*/
- void free_movie_list(movie_t *p_head)
- {
-     movie_t *p_temp = NULL;
- 
-     while (NULL != p_head)
-     {
-         p_temp = p_head;
-         p_head = p_head->p_next;
- 
-         free(p_temp->p_title);
-         for (int i = 0; i < MAX_LANGUAGES && p_temp->pp_languages[i] != NULL; i++)
-             free(p_temp->pp_languages[i]);
- 
-         free(p_temp);
-     }
- }
- 
- /* this came straight from movies.c — adapted it to build up our own linked list */
-movie_t *load_movies_from_csv(char *p_filename, int *p_total_count)
-{
-    // try to open the file in read mode
-    FILE *p_file = fopen(p_filename, "r");
+    stats_count(COUNT_HEAP_ALLOCS, 1);
+    free(p_dict->p_slots);
+    p_dict->p_slots = p_new_slots;
+    p_dict->slot_count = new_count;
 
-    // if file doesn't open properly, bail out
-    if (NULL == p_file)
+    for (int id = 0; id < p_dict->lang_count; id++)
     {
-        fprintf(stderr, "couldn't open that file!\n");
-        return NULL;
+        unsigned int slot = p_dict->p_entries[id].hash & (new_count - 1);
+        while (0 != p_new_slots[slot])
+            slot = (slot + 1) & (new_count - 1);
+        p_new_slots[slot] = (unsigned int) id + 1;
     }
 
-    // buffer that will hold one full line of text from the file
-    char *p_curr_line = NULL;
+    return 0;
+}
 
-    // getline needs us to pass in the size of the buffer — this will get updated by getline
-    size_t line_length = 0;
+/* look a language up without adding it. returns its id, or -1 if no movie has it */
+int lookup_language(const lang_dict_t * p_dict, const char * p_name)
+{
+    if (0 == p_dict->slot_count)
+        return -1;
 
-    // 'read' will store how many characters were read by getline
-    ssize_t read;
+    size_t length = strlen(p_name);
+    unsigned int slot = find_language_slot(p_dict, p_name, length, hash_language(p_name, length));
 
-    // flag to skip the first line (the header row in the CSV)
-    int is_first_line = 1;
+    return (int) p_dict->p_slots[slot] - 1;
+}
+
+/* hand back the id for a language, adding it (one strdup, ever) the first time we see it.
+   returns -1 if we ran out of memory or ids */
+int intern_language(lang_dict_t * p_dict, const char * p_name, size_t length)
+{
+    // keep the table at most half full so probe chains stay short
+    if ((unsigned int) (p_dict->lang_count + 1) * 2 > p_dict->slot_count && grow_language_slots(p_dict) != 0)
+        return -1;
 
-    // start of the linked list
-    movie_t *p_head = NULL;
+    unsigned int hash = hash_language(p_name, length);
+    unsigned int slot = find_language_slot(p_dict, p_name, length, hash);
 
-    // end of the linked list (lets us add to the tail easily)
-    movie_t *p_tail = NULL;
+    // already interned, the common case ("English" for the millionth time)
+    if (0 != p_dict->p_slots[slot])
+        return (int) p_dict->p_slots[slot] - 1;
 
-    // we're gonna count how many movies we successfully parsed
-    *p_total_count = 0;
+    if (p_dict->lang_count >= NO_LANGUAGE)
+    {
+        fprintf(stderr, "too many distinct languages\n");
+        return -1;
+    }
 
-    // read the file line-by-line
-    while ((read = getline(&p_curr_line, &line_length, p_file)) != -1)
+    if (p_dict->lang_count == p_dict->lang_capacity)
     {
-        // first line is just column headers — skip it
-        if (is_first_line)
+        int new_capacity = (0 == p_dict->lang_capacity) ? 32 : p_dict->lang_capacity * 2;
+        lang_entry_t * p_grown = realloc(p_dict->p_entries, new_capacity * sizeof(lang_entry_t));
+        if (NULL == p_grown)
         {
-            is_first_line = 0;
-            continue;
+            fprintf(stderr, "couldn't grow the language dictionary\n");
+            return -1;
         }
+        p_dict->p_entries = p_grown;
+        p_dict->lang_capacity = new_capacity;
+        stats_count(COUNT_HEAP_ALLOCS, 1);
+    }
 
-        // we'll use this to keep track of strtok_r's internal state
-        char *p_save_ptr = NULL;
-
-        // first chunk of data: movie title
-        char *p_title = strtok_r(p_curr_line, ",", &p_save_ptr);
-
-        // if for some reason there’s no title, skip this line
-        if (NULL == p_title)
-            continue;
-
-        // next chunk: year as a string (need to convert it later)
-        char *p_year_str = strtok_r(NULL, ",", &p_save_ptr);
-
-        // turn year from string to int
-        int release_year = atoi(p_year_str);
+    lang_entry_t * p_entry = &p_dict->p_entries[p_dict->lang_count];
+    memset(p_entry, 0, sizeof(*p_entry));
+    p_entry->p_name = strndup(p_name, length);
+    p_entry->hash = hash;
+    if (NULL == p_entry->p_name)
+        return -1;
+    stats_count(COUNT_HEAP_ALLOCS, 1);
 
-        // next chunk: the languages field (like [English;French])
-        char *p_langs_str = strtok_r(NULL, ",", &p_save_ptr);
+    p_dict->p_slots[slot] = (unsigned int) p_dict->lang_count + 1;
+    return p_dict->lang_count++;
+}
 
-        // we'll use this to store individual language strings
-        char *pp_langs[MAX_LANGUAGES] = {NULL};
+/* realloc for the row table and posting lists. an older --watch version may still be
+   reading the array (is_shared), and realloc could free it under that reader, so then
+   it's a copy and the old array is left for that version to free */
+static void * grow_index_array(void * p_array, size_t used_bytes, size_t new_bytes, int is_shared)
+{
+    if (!is_shared)
+        return realloc(p_array, new_bytes);
 
-        // turn [English;French] into { "English", "French", NULL, ... }
-        parse_languages(p_langs_str, pp_langs);
+    void * p_copy = malloc(new_bytes);
+    if (NULL != p_copy && used_bytes > 0)
+        memcpy(p_copy, p_array, used_bytes);
+    return p_copy;
+}
 
-        // last chunk: rating (as a float like 8.7)
-        char *p_rating_str = strtok_r(NULL, "\n", &p_save_ptr);
-        float rating = strtof(p_rating_str, NULL);
+/* take a movie back off the end of its languages' posting lists (a row that couldn't be filed) */
+static void drop_lang_postings(lang_dict_t * p_dict, const movie_t * p_movie)
+{
+    for (int index = 0; index < p_movie->lang_count; index++)
+    {
+        lang_entry_t * p_entry = &p_dict->p_entries[p_movie->lang_ids[index]];
+        if (p_entry->posting_count > 0 && p_entry->pp_postings[p_entry->posting_count - 1] == p_movie)
+            p_entry->posting_count--;
+    }
+}
 
-        // now that we have all fields, build a new node on the heap
-        movie_t *p_new_node = create_movie_node(p_title, release_year, pp_langs, rating);
+/* add a movie to the posting list of every language it lists (once per language).
+   returns -1 (with none of them added) if a list couldn't grow */
+int add_to_lang_postings(lang_dict_t * p_dict, movie_t * p_movie)
+{
+    for (int index = 0; index < p_movie->lang_count; index++)
+    {
+        lang_id_t id = p_movie->lang_ids[index];
+        lang_entry_t * p_entry = &p_dict->p_entries[id];
 
-        // if something went wrong, skip this one
-        if (NULL == p_new_node)
+        // [English;English] shouldn't print the movie twice
+        int is_repeat = 0;
+        for (int earlier = 0; earlier < index; earlier++)
+        {
+            if (p_movie->lang_ids[earlier] == id)
+                is_repeat = 1;
+        }
+        if (is_repeat)
             continue;
 
-        // if this is the first valid movie, it becomes both head and tail
-        if (NULL == p_head)
-            p_head = p_tail = p_new_node;
-        else
+        if (p_entry->posting_count == p_entry->posting_capacity)
         {
-            // otherwise, we add to the end of the list and move the tail forward
-            p_tail->p_next = p_new_node;
-            p_tail = p_new_node;
+            int new_capacity = (0 == p_entry->posting_capacity) ? 16 : p_entry->posting_capacity * 2;
+            movie_t ** pp_grown = grow_index_array(p_entry->pp_postings, p_entry->posting_count * sizeof(movie_t *),
+                                                   new_capacity * sizeof(movie_t *), p_entry->postings_shared);
+            if (NULL == pp_grown)
+            {
+                fprintf(stderr, "couldn't grow the postings for %s\n", p_entry->p_name);
+                drop_lang_postings(p_dict, p_movie);
+                return -1;
+            }
+            p_entry->pp_postings = pp_grown;
+            p_entry->posting_capacity = new_capacity;
+            p_entry->postings_shared = 0;
+            stats_count(COUNT_HEAP_ALLOCS, 1);
         }
 
-        // keep track of how many good movies we added to the list
-        (*p_total_count)++;
+        p_entry->pp_postings[p_entry->posting_count++] = p_movie;
     }
 
-    // getline allocates memory for the line buffer, so we free it here
-    free(p_curr_line);
+    return 0;
+}
 
-    // done reading — close the file
-    fclose(p_file);
+/* frees every interned name, posting list and the hash table */
+void free_lang_dict(lang_dict_t * p_dict)
+{
+    for (int id = 0; id < p_dict->lang_count; id++)
+    {
+        free(p_dict->p_entries[id].p_name);
+        if (!p_dict->p_entries[id].postings_moved)
+            free(p_dict->p_entries[id].pp_postings);
+    }
 
-    // return the head of our linked list (could be NULL if nothing parsed)
-    return p_head;
+    free(p_dict->p_entries);
+    free(p_dict->p_slots);
+    memset(p_dict, 0, sizeof(*p_dict));
 }
+
  
- /* this one loops through the list and prints movies from a specific year */
-void print_movies_by_year(movie_t *p_head, int target_year)
+/* binary search for the bucket of a year.
+   returns its slot, or -(insert position) - 1 if that year isn't there yet */
+static int find_year_slot(const year_index_t * p_index, int year)
 {
-    int found = 0; // flag to check if we printed anything
+    int low = 0;
+    int high = p_index->bucket_count - 1;
 
-    // go through each node in the linked list
-    for (movie_t *p_curr = p_head; p_curr != NULL; p_curr = p_curr->p_next)
+    while (low <= high)
     {
-        // check if the year matches what the user asked for
-        if (p_curr->release_year == target_year)
-        {
-            // print the movie title
-            printf("%s\n", p_curr->p_title);
-            found = 1; // yep, we found at least one
-        }
-    }
+        int mid = low + (high - low) / 2;
+        int mid_year = p_index->p_buckets[mid].year;
 
-    // if we didn't find any movie from that year, say so
-    if (!found)
-    {
-        printf("No data about movies released in the year %d\n", target_year);
+        if (mid_year == year)
+            return mid;
+        else if (mid_year < year)
+            low = mid + 1;
+        else
+            high = mid - 1;
     }
+
+    return -low - 1;
 }
 
+/* hand back the bucket for a year, or NULL if no movie came out that year */
+year_bucket_t * find_year_bucket(const year_index_t * p_index, int year)
+{
+    int slot = find_year_slot(p_index, year);
 
-/* this one finds the highest-rated movie for each year */
-void print_highest_rated_by_year(movie_t *p_head)
+    return (slot >= 0) ? &p_index->p_buckets[slot] : NULL;
+}
+
+/* hand back the bucket for a year, making an empty one if it's new.
+   returns NULL only if the array couldn't grow */
+year_bucket_t * get_year_bucket(year_index_t * p_index, int year)
 {
-    // this goes year-by-year from 1900 to 2025 (as per assignment spec)
-    // not super efficient.. we're looping over the list for every year
-    for (int year = 1900; year <= 2025; year++)
+    int slot = find_year_slot(p_index, year);
+
+    if (slot < 0)
     {
-        movie_t *p_best = NULL; // will point to the best-rated movie found so far for this year
+        slot = -slot - 1;
 
-        // go through the list again and look for movies from this year
-        for (movie_t *p_curr = p_head; p_curr != NULL; p_curr = p_curr->p_next)
+        // out of room, double the array (same trick getline uses on its buffer)
+        if (p_index->bucket_count == p_index->bucket_capacity)
         {
-            if (p_curr->release_year == year)
+            int new_capacity = (0 == p_index->bucket_capacity) ? 64 : p_index->bucket_capacity * 2;
+            year_bucket_t * p_grown = realloc(p_index->p_buckets, new_capacity * sizeof(year_bucket_t));
+            if (NULL == p_grown)
             {
-                // if this is the first match or has a better rating than current best, update p_best
-                if (p_best == NULL || p_curr->rating > p_best->rating)
-                {
-                    p_best = p_curr;
-                }
+                fprintf(stderr, "couldn't grow the year index\n");
+                return NULL;
             }
+            p_index->p_buckets = p_grown;
+            p_index->bucket_capacity = new_capacity;
+            stats_count(COUNT_HEAP_ALLOCS, 1);
         }
 
-        // if we found at least one movie for this year, print the best one
-        if (p_best != NULL)
-        {
-            printf("%d %.1f %s\n", p_best->release_year, p_best->rating, p_best->p_title);
-        }
+        // shove the later years over by one to keep the array sorted
+        memmove(&p_index->p_buckets[slot + 1], &p_index->p_buckets[slot],
+                (p_index->bucket_count - slot) * sizeof(year_bucket_t));
+        memset(&p_index->p_buckets[slot], 0, sizeof(year_bucket_t));
+        p_index->p_buckets[slot].year = year;
+        p_index->p_buckets[slot].best_row = -1;
+        p_index->bucket_count++;
     }
+
+    return &p_index->p_buckets[slot];
 }
 
+/* count a row in its bucket and keep the best rating / tie count current.
+   strictly better takes over, equal just counts as a tie (first one wins like before).
+   returns 1 if this row is the new best */
+static int track_year_best(year_bucket_t * p_bucket, float rating, int row)
+{
+    p_bucket->movie_count++;
 
-/* this one shows movies that were available in a specific language */
-void print_movies_by_language(movie_t *p_head, const char *p_target_language)
+    if (p_bucket->best_row < 0 || rating > p_bucket->best_rating)
+    {
+        p_bucket->best_row = row;
+        p_bucket->best_rating = rating;
+        p_bucket->best_ties = 1;
+        return 1;
+    }
+
+    if (rating == p_bucket->best_rating)
+        p_bucket->best_ties++;
+
+    return 0;
+}
+
+/* true if (rating_a, row_a) ranks below (rating_b, row_b): lower rating,
+   or the same rating but later in the file */
+static int ranks_below(float rating_a, int row_a, float rating_b, int row_b)
 {
-    int found = 0; // again, flag to check if we found anything
+    return rating_a < rating_b || (rating_a == rating_b && row_a > row_b);
+}
+
+/* offer a row to the year's top-TOP_PER_YEAR heap */
+static void push_year_top(year_bucket_t * p_bucket, float rating, int row)
+{
+    int * p_rows = p_bucket->top_rows;
+    float * p_ratings = p_bucket->top_ratings;
+    int slot;
 
-    // loop through the list of all movies
-    for (movie_t *p_curr = p_head; p_curr != NULL; p_curr = p_curr->p_next)
+    if (p_bucket->top_count < TOP_PER_YEAR)
     {
-        // each movie might have multiple languages, so we loop through those
-        for (int i = 0; i < MAX_LANGUAGES && p_curr->pp_languages[i] != NULL; i++)
+        // room left: add at the bottom and sift up past anything stronger
+        slot = p_bucket->top_count++;
+        while (slot > 0)
         {
-            // do a case-sensitive string comparison 
-            if (strcmp(p_curr->pp_languages[i], p_target_language) == 0)
-            {
-                // found a match, print the year and title
-                printf("%d %s\n", p_curr->release_year, p_curr->p_title);
-                found = 1; // yep, found something
-                break;     // no need to check more languages for this movie
-            }
+            int parent = (slot - 1) / 2;
+            if (!ranks_below(rating, row, p_ratings[parent], p_rows[parent]))
+                break;
+            p_rows[slot] = p_rows[parent];
+            p_ratings[slot] = p_ratings[parent];
+            slot = parent;
         }
+        p_rows[slot] = row;
+        p_ratings[slot] = rating;
+        return;
     }
 
-    // if we never hit a match, tell the user
-    if (!found)
+    // full: only worth it if it beats the weakest (the root), which it then replaces
+    if (!ranks_below(p_ratings[0], p_rows[0], rating, row))
+        return;
+
+    slot = 0;
+    while (1)
     {
-        printf("No data about movies released in %s\n", p_target_language);
+        int child = slot * 2 + 1;
+        if (child >= TOP_PER_YEAR)
+            break;
+        if (child + 1 < TOP_PER_YEAR && ranks_below(p_ratings[child + 1], p_rows[child + 1], p_ratings[child], p_rows[child]))
+            child++;
+        if (!ranks_below(p_ratings[child], p_rows[child], rating, row))
+            break;
+        p_rows[slot] = p_rows[child];
+        p_ratings[slot] = p_ratings[child];
+        slot = child;
     }
+    p_rows[slot] = row;
+    p_ratings[slot] = rating;
 }
- 
-int main(int argc, char **pp_args)
+
+/* file a freshly loaded movie under its year, creating the bucket if needed.
+   also keeps the best rating / tie count current so option 2 never rescans */
+int add_to_year_index(year_index_t * p_index, movie_t * p_movie, int row)
 {
-    // check if the user gave us a filename (we expect: ./movies somefile.csv)
-    if (argc < 2)
-    {
-        // let them know what they did wrong and how to fix it
-        printf("You must provide the name of the file to process\n");
-        printf("Example usage: ./movies movies_sample_1.csv\n");
-        return EXIT_FAILURE; // standard error code for bad run
-    }
+    year_bucket_t * p_bucket = get_year_bucket(p_index, p_movie->release_year);
+    if (NULL == p_bucket)
+        return -1;
 
-    // this will hold how many movies we loaded
-    int total_movies = 0;
+    // append to the end of this year's chain
+    if (NULL == p_bucket->p_first)
+        p_bucket->p_first = p_movie;
+    else
+        p_bucket->p_last->p_next_in_year = p_movie;
+    p_bucket->p_last = p_movie;
 
-    // call the CSV loading function and also give it a pointer to total_movies
-    // so it can update it for us as it reads the file
-    // good example of passing around pointers vs global variables
-    movie_t * p_movie_list = load_movies_from_csv(pp_args[1], &total_movies);
+    if (track_year_best(p_bucket, p_movie->rating, row))
+        p_bucket->p_best = p_movie;
+    push_year_top(p_bucket, p_movie->rating, row);
 
-    // if loading failed or list came back empty, bail
-    if (NULL == p_movie_list)
+    return 0;
+}
+
+/* columnar version: no chain to extend, the bucket just counts and tracks the best row */
+int add_row_to_year_index(year_index_t * p_index, int year, float rating, int row)
+{
+    year_bucket_t * p_bucket = get_year_bucket(p_index, year);
+    if (NULL == p_bucket)
+        return -1;
+
+    track_year_best(p_bucket, rating, row);
+    push_year_top(p_bucket, rating, row);
+    return 0;
+}
+
+/* make room for at least one more row in every column */
+static int grow_movie_columns(movie_columns_t * p_cols)
+{
+    int new_capacity = (0 == p_cols->row_capacity) ? 1024 : p_cols->row_capacity * 2;
+
+    int * p_years = realloc(p_cols->p_years, new_capacity * sizeof(int));
+    if (NULL == p_years)
+        return -1;
+    p_cols->p_years = p_years;
+
+    float * p_ratings = realloc(p_cols->p_ratings, new_capacity * sizeof(float));
+    if (NULL == p_ratings)
+        return -1;
+    p_cols->p_ratings = p_ratings;
+
+    size_t * p_offsets = realloc(p_cols->p_title_offsets, new_capacity * sizeof(size_t));
+    if (NULL == p_offsets)
+        return -1;
+    p_cols->p_title_offsets = p_offsets;
+
+    unsigned int * p_lengths = realloc(p_cols->p_title_lengths, new_capacity * sizeof(unsigned int));
+    if (NULL == p_lengths)
+        return -1;
+    p_cols->p_title_lengths = p_lengths;
+
+    for (int col = 0; col < MAX_LANGUAGES; col++)
+    {
+        lang_id_t * p_lang_col = realloc(p_cols->p_lang_cols[col], new_capacity * sizeof(lang_id_t));
+        if (NULL == p_lang_col)
+            return -1;
+        p_cols->p_lang_cols[col] = p_lang_col;
+    }
+
+    p_cols->row_capacity = new_capacity;
+    stats_count(COUNT_HEAP_ALLOCS, 4 + MAX_LANGUAGES);
+    return 0;
+}
+
+/* tack one movie onto the end of every column. returns -1 if out of memory.
+   if the pool is borrowed (the mmap'd file) the title isn't copied, its
+   offset in the mapping is recorded instead */
+int append_movie_row(movie_columns_t * p_cols, const movie_row_t * p_row)
+{
+    if (p_cols->row_count == p_cols->row_capacity && grow_movie_columns(p_cols) != 0)
+    {
+        fprintf(stderr, "couldn't grow the movie columns\n");
+        return -1;
+    }
+
+    int row = p_cols->row_count;
+
+    if (p_cols->borrows_pool)
+    {
+        p_cols->p_title_offsets[row] = (size_t) (p_row->p_title - p_cols->p_title_pool);
+    }
+    else
+    {
+        if (p_cols->pool_used + p_row->title_length > p_cols->pool_capacity)
+        {
+            size_t new_capacity = (0 == p_cols->pool_capacity) ? 65536 : p_cols->pool_capacity * 2;
+            while (new_capacity < p_cols->pool_used + p_row->title_length)
+                new_capacity *= 2;
+
+            char * p_pool = realloc((char *) p_cols->p_title_pool, new_capacity);
+            if (NULL == p_pool)
+            {
+                fprintf(stderr, "couldn't grow the title pool\n");
+                return -1;
+            }
+            p_cols->p_title_pool = p_pool;
+            p_cols->pool_capacity = new_capacity;
+            stats_count(COUNT_HEAP_ALLOCS, 1);
+        }
+
+        memcpy((char *) p_cols->p_title_pool + p_cols->pool_used, p_row->p_title, p_row->title_length);
+        p_cols->p_title_offsets[row] = p_cols->pool_used;
+        p_cols->pool_used += p_row->title_length;
+    }
+    p_cols->p_title_lengths[row] = (unsigned int) p_row->title_length;
+
+    p_cols->p_years[row] = p_row->release_year;
+    p_cols->p_ratings[row] = p_row->rating;
+    for (int col = 0; col < MAX_LANGUAGES; col++)
+        p_cols->p_lang_cols[col][row] = (col < p_row->lang_count) ? p_row->lang_ids[col] : NO_LANGUAGE;
+
+    p_cols->row_count++;
+    return 0;
+}
+
+/* title of a row in the columnar layout (use with p_title_lengths[row], no '\0') */
+static const char * column_title(const movie_columns_t * p_cols, int row)
+{
+    return p_cols->p_title_pool + p_cols->p_title_offsets[row];
+}
+
+void free_movie_columns(movie_columns_t * p_cols)
+{
+    // snapshot columns go away with the munmap in free_movie_db()
+    if (p_cols->is_mapped)
+    {
+        memset(p_cols, 0, sizeof(*p_cols));
+        return;
+    }
+
+    free(p_cols->p_years);
+    free(p_cols->p_ratings);
+    free(p_cols->p_title_offsets);
+    free(p_cols->p_title_lengths);
+    for (int col = 0; col < MAX_LANGUAGES; col++)
+        free(p_cols->p_lang_cols[col]);
+    if (!p_cols->borrows_pool)
+        free((char *) p_cols->p_title_pool);
+    memset(p_cols, 0, sizeof(*p_cols));
+}
+
+/* ---- compact layout ----
+   one compact_movie_t per row in one array plus a title pool. a year and a
+   rating are narrowed on the way in, so a row that can't be narrowed
+   (a year past 16 bits, a rating past 25.5) is skipped like a bad record */
+
+/* make room for at least one more record */
+static int grow_compact_store(compact_store_t * p_store)
+{
+    int new_capacity = (0 == p_store->row_capacity) ? 1024 : p_store->row_capacity * 2;
+
+    compact_movie_t * p_records = realloc(p_store->p_records, new_capacity * sizeof(compact_movie_t));
+    if (NULL == p_records)
+        return -1;
+    p_store->p_records = p_records;
+    p_store->row_capacity = new_capacity;
+    stats_count(COUNT_HEAP_ALLOCS, 1);
+    return 0;
+}
+
+/* tack one movie onto the end of the store, title copied into the pool.
+   returns -1 if it doesn't fit a record or we're out of memory */
+int append_compact_row(compact_store_t * p_store, const movie_row_t * p_row)
+{
+    if (p_row->release_year < INT16_MIN || p_row->release_year > INT16_MAX
+        || !(p_row->rating >= 0.0f && p_row->rating <= 25.5f)
+        || p_store->pool_used + p_row->title_length > UINT32_MAX)
+    {
+        stats_count(COUNT_ROWS_SKIPPED, 1);
+        return -1;
+    }
+
+    if (p_store->row_count == p_store->row_capacity && grow_compact_store(p_store) != 0)
+    {
+        fprintf(stderr, "couldn't grow the compact records\n");
+        return -1;
+    }
+
+    if (p_store->pool_used + p_row->title_length > p_store->pool_capacity)
+    {
+        size_t new_capacity = (0 == p_store->pool_capacity) ? 65536 : p_store->pool_capacity * 2;
+        while (new_capacity < p_store->pool_used + p_row->title_length)
+            new_capacity *= 2;
+
+        char * p_pool = realloc(p_store->p_title_pool, new_capacity);
+        if (NULL == p_pool)
+        {
+            fprintf(stderr, "couldn't grow the title pool\n");
+            return -1;
+        }
+        p_store->p_title_pool = p_pool;
+        p_store->pool_capacity = new_capacity;
+        stats_count(COUNT_HEAP_ALLOCS, 1);
+    }
+
+    compact_movie_t * p_record = &p_store->p_records[p_store->row_count];
+    memcpy(p_store->p_title_pool + p_store->pool_used, p_row->p_title, p_row->title_length);
+    p_record->title_offset = (uint32_t) p_store->pool_used;
+    p_store->pool_used += p_row->title_length;
+
+    // the data only ever has one decimal, so tenths lose nothing
+    p_record->year = (int16_t) p_row->release_year;
+    p_record->rating_tenths = (uint8_t) (p_row->rating * 10.0f + 0.5f);
+    p_record->lang_count = (uint8_t) p_row->lang_count;
+    for (int lang = 0; lang < MAX_LANGUAGES; lang++)
+        p_record->lang_ids[lang] = (lang < p_row->lang_count) ? p_row->lang_ids[lang] : NO_LANGUAGE;
+
+    p_store->row_count++;
+    return 0;
+}
+
+/* a record's rating back as the float the parser made (n / 10.0f rounds to the same float strtof does) */
+static float compact_rating(const compact_movie_t * p_record)
+{
+    return p_record->rating_tenths / 10.0f;
+}
+
+/* title of a row in the compact layout, not '\0' terminated */
+static const char * compact_title(const compact_store_t * p_store, int row, size_t * p_length)
+{
+    size_t begin = p_store->p_records[row].title_offset;
+    size_t end = (row + 1 < p_store->row_count) ? p_store->p_records[row + 1].title_offset : p_store->pool_used;
+
+    *p_length = end - begin;
+    return p_store->p_title_pool + begin;
+}
+
+void free_compact_store(compact_store_t * p_store)
+{
+    free(p_store->p_records);
+    free(p_store->p_title_pool);
+    memset(p_store, 0, sizeof(*p_store));
+}
+
+/* ---- column scan kernels ----
+   each one looks at rows [begin, end), writes the row numbers that match
+   into p_out (in order) and returns how many it wrote. p_out needs room
+   for end - begin rows. */
+
+static int scan_years_scalar(const int * p_years, int begin, int end, int target, int * p_out)
+{
+    int found = 0;
+
+    for (int row = begin; row < end; row++)
+    {
+        // branch-free append: always write, only advance on a match
+        p_out[found] = row;
+        found += (p_years[row] == target);
+    }
+
+    return found;
+}
+
+static int scan_langs_scalar(lang_id_t * const * pp_cols, int begin, int end, lang_id_t target, int * p_out)
+{
+    int found = 0;
+
+    for (int row = begin; row < end; row++)
+    {
+        int hit = 0;
+        for (int col = 0; col < MAX_LANGUAGES; col++)
+            hit |= (pp_cols[col][row] == target);
+
+        p_out[found] = row;
+        found += hit;
+    }
+
+    return found;
+}
+
+#ifdef MOVIES_X86_SIMD
+/* 4 years per compare. movemask hands back one bit per matching lane */
+static int scan_years_sse2(const int * p_years, int begin, int end, int target, int * p_out)
+{
+    __m128i needle = _mm_set1_epi32(target);
+    int found = 0;
+    int row = begin;
+
+    for (; row + 4 <= end; row += 4)
+    {
+        __m128i years = _mm_loadu_si128((const __m128i *) (p_years + row));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(years, needle)));
+
+        while (mask)
+        {
+            p_out[found++] = row + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    return found + scan_years_scalar(p_years, row, end, target, p_out + found);
+}
+
+/* 8 rows per step. each 16-bit lane that matches sets two bits in the byte mask */
+static int scan_langs_sse2(lang_id_t * const * pp_cols, int begin, int end, lang_id_t target, int * p_out)
+{
+    __m128i needle = _mm_set1_epi16((short) target);
+    int found = 0;
+    int row = begin;
+
+    for (; row + 8 <= end; row += 8)
+    {
+        __m128i hits = _mm_setzero_si128();
+        for (int col = 0; col < MAX_LANGUAGES; col++)
+        {
+            __m128i ids = _mm_loadu_si128((const __m128i *) (pp_cols[col] + row));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi16(ids, needle));
+        }
+
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(hits) & 0x5555u;
+        while (mask)
+        {
+            p_out[found++] = row + (__builtin_ctz(mask) >> 1);
+            mask &= mask - 1;
+        }
+    }
+
+    return found + scan_langs_scalar(pp_cols, row, end, target, p_out + found);
+}
+
+/* same thing, 8 years per compare */
+__attribute__((target("avx2")))
+static int scan_years_avx2(const int * p_years, int begin, int end, int target, int * p_out)
+{
+    __m256i needle = _mm256_set1_epi32(target);
+    int found = 0;
+    int row = begin;
+
+    for (; row + 8 <= end; row += 8)
+    {
+        __m256i years = _mm256_loadu_si256((const __m256i *) (p_years + row));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(years, needle)));
+
+        while (mask)
+        {
+            p_out[found++] = row + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    return found + scan_years_scalar(p_years, row, end, target, p_out + found);
+}
+
+/* 16 rows per step */
+__attribute__((target("avx2")))
+static int scan_langs_avx2(lang_id_t * const * pp_cols, int begin, int end, lang_id_t target, int * p_out)
+{
+    __m256i needle = _mm256_set1_epi16((short) target);
+    int found = 0;
+    int row = begin;
+
+    for (; row + 16 <= end; row += 16)
+    {
+        __m256i hits = _mm256_setzero_si256();
+        for (int col = 0; col < MAX_LANGUAGES; col++)
+        {
+            __m256i ids = _mm256_loadu_si256((const __m256i *) (pp_cols[col] + row));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi16(ids, needle));
+        }
+
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hits) & 0x55555555u;
+        while (mask)
+        {
+            p_out[found++] = row + (__builtin_ctz(mask) >> 1);
+            mask &= mask - 1;
+        }
+    }
+
+    return found + scan_langs_scalar(pp_cols, row, end, target, p_out + found);
+}
+#endif
+
+/* the kernels we'll actually use, picked once by pick_scan_kernels() */
+static int (*scan_years)(const int *, int, int, int, int *) = scan_years_scalar;
+static int (*scan_langs)(lang_id_t * const *, int, int, lang_id_t, int *) = scan_langs_scalar;
+
+/* use the widest kernels this CPU can run */
+void pick_scan_kernels(void)
+{
+#ifdef MOVIES_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_years = scan_years_avx2;
+        scan_langs = scan_langs_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        scan_years = scan_years_sse2;
+        scan_langs = scan_langs_sse2;
+    }
+#endif
+}
+
+/* the buckets only point into the list, so just the array itself gets freed */
+void free_year_index(year_index_t * p_index)
+{
+    free(p_index->p_buckets);
+    p_index->p_buckets = NULL;
+    p_index->bucket_count = 0;
+    p_index->bucket_capacity = 0;
+}
+
+void free_rating_index(rating_index_t * p_index)
+{
+    if (!p_index->is_mapped)
+    {
+        free(p_index->p_rows);
+        free(p_index->p_ratings);
+    }
+    memset(p_index, 0, sizeof(*p_index));
+}
+
+/* ---- query result cache ----
+   the output of a query, rendered once, keyed by the output format plus the
+   query text. asking the same thing again is then one copy of those bytes
+   (or one write) instead of another walk over the data. every loaded
+   dataset has its own cache and frees it along with everything else, so a
+   reload (--watch) starts out empty and nothing stale is ever handed out */
+
+/* NULL (no caching) when byte_limit is 0 or there's no memory for it */
+query_cache_t * query_cache_create(size_t byte_limit)
+{
+    if (0 == byte_limit)
+        return NULL;
+
+    query_cache_t * p_cache = calloc(1, sizeof(query_cache_t));
+    if (NULL == p_cache)
+        return NULL;
+
+    pthread_mutex_init(&p_cache->lock, NULL);
+    p_cache->byte_limit = byte_limit;
+    return p_cache;
+}
+
+static void free_cached_output(cached_output_t * p_entry)
+{
+    free(p_entry->p_key);
+    free(p_entry->p_data);
+    free(p_entry);
+}
+
+/* only once nobody is reading from it (the server reaps a version with no readers left) */
+void query_cache_free(query_cache_t * p_cache)
+{
+    if (NULL == p_cache)
+        return;
+
+    cached_output_t * p_entry = p_cache->p_newest;
+    while (NULL != p_entry)
+    {
+        cached_output_t * p_older = p_entry->p_older;
+        free_cached_output(p_entry);
+        p_entry = p_older;
+    }
+
+    pthread_mutex_destroy(&p_cache->lock);
+    free(p_cache);
+}
+
+/* the LRU list and hash chain helpers below all expect the lock held */
+static void unlink_lru(query_cache_t * p_cache, cached_output_t * p_entry)
+{
+    if (NULL != p_entry->p_newer)
+        p_entry->p_newer->p_older = p_entry->p_older;
+    else
+        p_cache->p_newest = p_entry->p_older;
+
+    if (NULL != p_entry->p_older)
+        p_entry->p_older->p_newer = p_entry->p_newer;
+    else
+        p_cache->p_oldest = p_entry->p_newer;
+}
+
+static void push_lru_newest(query_cache_t * p_cache, cached_output_t * p_entry)
+{
+    p_entry->p_newer = NULL;
+    p_entry->p_older = p_cache->p_newest;
+    if (NULL != p_cache->p_newest)
+        p_cache->p_newest->p_newer = p_entry;
+    else
+        p_cache->p_oldest = p_entry;
+    p_cache->p_newest = p_entry;
+}
+
+static cached_output_t * find_cached_output(const query_cache_t * p_cache, const char * p_key, size_t key_length, unsigned int hash)
+{
+    cached_output_t * p_entry = p_cache->p_slots[hash % QUERY_CACHE_SLOTS];
+
+    while (NULL != p_entry && (p_entry->hash != hash || p_entry->key_length != key_length
+                               || memcmp(p_entry->p_key, p_key, key_length) != 0))
+        p_entry = p_entry->p_next_in_slot;
+
+    return p_entry;
+}
+
+/* take the oldest entry out; it's freed now unless someone is still copying it */
+static void evict_oldest(query_cache_t * p_cache)
+{
+    cached_output_t * p_entry = p_cache->p_oldest;
+    cached_output_t ** pp_link = &p_cache->p_slots[p_entry->hash % QUERY_CACHE_SLOTS];
+
+    while (*pp_link != p_entry)
+        pp_link = &(*pp_link)->p_next_in_slot;
+    *pp_link = p_entry->p_next_in_slot;
+    unlink_lru(p_cache, p_entry);
+
+    p_cache->bytes_used -= p_entry->length + p_entry->key_length;
+    p_cache->entry_count--;
+    p_cache->evictions++;
+
+    if (0 == p_entry->refs)
+        free_cached_output(p_entry);
+    else
+        p_entry->is_evicted = 1;
+}
+
+/* the cached result for this key (now the most recently used one), or NULL.
+   a result that comes back has to go back through query_cache_release() */
+cached_output_t * query_cache_get(query_cache_t * p_cache, const char * p_key, size_t key_length)
+{
+    unsigned int hash = hash_language(p_key, key_length);
+
+    pthread_mutex_lock(&p_cache->lock);
+    cached_output_t * p_entry = find_cached_output(p_cache, p_key, key_length, hash);
+    if (NULL == p_entry)
+    {
+        p_cache->misses++;
+    }
+    else
+    {
+        p_cache->hits++;
+        p_entry->refs++;
+        if (p_cache->p_newest != p_entry)
+        {
+            unlink_lru(p_cache, p_entry);
+            push_lru_newest(p_cache, p_entry);
+        }
+    }
+    pthread_mutex_unlock(&p_cache->lock);
+
+    stats_count((NULL == p_entry) ? COUNT_CACHE_MISSES : COUNT_CACHE_HITS, 1);
+    return p_entry;
+}
+
+void query_cache_release(query_cache_t * p_cache, cached_output_t * p_entry)
+{
+    pthread_mutex_lock(&p_cache->lock);
+    int is_last = (0 == --p_entry->refs && p_entry->is_evicted);
+    pthread_mutex_unlock(&p_cache->lock);
+
+    if (is_last)
+        free_cached_output(p_entry);
+}
+
+/* hand a freshly rendered result over to the cache, which owns p_data from
+   here on whether it keeps it or not. anything bigger than half the budget is
+   dropped instead of pushing everything else out */
+void query_cache_put(query_cache_t * p_cache, const char * p_key, size_t key_length, char * p_data, size_t length)
+{
+    size_t cost = length + key_length;
+    cached_output_t * p_entry = (cost > p_cache->byte_limit / 2) ? NULL : calloc(1, sizeof(cached_output_t));
+    char * p_key_copy = (NULL == p_entry) ? NULL : malloc(key_length + 1);
+
+    if (NULL == p_key_copy)
+    {
+        free(p_entry);
+        free(p_data);
+        return;
+    }
+
+    memcpy(p_key_copy, p_key, key_length);
+    p_key_copy[key_length] = '\0';
+    p_entry->p_key = p_key_copy;
+    p_entry->key_length = key_length;
+    p_entry->hash = hash_language(p_key, key_length);
+    p_entry->p_data = p_data;
+    p_entry->length = length;
+
+    pthread_mutex_lock(&p_cache->lock);
+
+    // two workers can miss on the same query at once, the first one in stays
+    if (NULL != find_cached_output(p_cache, p_key, key_length, p_entry->hash))
+    {
+        pthread_mutex_unlock(&p_cache->lock);
+        free_cached_output(p_entry);
+        return;
+    }
+
+    while (p_cache->bytes_used + cost > p_cache->byte_limit && NULL != p_cache->p_oldest)
+        evict_oldest(p_cache);
+
+    cached_output_t ** pp_slot = &p_cache->p_slots[p_entry->hash % QUERY_CACHE_SLOTS];
+    p_entry->p_next_in_slot = *pp_slot;
+    *pp_slot = p_entry;
+    push_lru_newest(p_cache, p_entry);
+    p_cache->bytes_used += cost;
+    p_cache->entry_count++;
+
+    pthread_mutex_unlock(&p_cache->lock);
+}
+
+/* heap bytes the loaded data holds: the layout itself plus every index on
+   top of it. the mmap'd file and snapshot mappings are page cache, not
+   counted. --stats reports it as storage_bytes */
+static size_t movie_db_footprint(const movie_db_t * p_db)
+{
+    const movie_columns_t * p_cols = &p_db->columns;
+    size_t bytes = p_db->arena.bytes_reserved
+                 + (size_t) p_db->row_capacity * sizeof(movie_t *)
+                 + (size_t) p_db->compact.row_capacity * sizeof(compact_movie_t) + p_db->compact.pool_capacity
+                 + (size_t) p_db->year_index.bucket_capacity * sizeof(year_bucket_t)
+                 + (size_t) p_db->lang_dict.lang_capacity * sizeof(lang_entry_t)
+                 + (size_t) p_db->lang_dict.slot_count * sizeof(unsigned int);
+
+    if (!p_cols->is_mapped)
+    {
+        bytes += (size_t) p_cols->row_capacity * (sizeof(int) + sizeof(float) + sizeof(size_t) + sizeof(unsigned int)
+                                                  + MAX_LANGUAGES * sizeof(lang_id_t));
+        if (!p_cols->borrows_pool)
+            bytes += p_cols->pool_capacity;
+    }
+    if (!p_db->rating_index.is_mapped)
+        bytes += (size_t) p_db->rating_index.count * (sizeof(int) + sizeof(float));
+
+    for (int id = 0; id < p_db->lang_dict.lang_count; id++)
+    {
+        const lang_entry_t * p_entry = &p_db->lang_dict.p_entries[id];
+        bytes += (size_t) p_entry->posting_capacity * sizeof(movie_t *) + strlen(p_entry->p_name) + 1;
+    }
+
+    return bytes;
+}
+
+/* frees the list (or the columns) and every index built on top of it.
+   the nodes and titles all live in the arena, so that's a single release
+   instead of walking the list freeing node by node.
+   if a newer version took the storage over (--watch), only the index arrays go */
+void free_movie_db(movie_db_t * p_db)
+{
+    if (p_db->storage_moved)
+    {
+        // the entries array is ours, the names in it aren't
+        for (int id = 0; id < p_db->lang_dict.lang_count; id++)
+            p_db->lang_dict.p_entries[id].p_name = NULL;
+        p_db->arena.p_current = NULL;
+        p_db->p_map = NULL;
+    }
+
+    free_year_index(&p_db->year_index);
+    free_lang_dict(&p_db->lang_dict);
+    free_movie_columns(&p_db->columns);
+    free_compact_store(&p_db->compact);
+    free_rating_index(&p_db->rating_index);
+    query_cache_free(p_db->p_cache);
+    p_db->p_cache = NULL;
+    if (!p_db->rows_moved)
+        free(p_db->pp_rows);
+    p_db->pp_rows = NULL;
+    arena_release(&p_db->arena);
+    if (NULL != p_db->p_map)
+        munmap((void *) p_db->p_map, p_db->map_length);
+    p_db->p_map = NULL;
+    p_db->p_head = NULL;
+    p_db->total_count = 0;
+}
+
+/* store_movie_row() minus the timing */
+static int file_movie_row(movie_db_t *p_db, const movie_row_t *p_row)
+{
+    // columnar layout: append to the columns and just count it in its year bucket
+    if (LAYOUT_COLUMNAR == p_db->layout)
+    {
+        if (append_movie_row(&p_db->columns, p_row) != 0)
+            return -1;
+
+        if (add_row_to_year_index(&p_db->year_index, p_row->release_year, p_row->rating, p_db->total_count) != 0)
+        {
+            // take the row back off so the columns and the index still agree
+            p_db->columns.row_count--;
+            if (!p_db->columns.borrows_pool)
+                p_db->columns.pool_used -= p_row->title_length;
+            return -1;
+        }
+        p_db->total_count++;
+        return 0;
+    }
+
+    // compact layout: same, into the record array. the index gets the narrowed rating
+    // so best-per-year and top-per-year rank exactly what the queries will print
+    if (LAYOUT_COMPACT == p_db->layout)
+    {
+        if (append_compact_row(&p_db->compact, p_row) != 0)
+            return -1;
+
+        const compact_movie_t * p_record = &p_db->compact.p_records[p_db->total_count];
+        if (add_row_to_year_index(&p_db->year_index, p_record->year, compact_rating(p_record), p_db->total_count) != 0)
+        {
+            p_db->compact.row_count--;
+            p_db->compact.pool_used -= p_row->title_length;
+            return -1;
+        }
+        p_db->total_count++;
+        return 0;
+    }
+
+    // now that we have all fields, build a new node on the heap
+    int is_in_map = (NULL != p_db->p_map && p_row->p_title >= p_db->p_map && p_row->p_title < p_db->p_map + p_db->map_length);
+    movie_t *p_new_node = create_movie_node(&p_db->arena, p_row, !is_in_map);
+
+    // if something went wrong, skip this one
+    if (NULL == p_new_node)
+        return -1;
+
+    // remember which node this row number is
+    if (p_db->total_count == p_db->row_capacity)
+    {
+        int new_capacity = (0 == p_db->row_capacity) ? 1024 : p_db->row_capacity * 2;
+        movie_t ** pp_grown = grow_index_array(p_db->pp_rows, p_db->total_count * sizeof(movie_t *),
+                                               new_capacity * sizeof(movie_t *), p_db->rows_shared);
+        if (NULL == pp_grown)
+        {
+            fprintf(stderr, "couldn't grow the row table\n");
+            return -1;
+        }
+        p_db->pp_rows = pp_grown;
+        p_db->row_capacity = new_capacity;
+        p_db->rows_shared = 0;
+        stats_count(COUNT_HEAP_ALLOCS, 1);
+    }
+
+    // file it under its languages and its year while we're here so the queries never rescan
+    // the list. the year index only fails before it changes anything, so it goes last and a
+    // row that can't be filed everywhere is filed nowhere (the node just stays in the arena)
+    if (add_to_lang_postings(&p_db->lang_dict, p_new_node) != 0)
+        return -1;
+    if (add_to_year_index(&p_db->year_index, p_new_node, p_db->total_count) != 0)
+    {
+        drop_lang_postings(&p_db->lang_dict, p_new_node);
+        return -1;
+    }
+    p_db->pp_rows[p_db->total_count] = p_new_node;
+
+    // if this is the first valid movie, it becomes both head and tail
+    if (NULL == p_db->p_head)
+        p_db->p_head = p_db->p_tail = p_new_node;
+    else
+    {
+        // otherwise, we add to the end of the list and move the tail forward
+        p_db->p_tail->p_next = p_new_node;
+        p_db->p_tail = p_new_node;
+    }
+
+    // keep track of how many good movies we added to the list
+    p_db->total_count++;
+    return 0;
+}
+
+/* file one parsed row into whichever layout we're using and into the indexes.
+   titles get copied unless they sit in the mapping (rows appended later don't).
+   returns -1 if the row couldn't be stored */
+int store_movie_row(movie_db_t *p_db, const movie_row_t *p_row)
+{
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_STORE);
+    int result = file_movie_row(p_db, p_row);
+    stats_end(&timer);
+    return result;
+}
+
+/* rating of a row, whatever the layout */
+static float row_rating(const movie_db_t *p_db, int row)
+{
+    if (LAYOUT_COMPACT == p_db->layout)
+        return compact_rating(&p_db->compact.p_records[row]);
+    return (LAYOUT_COLUMNAR == p_db->layout) ? p_db->columns.p_ratings[row] : p_db->pp_rows[row]->rating;
+}
+
+/* float bits -> unsigned key that sorts the same way, flipped so the best
+   rating gets the smallest key */
+static uint32_t rating_sort_key(float rating)
+{
+    uint32_t bits;
+    memcpy(&bits, &rating, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    return ~bits;
+}
+
+/* rows first_row .. first_row + count - 1 sorted by rating, best first.
+   LSD radix sort, 4 passes of 8 bits: linear time, and stable, so rows
+   with the same rating stay in file order without comparing row numbers.
+   returns a malloc'd array, NULL if out of memory */
+static int *sort_rows_by_rating(const movie_db_t *p_db, int first_row, int count)
+{
+    int *p_rows = malloc(count * sizeof(int));
+    int *p_spare_rows = malloc(count * sizeof(int));
+    uint32_t *p_keys = malloc(count * sizeof(uint32_t));
+    uint32_t *p_spare_keys = malloc(count * sizeof(uint32_t));
+    if (NULL == p_rows || NULL == p_spare_rows || NULL == p_keys || NULL == p_spare_keys)
+    {
+        free(p_rows);
+        free(p_spare_rows);
+        free(p_keys);
+        free(p_spare_keys);
+        return NULL;
+    }
+    stats_count(COUNT_HEAP_ALLOCS, 4);
+
+    for (int index = 0; index < count; index++)
+    {
+        p_rows[index] = first_row + index;
+        p_keys[index] = rating_sort_key(row_rating(p_db, first_row + index));
+    }
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        int offsets[256] = {0};
+
+        for (int index = 0; index < count; index++)
+            offsets[(p_keys[index] >> shift) & 0xFF]++;
+
+        // every row has the same byte here (ratings cluster a lot): nothing to move
+        if (offsets[(p_keys[0] >> shift) & 0xFF] == count)
+            continue;
+
+        int total = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            int digit_count = offsets[digit];
+            offsets[digit] = total;
+            total += digit_count;
+        }
+
+        for (int index = 0; index < count; index++)
+        {
+            int slot = offsets[(p_keys[index] >> shift) & 0xFF]++;
+            p_spare_keys[slot] = p_keys[index];
+            p_spare_rows[slot] = p_rows[index];
+        }
+
+        uint32_t *p_swap_keys = p_keys;
+        p_keys = p_spare_keys;
+        p_spare_keys = p_swap_keys;
+        int *p_swap_rows = p_rows;
+        p_rows = p_spare_rows;
+        p_spare_rows = p_swap_rows;
+    }
+
+    free(p_keys);
+    free(p_spare_keys);
+    free(p_spare_rows);
+    return p_rows;
+}
+
+/* sort every row by rating (best first, ties in file order) into p_db->rating_index.
+   returns -1 if out of memory (the top/range queries then report no data) */
+int build_rating_index(movie_db_t *p_db)
+{
+    rating_index_t *p_index = &p_db->rating_index;
+    int count = p_db->total_count;
+
+    free_rating_index(p_index);
+    if (0 == count)
+        return 0;
+
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_RATING_INDEX);
+
+    int *p_rows = sort_rows_by_rating(p_db, 0, count);
+    float *p_ratings = (NULL == p_rows) ? NULL : malloc(count * sizeof(float));
+    if (NULL == p_ratings)
+    {
+        fprintf(stderr, "couldn't build the rating index\n");
+        free(p_rows);
+        stats_end(&timer);
+        return -1;
+    }
+    stats_count(COUNT_HEAP_ALLOCS, 1);
+
+    for (int index = 0; index < count; index++)
+        p_ratings[index] = row_rating(p_db, p_rows[index]);
+
+    p_index->p_rows = p_rows;
+    p_index->p_ratings = p_ratings;
+    p_index->count = count;
+    stats_end(&timer);
+    return 0;
+}
+
+/* --watch: p_db is p_old's rows plus some appended ones. sort just the new rows and
+   merge them into a copy of p_old, rather than sort everything again: a binary search
+   per new row and one memcpy per run of old ones in between. an old row goes before a
+   new one with the same rating, it's earlier in the file. returns -1 if out of memory */
+static int extend_rating_index(movie_db_t *p_db, const rating_index_t *p_old)
+{
+    rating_index_t *p_index = &p_db->rating_index;
+    int old_count = p_old->count;
+    int added_count = p_db->total_count - old_count;
+    int count = p_db->total_count;
+
+    free_rating_index(p_index);
+    if (0 == count)
+        return 0;
+
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_RATING_INDEX);
+
+    int *p_added = (added_count > 0) ? sort_rows_by_rating(p_db, old_count, added_count) : NULL;
+    int *p_rows = malloc(count * sizeof(int));
+    float *p_ratings = malloc(count * sizeof(float));
+    if ((added_count > 0 && NULL == p_added) || NULL == p_rows || NULL == p_ratings)
+    {
+        fprintf(stderr, "couldn't build the rating index\n");
+        free(p_added);
+        free(p_rows);
+        free(p_ratings);
+        stats_end(&timer);
+        return -1;
+    }
+    stats_count(COUNT_HEAP_ALLOCS, 2);
+
+    int taken = 0;  // old entries copied so far
+    int index = 0;  // next free slot
+    for (int added = 0; added < added_count; added++)
+    {
+        float rating = row_rating(p_db, p_added[added]);
+        uint32_t key = rating_sort_key(rating);
+
+        // every old row rated at least this well goes first
+        int low = taken;
+        int high = old_count;
+        while (low < high)
+        {
+            int middle = low + (high - low) / 2;
+            if (rating_sort_key(p_old->p_ratings[middle]) <= key)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        memcpy(p_rows + index, p_old->p_rows + taken, (low - taken) * sizeof(int));
+        memcpy(p_ratings + index, p_old->p_ratings + taken, (low - taken) * sizeof(float));
+        index += low - taken;
+        taken = low;
+
+        p_rows[index] = p_added[added];
+        p_ratings[index] = rating;
+        index++;
+    }
+    memcpy(p_rows + index, p_old->p_rows + taken, (old_count - taken) * sizeof(int));
+    memcpy(p_ratings + index, p_old->p_ratings + taken, (old_count - taken) * sizeof(float));
+    free(p_added);
+
+    p_index->p_rows = p_rows;
+    p_index->p_ratings = p_ratings;
+    p_index->count = count;
+    stats_end(&timer);
+    return 0;
+}
+
+/* atoi / strtof need a terminated string and the mapping doesn't have one,
+   so the (short) number gets copied onto the stack first */
+static void copy_number_field(const csv_field_t * p_field, char * p_buffer, size_t buffer_size)
+{
+    size_t length = p_field->length;
+    if (length >= buffer_size)
+        length = buffer_size - 1;
+    memcpy(p_buffer, p_field->p_data, length);
+    p_buffer[length] = '\0';
+}
+
+/* split one record (no newline) into a row. the shared tokenizer does the
+   CSV part: title, year, [languages], rating, with quoted fields allowed.
+   the title stays a view into p_line; the only write is for a quoted title
+   with "" in it, which gets unescaped in place. returns -1 for records
+   missing fields */
+int parse_movie_view(char * p_line, size_t length, lang_dict_t * p_dict, movie_row_t * p_row)
+{
+    csv_field_t fields[4];
+    char number[32];
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_PARSE);
+
+    if (csv_split_record(p_line, length, fields, 4) < 4 || 0 == fields[0].length)
+    {
+        stats_count(COUNT_ROWS_SKIPPED, 1);
+        stats_end(&timer);
+        return -1;
+    }
+
+    // title
+    p_row->p_title = fields[0].p_data;
+    p_row->title_length = fields[0].length;
+    if (fields[0].has_escapes)
+    {
+        char * p_title = p_line + (fields[0].p_data - p_line);
+        p_row->title_length = csv_unescape(&fields[0], p_title);
+    }
+
+    // year
+    copy_number_field(&fields[1], number, sizeof(number));
+    p_row->release_year = atoi(number);
+
+    // languages: [English;French] -> ids, looked up straight from the record
+    stats_timer_t lang_timer;
+    stats_begin(&lang_timer, PHASE_LANGUAGES);
+    const char * p_field_end = fields[2].p_data + fields[2].length;
+    const char * p_lang = memchr(fields[2].p_data, '[', fields[2].length);
+    p_lang = (NULL == p_lang) ? fields[2].p_data : p_lang + 1;
+    const char * p_lang_end = memchr(p_lang, ']', (size_t) (p_field_end - p_lang));
+    if (NULL == p_lang_end)
+        p_lang_end = p_field_end;
+
+    p_row->lang_count = 0;
+    while (p_lang < p_lang_end && p_row->lang_count < MAX_LANGUAGES)
+    {
+        const char * p_semi = memchr(p_lang, ';', (size_t) (p_lang_end - p_lang));
+        if (NULL == p_semi)
+            p_semi = p_lang_end;
+
+        // strtok_r skipped empty tokens, so we do too
+        if (p_semi > p_lang)
+        {
+            int id = intern_language(p_dict, p_lang, (size_t) (p_semi - p_lang));
+            if (id >= 0)
+                p_row->lang_ids[p_row->lang_count++] = (lang_id_t) id;
+        }
+        p_lang = p_semi + 1;
+    }
+    stats_end(&lang_timer);
+
+    // rating
+    copy_number_field(&fields[3], number, sizeof(number));
+    p_row->rating = strtof(number, NULL);
+
+    stats_count(COUNT_ROWS_PARSED, 1);
+    stats_end(&timer);
+    return 0;
+}
+
+/* csv_getline, counted as the read phase */
+static ssize_t read_record(char ** pp_line, size_t * p_capacity, FILE * p_file)
+{
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_READ);
+    ssize_t read = csv_getline(pp_line, p_capacity, p_file);
+    if (read > 0)
+        stats_count(COUNT_BYTES_READ, (uint64_t) read);
+    stats_end(&timer);
+    return read;
+}
+
+/* csv_record_end for the loaders that have the bytes in memory, counted the same way */
+static char * find_record_end(char * p_curr, char * p_end)
+{
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_READ);
+    char * p_record_end = (char *) csv_record_end(p_curr, p_end, NULL);
+    stats_count(COUNT_BYTES_READ, (uint64_t) (p_record_end - p_curr) + (p_record_end < p_end));
+    stats_end(&timer);
+    return p_record_end;
+}
+
+ /* this came straight from movies.c — adapted it to build up our own linked list.
+    reads a record at a time (csv_getline, so quoted newlines don't split a row)
+    and hands each one to store_movie_row() */
+static int load_movies_with_getline(char *p_filename, int whole_records_only, movie_db_t *p_db)
+{
+    // try to open the file in read mode
+    FILE *p_file = fopen(p_filename, "r");
+
+    // if file doesn't open properly, bail out
+    if (NULL == p_file)
+    {
+        fprintf(stderr, "couldn't open that file!\n");
+        return -1;
+    }
+
+    // buffer that will hold one full record of text from the file
+    char *p_curr_line = NULL;
+
+    // getline needs us to pass in the size of the buffer — this will get updated by getline
+    size_t line_length = 0;
+
+    // 'read' will store how many characters were read by getline
+    ssize_t read;
+
+    // flag to skip the first line (the header row in the CSV)
+    int is_first_line = 1;
+
+
+    // read the file record-by-record
+    while ((read = read_record(&p_curr_line, &line_length, p_file)) != -1)
+    {
+        // the writer is still on this one (--watch): the next append finishes it and it gets parsed then
+        if (whole_records_only && (0 == read || '\n' != p_curr_line[read - 1]))
+            break;
+        p_db->parsed_bytes += (size_t) read;
+
+        // first line is just column headers — skip it
+        if (is_first_line)
+        {
+            is_first_line = 0;
+            continue;
+        }
+
+        // drop the newline, the tokenizer wants just the record
+        size_t length = (size_t) read;
+        if (length > 0 && '\n' == p_curr_line[length - 1])
+            length--;
+
+        // title, year, [languages], rating -- same splitting as the mmap loader
+        movie_row_t row;
+        if (length > 0 && 0 == parse_movie_view(p_curr_line, length, &p_db->lang_dict, &row))
+            store_movie_row(p_db, &row);
+    }
+
+    // getline allocates memory for the line buffer, so we free it here
+    free(p_curr_line);
+
+    // done reading — close the file
+    fclose(p_file);
+
+    return p_db->total_count;
+}
+
+/* one parser thread's slice of the file and what it pulled out of it.
+   rows use this chunk's own language ids until merge time, so the threads
+   never share (or lock) the real dictionary */
+typedef struct parse_chunk
+{
+    char * p_begin;             // first byte of the first record in the chunk
+    char * p_end;               // one past the last record's newline
+    movie_row_t * p_rows;       // partial store, in file order
+    int row_count;
+    int row_capacity;
+    lang_dict_t local_langs;
+    int failed;                 // ran out of memory
+} parse_chunk_t;
+
+/* thread body: parse every record of one chunk into its partial store */
+static void * parse_chunk_worker(void * p_arg)
+{
+    parse_chunk_t * p_chunk = p_arg;
+    char * p_curr = p_chunk->p_begin;
+
+    while (p_curr < p_chunk->p_end)
+    {
+        char * p_line_end = find_record_end(p_curr, p_chunk->p_end);
+
+        if (p_chunk->row_count == p_chunk->row_capacity)
+        {
+            int new_capacity = (0 == p_chunk->row_capacity) ? 4096 : p_chunk->row_capacity * 2;
+            movie_row_t * p_grown = realloc(p_chunk->p_rows, new_capacity * sizeof(movie_row_t));
+            if (NULL == p_grown)
+            {
+                p_chunk->failed = 1;
+                return NULL;
+            }
+            p_chunk->p_rows = p_grown;
+            p_chunk->row_capacity = new_capacity;
+            stats_count(COUNT_HEAP_ALLOCS, 1);
+        }
+
+        movie_row_t * p_row = &p_chunk->p_rows[p_chunk->row_count];
+        if (p_line_end > p_curr && 0 == parse_movie_view(p_curr, (size_t) (p_line_end - p_curr), &p_chunk->local_langs, p_row))
+            p_chunk->row_count++;
+
+        p_curr = p_line_end + 1;
+    }
+
+    return NULL;
+}
+
+/* cut [p_begin, p_end) into chunk_count pieces that start right after a record,
+   parse them on chunk_count threads, then merge the partial stores in order.
+   only the merge touches p_db, so the result matches a serial load exactly.
+   returns -1 if any chunk couldn't be parsed or merged whole (the load fails
+   rather than come back with the rows of the chunks before it) */
+static int parse_mapping_parallel(char * p_begin, char * p_end, int chunk_count, movie_db_t * p_db)
+{
+    parse_chunk_t * p_chunks = calloc(chunk_count, sizeof(parse_chunk_t));
+    pthread_t * p_threads = calloc(chunk_count, sizeof(pthread_t));
+    int * p_started = calloc(chunk_count, sizeof(int));
+    if (NULL == p_chunks || NULL == p_threads || NULL == p_started)
+    {
+        fprintf(stderr, "couldn't set up the parser threads\n");
+        free(p_chunks);
+        free(p_threads);
+        free(p_started);
+        return -1;
+    }
+
+    // nominal cut every length / N bytes, pushed forward to the next record start.
+    // a newline only ends a record outside quotes, so count the quotes since the
+    // last cut (odd = the nominal cut is inside a quoted field)
+    size_t length = (size_t) (p_end - p_begin);
+    char * p_cut = p_begin;
+    for (int index = 0; index < chunk_count; index++)
+    {
+        p_chunks[index].p_begin = p_cut;
+
+        char * p_next = (index == chunk_count - 1) ? p_end : p_begin + length / chunk_count * (index + 1);
+        if (p_next < p_cut)
+            p_next = p_cut;
+        if (p_next < p_end)
+        {
+            int in_quotes = (int) (csv_count_quotes(p_cut, (size_t) (p_next - p_cut)) & 1);
+            const char * p_newline = csv_record_end(p_next, p_end, &in_quotes);
+            p_next = (p_newline == p_end) ? p_end : (char *) p_newline + 1;
+        }
+
+        p_chunks[index].p_end = p_next;
+        p_cut = p_next;
+    }
+
+    for (int index = 0; index < chunk_count; index++)
+        p_started[index] = (0 == pthread_create(&p_threads[index], NULL, parse_chunk_worker, &p_chunks[index]));
+
+    // a thread that wouldn't start just gets its chunk parsed right here
+    for (int index = 0; index < chunk_count; index++)
+    {
+        if (p_started[index])
+            pthread_join(p_threads[index], NULL);
+        else
+            parse_chunk_worker(&p_chunks[index]);
+    }
+
+    // merge in chunk order: swap each chunk's language ids for the real ones, then store
+    int result = 0;
+    for (int index = 0; index < chunk_count; index++)
+    {
+        parse_chunk_t * p_chunk = &p_chunks[index];
+        lang_id_t remap[NO_LANGUAGE];
+
+        if (p_chunk->failed)
+        {
+            fprintf(stderr, "a parser thread ran out of memory\n");
+            result = -1;
+        }
+
+        for (int id = 0; id < p_chunk->local_langs.lang_count; id++)
+        {
+            const char * p_name = p_chunk->local_langs.p_entries[id].p_name;
+            int global_id = intern_language(&p_db->lang_dict, p_name, strlen(p_name));
+            remap[id] = (global_id < 0) ? NO_LANGUAGE : (lang_id_t) global_id;
+        }
+
+        for (int row = 0; row < p_chunk->row_count && 0 == result; row++)
+        {
+            movie_row_t * p_row = &p_chunk->p_rows[row];
+            int kept = 0;
+            for (int lang = 0; lang < p_row->lang_count; lang++)
+            {
+                // one the real dictionary couldn't take is dropped, like the serial parse does
+                if (NO_LANGUAGE != remap[p_row->lang_ids[lang]])
+                    p_row->lang_ids[kept++] = remap[p_row->lang_ids[lang]];
+            }
+            p_row->lang_count = kept;
+            store_movie_row(p_db, p_row);
+        }
+
+        free(p_chunk->p_rows);
+        free_lang_dict(&p_chunk->local_langs);
+    }
+
+    free(p_chunks);
+    free(p_threads);
+    free(p_started);
+    return result;
+}
+
+/* just past the newline of the last complete record in [p_begin, p_end), p_begin if there
+   isn't one. a newline ends a record when the quotes before it are even, so the quotes get
+   counted once and then it walks back from the end (only over the unfinished line) */
+static char * last_record_end(char * p_begin, char * p_end)
+{
+    int in_quotes = (int) (csv_count_quotes(p_begin, (size_t) (p_end - p_begin)) & 1);
+
+    for (char * p_curr = p_end; p_curr > p_begin; p_curr--)
+    {
+        if ('"' == p_curr[-1])
+            in_quotes = !in_quotes;
+        else if ('\n' == p_curr[-1] && !in_quotes)
+            return p_curr;
+    }
+    return p_begin;
+}
+
+/* zero-copy loader: mmap the whole file and parse it in place (on thread_count
+   threads if asked). the mapping stays alive in p_db (titles point into it)
+   until free_movie_db(). with whole_records_only an unfinished last line is left out */
+static int load_movies_with_mmap(char *p_filename, int thread_count, int whole_records_only, movie_db_t *p_db)
+{
+    int fd = open(p_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "couldn't open that file!\n");
+        return -1;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || 0 == file_stat.st_size)
+    {
+        close(fd);
+        return 0;
+    }
+
+    // private, so every movies process on this file still shares the page cache pages,
+    // but a quoted title with "" in it can be unescaped in place (that page alone gets copied)
+    size_t length = (size_t) file_stat.st_size;
+    void * p_map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive on its own
+    if (MAP_FAILED == p_map)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    p_db->p_map = p_map;
+    p_db->map_length = length;
+    if (LAYOUT_COLUMNAR == p_db->layout)
+    {
+        p_db->columns.p_title_pool = p_map;
+        p_db->columns.borrows_pool = 1;
+    }
+
+    // we read it front to back once, tell the kernel to read ahead hard
+    madvise(p_map, length, MADV_SEQUENTIAL);
+
+    char * p_curr = p_map;
+    char * p_end = whole_records_only ? last_record_end(p_curr, p_curr + length) : p_curr + length;
+    p_db->parsed_bytes = (size_t) (p_end - p_curr);
+
+    // first line is just column headers — skip it
+    const char * p_newline = csv_record_end(p_curr, p_end, NULL);
+    p_curr = (p_newline == p_end) ? p_end : (char *) p_newline + 1;
+
+    if (thread_count > 1)
+    {
+        if (parse_mapping_parallel(p_curr, p_end, thread_count, p_db) != 0)
+            return -1;
+        p_curr = p_end;
+    }
+
+    while (p_curr < p_end)
+    {
+        char * p_line_end = find_record_end(p_curr, p_end);
+
+        movie_row_t row;
+        if (p_line_end > p_curr && 0 == parse_movie_view(p_curr, (size_t) (p_line_end - p_curr), &p_db->lang_dict, &row))
+            store_movie_row(p_db, &row);
+
+        p_curr = p_line_end + 1;
+    }
+
+    // queries jump around the titles, so go back to normal readahead
+    madvise(p_map, length, MADV_NORMAL);
+
+    return p_db->total_count;
+}
+
+/* ---- binary snapshot (<file>.snap) ----
+   header, then each section padded to SNAPSHOT_ALIGN so it can be used
+   straight out of the mapping. all offsets are from the start of the file */
+
+/* one year bucket as saved (no pointers, those mean nothing next run) */
+typedef struct snapshot_bucket
+{
+    int32_t year;
+    int32_t movie_count;
+    int32_t best_ties;
+    int32_t best_row;
+    float best_rating;
+    int32_t top_count;
+    int32_t top_rows[TOP_PER_YEAR];  // the heap, as is
+    float top_ratings[TOP_PER_YEAR];
+} snapshot_bucket_t;
+
+typedef struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t max_languages;     // MAX_LANGUAGES when written, the language columns depend on it
+    uint32_t top_per_year;      // TOP_PER_YEAR when written, the buckets depend on it
+    uint32_t has_rating_index;  // 0 if the index couldn't be built, the loader then sorts again
+    uint64_t csv_size;          // the CSV this came from; any change makes the snapshot stale
+    int64_t csv_mtime_sec;
+    int64_t csv_mtime_nsec;
+    uint64_t row_count;
+    uint64_t lang_count;
+    uint64_t bucket_count;
+    uint64_t pool_size;
+    uint64_t years_offset;          // int32_t[row_count]
+    uint64_t ratings_offset;        // float[row_count]
+    uint64_t title_offsets_offset;  // uint64_t[row_count], into the pool
+    uint64_t title_lengths_offset;  // uint32_t[row_count]
+    uint64_t lang_cols_offset[MAX_LANGUAGES]; // uint16_t[row_count] each
+    uint64_t pool_offset;           // titles back to back, no '\0'
+    uint64_t lang_names_offset;     // lang_count '\0' terminated names, id order
+    uint64_t buckets_offset;        // snapshot_bucket_t[bucket_count]
+    uint64_t rating_rows_offset;    // int32_t[row_count], the rating index
+    uint64_t rating_values_offset;  // float[row_count]
+    uint64_t file_size;
+} snapshot_header_t;
+
+/* <file>.snap, or NULL if the name is too long */
+static char * snapshot_path(const char * p_csv_name)
+{
+    size_t length = strlen(p_csv_name) + sizeof(".snap");
+    char * p_path = malloc(length);
+    if (NULL != p_path)
+        snprintf(p_path, length, "%s.snap", p_csv_name);
+    return p_path;
+}
+
+/* pad with zeros up to the next section boundary, return where the section starts */
+static uint64_t start_snapshot_section(FILE * p_out)
+{
+    static const char zeros[SNAPSHOT_ALIGN] = {0};
+    long position = ftell(p_out);
+    long padding = (SNAPSHOT_ALIGN - position % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN;
+
+    fwrite(zeros, 1, (size_t) padding, p_out);
+    return (uint64_t) (position + padding);
+}
+
+/* save the columnar store + indexes. written to <file>.snap.tmp then renamed
+   so a reader never sees half a snapshot. returns -1 on failure */
+int write_snapshot(const char * p_csv_name, const struct stat * p_csv_stat, const movie_db_t * p_db)
+{
+    const movie_columns_t * p_cols = &p_db->columns;
+    char * p_path = snapshot_path(p_csv_name);
+    char * p_tmp_path = (NULL == p_path) ? NULL : malloc(strlen(p_path) + sizeof(".tmp"));
+    if (NULL == p_tmp_path)
+    {
+        free(p_path);
+        return -1;
+    }
+    sprintf(p_tmp_path, "%s.tmp", p_path);
+
+    FILE * p_out = fopen(p_tmp_path, "wb");
+    if (NULL == p_out)
+    {
+        perror("couldn't write the snapshot");
+        free(p_path);
+        free(p_tmp_path);
+        return -1;
+    }
+
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.max_languages = MAX_LANGUAGES;
+    header.top_per_year = TOP_PER_YEAR;
+    header.csv_size = (uint64_t) p_csv_stat->st_size;
+    header.csv_mtime_sec = (int64_t) p_csv_stat->st_mtim.tv_sec;
+    header.csv_mtime_nsec = (int64_t) p_csv_stat->st_mtim.tv_nsec;
+    header.row_count = (uint64_t) p_cols->row_count;
+    header.lang_count = (uint64_t) p_db->lang_dict.lang_count;
+    header.bucket_count = (uint64_t) p_db->year_index.bucket_count;
+
+    // header goes in last, once we know where everything landed
+    fwrite(&header, sizeof(header), 1, p_out);
+
+    header.years_offset = start_snapshot_section(p_out);
+    fwrite(p_cols->p_years, sizeof(int32_t), p_cols->row_count, p_out);
+
+    header.ratings_offset = start_snapshot_section(p_out);
+    fwrite(p_cols->p_ratings, sizeof(float), p_cols->row_count, p_out);
+
+    // the pool gets compacted on the way out (with --mmap it's the whole CSV),
+    // so the title offsets are recomputed rather than copied
+    header.title_offsets_offset = start_snapshot_section(p_out);
+    uint64_t pool_size = 0;
+    for (int row = 0; row < p_cols->row_count; row++)
+    {
+        fwrite(&pool_size, sizeof(pool_size), 1, p_out);
+        pool_size += p_cols->p_title_lengths[row];
+    }
+    header.pool_size = pool_size;
+
+    header.title_lengths_offset = start_snapshot_section(p_out);
+    fwrite(p_cols->p_title_lengths, sizeof(uint32_t), p_cols->row_count, p_out);
+
+    for (int col = 0; col < MAX_LANGUAGES; col++)
+    {
+        header.lang_cols_offset[col] = start_snapshot_section(p_out);
+        fwrite(p_cols->p_lang_cols[col], sizeof(uint16_t), p_cols->row_count, p_out);
+    }
+
+    header.pool_offset = start_snapshot_section(p_out);
+    for (int row = 0; row < p_cols->row_count; row++)
+        fwrite(column_title(p_cols, row), 1, p_cols->p_title_lengths[row], p_out);
+
+    header.lang_names_offset = start_snapshot_section(p_out);
+    for (int id = 0; id < p_db->lang_dict.lang_count; id++)
+        fwrite(p_db->lang_dict.p_entries[id].p_name, 1, strlen(p_db->lang_dict.p_entries[id].p_name) + 1, p_out);
+
+    header.buckets_offset = start_snapshot_section(p_out);
+    for (int slot = 0; slot < p_db->year_index.bucket_count; slot++)
+    {
+        const year_bucket_t * p_bucket = &p_db->year_index.p_buckets[slot];
+        snapshot_bucket_t saved;
+        memset(&saved, 0, sizeof(saved));
+        saved.year = p_bucket->year;
+        saved.movie_count = p_bucket->movie_count;
+        saved.best_ties = p_bucket->best_ties;
+        saved.best_row = p_bucket->best_row;
+        saved.best_rating = p_bucket->best_rating;
+        saved.top_count = p_bucket->top_count;
+        memcpy(saved.top_rows, p_bucket->top_rows, sizeof(saved.top_rows));
+        memcpy(saved.top_ratings, p_bucket->top_ratings, sizeof(saved.top_ratings));
+        fwrite(&saved, sizeof(saved), 1, p_out);
+    }
+
+    // an empty rating index (it ran out of memory) is saved as all zero rows; the
+    // loader spots the short count and rebuilds it
+    header.rating_rows_offset = start_snapshot_section(p_out);
+    fwrite(p_db->rating_index.p_rows, sizeof(int32_t), p_db->rating_index.count, p_out);
+    header.rating_values_offset = start_snapshot_section(p_out);
+    fwrite(p_db->rating_index.p_ratings, sizeof(float), p_db->rating_index.count, p_out);
+    header.has_rating_index = (uint32_t) (p_db->rating_index.count == p_cols->row_count);
+
+    header.file_size = (uint64_t) ftell(p_out);
+    fseek(p_out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, p_out);
+
+    int result = 0;
+    if (ferror(p_out) | fclose(p_out))
+    {
+        fprintf(stderr, "couldn't write the snapshot %s\n", p_tmp_path);
+        unlink(p_tmp_path);
+        result = -1;
+    }
+    else if (rename(p_tmp_path, p_path) != 0)
+    {
+        perror("couldn't publish the snapshot");
+        unlink(p_tmp_path);
+        result = -1;
+    }
+
+    free(p_path);
+    free(p_tmp_path);
+    return result;
+}
+
+/* true if [offset, offset + size) sits inside the snapshot */
+static int snapshot_section_fits(const snapshot_header_t * p_header, uint64_t offset, uint64_t size)
+{
+    return offset <= p_header->file_size && size <= p_header->file_size - offset;
+}
+
+/* true if a saved year bucket only names rows the snapshot has */
+static int snapshot_bucket_valid(const snapshot_bucket_t * p_saved, uint64_t rows)
+{
+    if (p_saved->movie_count < 0 || (uint64_t) p_saved->movie_count > rows
+        || p_saved->best_row < 0 || (uint64_t) p_saved->best_row >= rows
+        || p_saved->top_count < 0 || p_saved->top_count > TOP_PER_YEAR)
+        return 0;
+
+    for (int index = 0; index < p_saved->top_count; index++)
+    {
+        if (p_saved->top_rows[index] < 0 || (uint64_t) p_saved->top_rows[index] >= rows)
+            return 0;
+    }
+    return 1;
+}
+
+/* true if every title lands in the pool, every language id is one the snapshot
+   names and every rating index entry is a real row. the section checks only say
+   the arrays fit in the file, this is what keeps a damaged one out of the queries */
+static int snapshot_rows_valid(const movie_db_t * p_db, const snapshot_header_t * p_header)
+{
+    const movie_columns_t * p_cols = &p_db->columns;
+    int rows = p_cols->row_count;
+
+    for (int row = 0; row < rows; row++)
+    {
+        uint64_t offset = p_cols->p_title_offsets[row];
+        if (offset > p_header->pool_size || p_cols->p_title_lengths[row] > p_header->pool_size - offset)
+            return 0;
+
+        for (int col = 0; col < MAX_LANGUAGES; col++)
+        {
+            lang_id_t id = p_cols->p_lang_cols[col][row];
+            if (NO_LANGUAGE != id && id >= p_header->lang_count)
+                return 0;
+        }
+    }
+
+    if (p_header->has_rating_index)
+    {
+        for (int index = 0; index < rows; index++)
+        {
+            if (p_db->rating_index.p_rows[index] < 0 || p_db->rating_index.p_rows[index] >= rows)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* mmap <file>.snap and point the columnar store straight into it.
+   returns the row count, or -1 if there's no usable snapshot (missing,
+   other version, the CSV changed since it was written, or damaged) */
+int load_snapshot(const char * p_csv_name, const struct stat * p_csv_stat, movie_db_t * p_db)
+{
+    char * p_path = snapshot_path(p_csv_name);
+    int fd = (NULL == p_path) ? -1 : open(p_path, O_RDONLY);
+    free(p_path);
+    if (fd < 0)
+        return -1;
+
+    struct stat snap_stat;
+    void * p_map = MAP_FAILED;
+    if (0 == fstat(fd, &snap_stat) && (size_t) snap_stat.st_size >= sizeof(snapshot_header_t))
+        p_map = mmap(NULL, (size_t) snap_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p_map)
+        return -1;
+
+    const char * p_base = p_map;
+    const snapshot_header_t * p_header = p_map;
+    uint64_t rows = p_header->row_count;
+
+    // anything off and we just fall back to parsing the CSV again
+    int usable = memcmp(p_header->magic, SNAPSHOT_MAGIC, sizeof(p_header->magic)) == 0
+              && SNAPSHOT_VERSION == p_header->version
+              && MAX_LANGUAGES == p_header->max_languages
+              && TOP_PER_YEAR == p_header->top_per_year
+              && p_header->file_size == (uint64_t) snap_stat.st_size
+              && p_header->csv_size == (uint64_t) p_csv_stat->st_size
+              && p_header->csv_mtime_sec == (int64_t) p_csv_stat->st_mtim.tv_sec
+              && p_header->csv_mtime_nsec == (int64_t) p_csv_stat->st_mtim.tv_nsec
+              && rows <= (uint64_t) INT32_MAX && p_header->lang_count < NO_LANGUAGE
+              && snapshot_section_fits(p_header, p_header->years_offset, rows * sizeof(int32_t))
+              && snapshot_section_fits(p_header, p_header->ratings_offset, rows * sizeof(float))
+              && snapshot_section_fits(p_header, p_header->title_offsets_offset, rows * sizeof(uint64_t))
+              && snapshot_section_fits(p_header, p_header->title_lengths_offset, rows * sizeof(uint32_t))
+              && snapshot_section_fits(p_header, p_header->pool_offset, p_header->pool_size)
+              && snapshot_section_fits(p_header, p_header->buckets_offset, p_header->bucket_count * sizeof(snapshot_bucket_t))
+              && p_header->lang_names_offset <= p_header->buckets_offset
+              && (0 == p_header->has_rating_index
+                  || (snapshot_section_fits(p_header, p_header->rating_rows_offset, rows * sizeof(int32_t))
+                      && snapshot_section_fits(p_header, p_header->rating_values_offset, rows * sizeof(float))));
+    for (int col = 0; usable && col < MAX_LANGUAGES; col++)
+        usable = snapshot_section_fits(p_header, p_header->lang_cols_offset[col], rows * sizeof(uint16_t));
+
+    if (!usable)
+    {
+        munmap(p_map, (size_t) snap_stat.st_size);
+        return -1;
+    }
+    stats_count(COUNT_BYTES_READ, (uint64_t) snap_stat.st_size);
+
+    p_db->layout = LAYOUT_COLUMNAR;
+    p_db->p_map = p_map;
+    p_db->map_length = (size_t) snap_stat.st_size;
+
+    // the columns are used in place, nothing gets copied
+    movie_columns_t * p_cols = &p_db->columns;
+    p_cols->is_mapped = 1;
+    p_cols->borrows_pool = 1;
+    p_cols->row_count = (int) rows;
+    p_cols->row_capacity = (int) rows;
+    p_cols->p_years = (int *) (p_base + p_header->years_offset);
+    p_cols->p_ratings = (float *) (p_base + p_header->ratings_offset);
+    p_cols->p_title_offsets = (size_t *) (p_base + p_header->title_offsets_offset);
+    p_cols->p_title_lengths = (unsigned int *) (p_base + p_header->title_lengths_offset);
+    for (int col = 0; col < MAX_LANGUAGES; col++)
+        p_cols->p_lang_cols[col] = (lang_id_t *) (p_base + p_header->lang_cols_offset[col]);
+    p_cols->p_title_pool = p_base + p_header->pool_offset;
+    p_cols->pool_used = p_header->pool_size;
+
+    // the language names and year buckets are tiny, rebuilding them is a few hundred inserts
+    const char * p_name = p_base + p_header->lang_names_offset;
+    const char * p_names_end = p_base + p_header->buckets_offset;
+    for (uint64_t id = 0; id < p_header->lang_count; id++)
+    {
+        size_t length = strnlen(p_name, (size_t) (p_names_end - p_name));
+        if (p_name + length >= p_names_end || intern_language(&p_db->lang_dict, p_name, length) != (int) id)
+        {
+            fprintf(stderr, "snapshot language table is damaged, ignoring it\n");
+            free_movie_db(p_db);
+            return -1;
+        }
+        p_name += length + 1;
+    }
+
+    const snapshot_bucket_t * p_saved = (const snapshot_bucket_t *) (p_base + p_header->buckets_offset);
+    for (uint64_t slot = 0; slot < p_header->bucket_count; slot++)
+    {
+        if (!snapshot_bucket_valid(&p_saved[slot], rows))
+        {
+            fprintf(stderr, "snapshot year index is damaged, ignoring it\n");
+            free_movie_db(p_db);
+            return -1;
+        }
+
+        year_bucket_t * p_bucket = get_year_bucket(&p_db->year_index, p_saved[slot].year);
+        if (NULL == p_bucket)
+        {
+            free_movie_db(p_db);
+            return -1;
+        }
+        p_bucket->movie_count = p_saved[slot].movie_count;
+        p_bucket->best_ties = p_saved[slot].best_ties;
+        p_bucket->best_row = p_saved[slot].best_row;
+        p_bucket->best_rating = p_saved[slot].best_rating;
+        p_bucket->top_count = p_saved[slot].top_count;
+        memcpy(p_bucket->top_rows, p_saved[slot].top_rows, sizeof(p_bucket->top_rows));
+        memcpy(p_bucket->top_ratings, p_saved[slot].top_ratings, sizeof(p_bucket->top_ratings));
+    }
+
+    // rating index straight out of the mapping too
+    if (p_header->has_rating_index)
+    {
+        p_db->rating_index.p_rows = (int *) (p_base + p_header->rating_rows_offset);
+        p_db->rating_index.p_ratings = (float *) (p_base + p_header->rating_values_offset);
+        p_db->rating_index.count = (int) rows;
+        p_db->rating_index.is_mapped = 1;
+    }
+
+    if (!snapshot_rows_valid(p_db, p_header))
+    {
+        fprintf(stderr, "snapshot rows are damaged, ignoring it\n");
+        free_movie_db(p_db);
+        return -1;
+    }
+
+    p_db->total_count = (int) rows;
+    return p_db->total_count;
+}
+
+/* load_movies_from_csv() minus the timing */
+static int load_movies(char *p_filename, const load_options_t *p_options, movie_db_t *p_db)
+{
+    // start from an empty db (no list, no buckets, zero movies counted)
+    memset(p_db, 0, sizeof(*p_db));
+    p_db->layout = p_options->layout;
+
+    // too big to hold (or asked not to): load nothing, every query streams the file
+    struct stat csv_stat;
+    if (p_options->use_stream || p_options->stream_over > 0)
+    {
+        if (stat(p_filename, &csv_stat) != 0)
+        {
+            fprintf(stderr, "couldn't open that file!\n");
+            return -1;
+        }
+
+        if (p_options->use_stream || (long long) csv_stat.st_size > p_options->stream_over)
+        {
+            p_db->p_stream_path = p_filename;
+            return 0;
+        }
+    }
+
+    // a snapshot that still matches the CSV means no parsing at all
+    if (p_options->use_snapshot)
+    {
+        if (stat(p_filename, &csv_stat) != 0)
+        {
+            fprintf(stderr, "couldn't open that file!\n");
+            return -1;
+        }
+
+        stats_timer_t snapshot_timer;
+        stats_begin(&snapshot_timer, PHASE_SNAPSHOT_LOAD);
+        int snapshot_rows = load_snapshot(p_filename, &csv_stat, p_db);
+        stats_end(&snapshot_timer);
+
+        if (snapshot_rows >= 0)
+        {
+            if (0 == p_db->rating_index.count)
+                build_rating_index(p_db);
+            return p_db->total_count;
+        }
+
+        // snapshots are columnar, so build the columns this time round
+        memset(p_db, 0, sizeof(*p_db));
+        p_db->layout = LAYOUT_COLUMNAR;
+    }
+
+    int result;
+
+    // splitting into chunks needs random access, so threads always go through the mapping
+    if (p_options->use_mmap || p_options->thread_count > 1)
+        result = load_movies_with_mmap(p_filename, p_options->thread_count, p_options->whole_records_only, p_db);
+    else
+        result = load_movies_with_getline(p_filename, p_options->whole_records_only, p_db);
+
+    // compact records copied their titles out, the mapping has done its job
+    if (LAYOUT_COMPACT == p_db->layout && NULL != p_db->p_map)
+    {
+        munmap((void *) p_db->p_map, p_db->map_length);
+        p_db->p_map = NULL;
+    }
+
+    // one sort up front so the top-N and rating-range queries never scan
+    if (result > 0)
+        build_rating_index(p_db);
+
+    // next run gets to skip all of that
+    if (p_options->use_snapshot && result > 0)
+    {
+        stats_timer_t snapshot_timer;
+        stats_begin(&snapshot_timer, PHASE_SNAPSHOT_WRITE);
+        write_snapshot(p_filename, &csv_stat, p_db);
+        stats_end(&snapshot_timer);
+    }
+
+    return result;
+}
+
+/* fills in p_db with the list (or the columns, depending on layout) plus the
+   per-year index and language postings. returns -1 if the file won't open */
+int load_movies_from_csv(char *p_filename, const load_options_t *p_options, movie_db_t *p_db)
+{
+    stats_timer_t timer;
+    stats_begin(&timer, PHASE_LOAD);
+    int result = load_movies(p_filename, p_options, p_db);
+    if (result > 0)
+        stats_count(COUNT_STORAGE_BYTES, (uint64_t) movie_db_footprint(p_db));
+    stats_end(&timer);
+
+    // streaming keeps memory flat, so it doesn't hold on to results either
+    if (result > 0 && NULL == p_db->p_stream_path)
+        p_db->p_cache = query_cache_create(p_options->cache_bytes);
+    return result;
+}
+ 
+/* one query result, whatever layout it came out of */
+typedef struct movie_hit
+{
+    int year;
+    float rating;
+    const char *p_title;    // not '\0' terminated, use title_length
+    size_t title_length;
+} movie_hit_t;
+
+/* what the query walkers call once per result, in output order */
+typedef void (*hit_visitor_t)(void *p_context, const movie_hit_t *p_hit);
+
+/* fill in a hit from a list node */
+static void hit_from_node(const movie_t *p_movie, movie_hit_t *p_hit)
+{
+    p_hit->year = p_movie->release_year;
+    p_hit->rating = p_movie->rating;
+    p_hit->p_title = p_movie->p_title;
+    p_hit->title_length = p_movie->title_length;
+}
+
+/* fill in a hit from a row of the columns */
+static void hit_from_row(const movie_columns_t *p_cols, int row, movie_hit_t *p_hit)
+{
+    p_hit->year = p_cols->p_years[row];
+    p_hit->rating = p_cols->p_ratings[row];
+    p_hit->p_title = column_title(p_cols, row);
+    p_hit->title_length = p_cols->p_title_lengths[row];
+}
+
+/* fill in a hit from a compact record */
+static void hit_from_compact(const compact_store_t *p_store, int row, movie_hit_t *p_hit)
+{
+    const compact_movie_t *p_record = &p_store->p_records[row];
+
+    p_hit->year = p_record->year;
+    p_hit->rating = compact_rating(p_record);
+    p_hit->p_title = compact_title(p_store, row, &p_hit->title_length);
+}
+
+/* fill in a hit from a row number, whatever the layout */
+static void hit_from_db_row(const movie_db_t *p_db, int row, movie_hit_t *p_hit)
+{
+    if (LAYOUT_COMPACT == p_db->layout)
+        hit_from_compact(&p_db->compact, row, p_hit);
+    else if (LAYOUT_COLUMNAR == p_db->layout)
+        hit_from_row(&p_db->columns, row, p_hit);
+    else
+        hit_from_node(p_db->pp_rows[row], p_hit);
+}
+
+/* ---- streaming mode ----
+   for files that don't fit in memory: nothing is loaded, every query is one
+   pass over the file holding one line at a time. the only things that grow
+   are the line buffer (longest line), the language dictionary (distinct
+   languages) and, for best-per-year, one entry per distinct year */
+
+/* called once per good row while streaming. the row's title points into the
+   line buffer, so it's only good until the callback returns */
+typedef void (*stream_row_fn)(void *p_context, const movie_row_t *p_row, const lang_dict_t *p_dict);
+
+/* reads p_filename front to back and hands every row to p_on_row.
+   same line splitting as the mmap loader, so results match the loaded modes.
+   returns how many rows there were, -1 if the file couldn't be read */
+static int stream_movie_rows(const char *p_filename, stream_row_fn p_on_row, void *p_context)
+{
+    FILE *p_file = fopen(p_filename, "r");
+    if (NULL == p_file)
+    {
+        fprintf(stderr, "couldn't open that file!\n");
+        return -1;
+    }
+
+    // big reads and a hint that we only go forward, the default 4K stdio buffer is a lot of syscalls
+    setvbuf(p_file, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+    posix_fadvise(fileno(p_file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    lang_dict_t dict;
+    memset(&dict, 0, sizeof(dict));
+
+    char *p_line = NULL;
+    size_t line_capacity = 0;
+    ssize_t read;
+    int is_first_line = 1;
+    int row_count = 0;
+
+    while ((read = read_record(&p_line, &line_capacity, p_file)) != -1)
+    {
+        // first line is just column headers — skip it
+        if (is_first_line)
+        {
+            is_first_line = 0;
+            continue;
+        }
+
+        size_t length = (size_t) read;
+        if (length > 0 && '\n' == p_line[length - 1])
+            length--;
+
+        movie_row_t row;
+        if (length > 0 && 0 == parse_movie_view(p_line, length, &dict, &row))
+        {
+            p_on_row(p_context, &row, &dict);
+            row_count++;
+        }
+    }
+
+    stats_count(COUNT_NODES_VISITED, (uint64_t) row_count);
+    int failed = ferror(p_file);
+    free(p_line);
+    fclose(p_file);
+    free_lang_dict(&dict);
+
+    if (failed)
+    {
+        fprintf(stderr, "error reading %s\n", p_filename);
+        return -1;
+    }
+    return row_count;
+}
+
+/* what the streaming year/language filters carry between rows */
+typedef struct stream_filter
+{
+    int target_year;
+    const char *p_target_language;
+    int target_id;          // the language's id once it has shown up, else -1
+    hit_visitor_t p_visit;
+    void *p_context;
+    int matched;
+} stream_filter_t;
+
+static void hit_from_stream_row(const movie_row_t *p_row, movie_hit_t *p_hit)
+{
+    p_hit->year = p_row->release_year;
+    p_hit->rating = p_row->rating;
+    p_hit->p_title = p_row->p_title;
+    p_hit->title_length = p_row->title_length;
+}
+
+static void stream_year_row(void *p_context, const movie_row_t *p_row, const lang_dict_t *p_dict)
+{
+    stream_filter_t *p_filter = p_context;
+    movie_hit_t hit;
+    (void) p_dict;
+
+    if (p_row->release_year != p_filter->target_year)
+        return;
+
+    hit_from_stream_row(p_row, &hit);
+    p_filter->p_visit(p_filter->p_context, &hit);
+    p_filter->matched++;
+}
+
+static void stream_language_row(void *p_context, const movie_row_t *p_row, const lang_dict_t *p_dict)
+{
+    stream_filter_t *p_filter = p_context;
+    movie_hit_t hit;
+
+    // ids are handed out as languages show up, so look it up until it exists
+    if (p_filter->target_id < 0)
+    {
+        p_filter->target_id = lookup_language(p_dict, p_filter->p_target_language);
+        if (p_filter->target_id < 0)
+            return;
+    }
+
+    // once per movie, even for [English;English]
+    for (int index = 0; index < p_row->lang_count; index++)
+    {
+        if (p_row->lang_ids[index] == p_filter->target_id)
+        {
+            hit_from_stream_row(p_row, &hit);
+            p_filter->p_visit(p_filter->p_context, &hit);
+            p_filter->matched++;
+            return;
+        }
+    }
+}
+
+/* best-per-year accumulator: one entry per year, sorted by year, holding
+   its own copy of the best title since the line buffer gets reused */
+typedef struct stream_best
+{
+    int year;
+    float rating;
+    char *p_title;
+    size_t title_length;
+    size_t title_capacity;
+} stream_best_t;
+
+typedef struct stream_best_years
+{
+    stream_best_t *p_years;
+    int year_count;
+    int year_capacity;
+    int failed;
+} stream_best_years_t;
+
+static int keep_stream_title(stream_best_t *p_best, const movie_row_t *p_row)
+{
+    if (p_row->title_length + 1 > p_best->title_capacity)
+    {
+        char *p_grown = realloc(p_best->p_title, p_row->title_length + 1);
+        if (NULL == p_grown)
+            return -1;
+        p_best->p_title = p_grown;
+        p_best->title_capacity = p_row->title_length + 1;
+    }
+    memcpy(p_best->p_title, p_row->p_title, p_row->title_length);
+    p_best->title_length = p_row->title_length;
+    p_best->rating = p_row->rating;
+    return 0;
+}
+
+static void stream_best_row(void *p_context, const movie_row_t *p_row, const lang_dict_t *p_dict)
+{
+    stream_best_years_t *p_acc = p_context;
+    (void) p_dict;
+
+    // binary search for the year, same idea as find_year_slot
+    int low = 0;
+    int high = p_acc->year_count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (p_acc->p_years[middle].year < p_row->release_year)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low < p_acc->year_count && p_acc->p_years[low].year == p_row->release_year)
+    {
+        // strictly better takes over, first one wins a tie like the loaded modes
+        if (p_row->rating > p_acc->p_years[low].rating && keep_stream_title(&p_acc->p_years[low], p_row) != 0)
+            p_acc->failed = 1;
+        return;
+    }
+
+    // new year: make room and slide the later years up one
+    if (p_acc->year_count == p_acc->year_capacity)
+    {
+        int new_capacity = (0 == p_acc->year_capacity) ? 64 : p_acc->year_capacity * 2;
+        stream_best_t *p_grown = realloc(p_acc->p_years, new_capacity * sizeof(stream_best_t));
+        if (NULL == p_grown)
+        {
+            p_acc->failed = 1;
+            return;
+        }
+        p_acc->p_years = p_grown;
+        p_acc->year_capacity = new_capacity;
+    }
+
+    memmove(&p_acc->p_years[low + 1], &p_acc->p_years[low], (p_acc->year_count - low) * sizeof(stream_best_t));
+    memset(&p_acc->p_years[low], 0, sizeof(stream_best_t));
+    p_acc->p_years[low].year = p_row->release_year;
+    p_acc->year_count++;
+
+    if (keep_stream_title(&p_acc->p_years[low], p_row) != 0)
+        p_acc->failed = 1;
+}
+
+/* streaming versions of the three walkers below, same output and same return values */
+static int stream_movies_in_year(const char *p_filename, int target_year, hit_visitor_t p_visit, void *p_context)
+{
+    stream_filter_t filter = { target_year, NULL, -1, p_visit, p_context, 0 };
+
+    if (stream_movie_rows(p_filename, stream_year_row, &filter) < 0)
+        return -1;
+    return filter.matched;
+}
+
+static int stream_movies_in_language(const char *p_filename, const char *p_target_language, hit_visitor_t p_visit, void *p_context)
+{
+    stream_filter_t filter = { 0, p_target_language, -1, p_visit, p_context, 0 };
+
+    if (stream_movie_rows(p_filename, stream_language_row, &filter) < 0)
+        return -1;
+    return filter.matched;
+}
+
+static int stream_best_per_year(const char *p_filename, hit_visitor_t p_visit, void *p_context)
+{
+    stream_best_years_t acc = { NULL, 0, 0, 0 };
+    int result = stream_movie_rows(p_filename, stream_best_row, &acc);
+
+    if (acc.failed)
+    {
+        fprintf(stderr, "ran out of memory tracking the best movie per year\n");
+        result = -1;
+    }
+
+    if (result >= 0)
+    {
+        for (int index = 0; index < acc.year_count; index++)
+        {
+            movie_hit_t hit = { acc.p_years[index].year, acc.p_years[index].rating,
+                                acc.p_years[index].p_title, acc.p_years[index].title_length };
+            p_visit(p_context, &hit);
+        }
+        result = acc.year_count;
+    }
+
+    for (int index = 0; index < acc.year_count; index++)
+        free(acc.p_years[index].p_title);
+    free(acc.p_years);
+    return result;
+}
+
+/* hands every movie from target_year to p_visit, in file order. returns how many.
+   the year index already grouped them, so it's one lookup + a walk down that year's chain.
+   in the columnar layout it's a SIMD scan of the year column instead */
+int for_each_movie_in_year(const movie_db_t *p_db, int target_year, hit_visitor_t p_visit, void *p_context)
+{
+    if (NULL != p_db->p_stream_path)
+        return stream_movies_in_year(p_db->p_stream_path, target_year, p_visit, p_context);
+
+    year_bucket_t *p_bucket = find_year_bucket(&p_db->year_index, target_year);
+    movie_hit_t hit;
+
+    // no bucket means no movie from that year, no need to look any further
+    if (NULL == p_bucket)
+        return 0;
+
+    if (LAYOUT_COLUMNAR == p_db->layout)
+    {
+        const movie_columns_t *p_cols = &p_db->columns;
+        int matches[SCAN_BLOCK_ROWS];
+
+        // scan a block, report what it found, next block -- keeps output in file order
+        for (int begin = 0; begin < p_cols->row_count; begin += SCAN_BLOCK_ROWS)
+        {
+            int end = (begin + SCAN_BLOCK_ROWS < p_cols->row_count) ? begin + SCAN_BLOCK_ROWS : p_cols->row_count;
+            int found = scan_years(p_cols->p_years, begin, end, target_year, matches);
+            stats_count(COUNT_NODES_VISITED, (uint64_t) (end - begin));
+
+            for (int index = 0; index < found; index++)
+            {
+                hit_from_row(p_cols, matches[index], &hit);
+                p_visit(p_context, &hit);
+            }
+        }
+        return p_bucket->movie_count;
+    }
+
+    // compact layout: one pass over the records, 20 bytes a row
+    if (LAYOUT_COMPACT == p_db->layout)
+    {
+        const compact_store_t *p_store = &p_db->compact;
+
+        stats_count(COUNT_NODES_VISITED, (uint64_t) p_store->row_count);
+        for (int row = 0; row < p_store->row_count; row++)
+        {
+            if (p_store->p_records[row].year == target_year)
+            {
+                hit_from_compact(p_store, row, &hit);
+                p_visit(p_context, &hit);
+            }
+        }
+        return p_bucket->movie_count;
+    }
+
+    // chain is in file order, same order the old full-list scan printed them in.
+    // walk exactly movie_count nodes: with --watch a newer version may already
+    // be linking rows onto the end of this chain
+    movie_t *p_curr = p_bucket->p_first;
+    stats_count(COUNT_NODES_VISITED, (uint64_t) p_bucket->movie_count);
+    for (int index = 0; index < p_bucket->movie_count; index++)
+    {
+        hit_from_node(p_curr, &hit);
+        p_visit(p_context, &hit);
+        if (index + 1 < p_bucket->movie_count)
+            p_curr = p_curr->p_next_in_year;
+    }
+    return p_bucket->movie_count;
+}
+
+/* hands the highest-rated movie of every year (oldest year first) to p_visit.
+   the loader already tracked the best one per bucket, so this is one pass over
+   the years that exist instead of rescanning the list per year */
+int for_each_best_per_year(const movie_db_t *p_db, hit_visitor_t p_visit, void *p_context)
+{
+    const year_index_t *p_index = &p_db->year_index;
+    movie_hit_t hit;
+
+    if (NULL != p_db->p_stream_path)
+        return stream_best_per_year(p_db->p_stream_path, p_visit, p_context);
+
+    stats_count(COUNT_NODES_VISITED, (uint64_t) p_index->bucket_count);
+    for (int slot = 0; slot < p_index->bucket_count; slot++)
+    {
+        const year_bucket_t *p_bucket = &p_index->p_buckets[slot];
+
+        if (LAYOUT_LIST == p_db->layout)
+            hit_from_node(p_bucket->p_best, &hit);
+        else
+            hit_from_db_row(p_db, p_bucket->best_row, &hit);
+
+        p_visit(p_context, &hit);
+    }
+
+    return p_index->bucket_count;
+}
+
+/* hands every movie that lists p_target_language to p_visit, in file order.
+   one hash lookup for the language, then a walk down its posting list
+   (or a SIMD scan over the language columns in the columnar layout) */
+int for_each_movie_in_language(const movie_db_t *p_db, const char *p_target_language, hit_visitor_t p_visit, void *p_context)
+{
+    if (NULL != p_db->p_stream_path)
+        return stream_movies_in_language(p_db->p_stream_path, p_target_language, p_visit, p_context);
+
+    // case-sensitive, same as the old strcmp
+    int id = lookup_language(&p_db->lang_dict, p_target_language);
+    int count = 0;
+    movie_hit_t hit;
+
+    // no movie ever listed it
+    if (id < 0)
+        return 0;
+
+    if (LAYOUT_COLUMNAR == p_db->layout)
+    {
+        const movie_columns_t *p_cols = &p_db->columns;
+        int matches[SCAN_BLOCK_ROWS];
+
+        for (int begin = 0; begin < p_cols->row_count; begin += SCAN_BLOCK_ROWS)
+        {
+            int end = (begin + SCAN_BLOCK_ROWS < p_cols->row_count) ? begin + SCAN_BLOCK_ROWS : p_cols->row_count;
+            int found = scan_langs(p_cols->p_lang_cols, begin, end, (lang_id_t) id, matches);
+            stats_count(COUNT_NODES_VISITED, (uint64_t) (end - begin));
+
+            for (int index = 0; index < found; index++)
+            {
+                hit_from_row(p_cols, matches[index], &hit);
+                p_visit(p_context, &hit);
+            }
+            count += found;
+        }
+        return count;
+    }
+
+    if (LAYOUT_COMPACT == p_db->layout)
+    {
+        const compact_store_t *p_store = &p_db->compact;
+
+        stats_count(COUNT_NODES_VISITED, (uint64_t) p_store->row_count);
+        for (int row = 0; row < p_store->row_count; row++)
+        {
+            const compact_movie_t *p_record = &p_store->p_records[row];
+
+            // once per movie even if it lists the language twice, same as the postings
+            for (int lang = 0; lang < p_record->lang_count; lang++)
+            {
+                if (p_record->lang_ids[lang] == (lang_id_t) id)
+                {
+                    hit_from_compact(p_store, row, &hit);
+                    p_visit(p_context, &hit);
+                    count++;
+                    break;
+                }
+            }
+        }
+        return count;
+    }
+
+    // postings were appended while loading, so they're already in file order
+    const lang_entry_t *p_entry = &p_db->lang_dict.p_entries[id];
+    stats_count(COUNT_NODES_VISITED, (uint64_t) p_entry->posting_count);
+    for (int index = 0; index < p_entry->posting_count; index++)
+    {
+        hit_from_node(p_entry->pp_postings[index], &hit);
+        p_visit(p_context, &hit);
+    }
+    return p_entry->posting_count;
+}
+
+/* hands the top_count best-rated movies (best first, ties in file order) to p_visit.
+   the rating index is already sorted, so this is just its first top_count rows.
+   this and the two below need the loaded indexes, so they return -1 when streaming */
+int for_each_top_rated(const movie_db_t *p_db, int top_count, hit_visitor_t p_visit, void *p_context)
+{
+    const rating_index_t *p_index = &p_db->rating_index;
+    movie_hit_t hit;
+
+    if (NULL != p_db->p_stream_path)
+        return -1;
+
+    if (top_count > p_index->count)
+        top_count = p_index->count;
+    stats_count(COUNT_NODES_VISITED, (uint64_t) top_count);
+
+    for (int index = 0; index < top_count; index++)
+    {
+        hit_from_db_row(p_db, p_index->p_rows[index], &hit);
+        p_visit(p_context, &hit);
+    }
+    return top_count;
+}
+
+/* hands the top_count best movies of every year (oldest year first, best first
+   within a year) to p_visit. each bucket kept a heap of its TOP_PER_YEAR best
+   while loading, so this only sorts those few. returns -1 if top_count is
+   more than the heaps hold */
+int for_each_top_per_year(const movie_db_t *p_db, int top_count, hit_visitor_t p_visit, void *p_context)
+{
+    const year_index_t *p_index = &p_db->year_index;
+    movie_hit_t hit;
+    int count = 0;
+
+    if (top_count > TOP_PER_YEAR || NULL != p_db->p_stream_path)
+        return -1;
+
+    for (int slot = 0; slot < p_index->bucket_count; slot++)
+    {
+        const year_bucket_t *p_bucket = &p_index->p_buckets[slot];
+        int rows[TOP_PER_YEAR];
+        float ratings[TOP_PER_YEAR];
+        int kept = p_bucket->top_count;
+        stats_count(COUNT_NODES_VISITED, (uint64_t) kept + 1);
+
+        // heap order isn't output order; insertion sort is plenty for 32 entries
+        for (int index = 0; index < kept; index++)
+        {
+            int row = p_bucket->top_rows[index];
+            float rating = p_bucket->top_ratings[index];
+            int place = index;
+
+            while (place > 0 && ranks_below(ratings[place - 1], rows[place - 1], rating, row))
+            {
+                rows[place] = rows[place - 1];
+                ratings[place] = ratings[place - 1];
+                place--;
+            }
+            rows[place] = row;
+            ratings[place] = rating;
+        }
+
+        for (int index = 0; index < kept && index < top_count; index++)
+        {
+            hit_from_db_row(p_db, rows[index], &hit);
+            p_visit(p_context, &hit);
+            count++;
+        }
+    }
+    return count;
+}
+
+/* first position in the (best first) rating index whose rating is below the limit
+   (or at/below it with or_equal set) */
+static int find_rating_position(const rating_index_t *p_index, float limit, int or_equal)
+{
+    int low = 0;
+    int high = p_index->count;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        float rating = p_index->p_ratings[middle];
+
+        if (rating < limit || (or_equal && rating == limit))
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
+/* hands every movie rated lowest..highest (both included) to p_visit, best first.
+   two binary searches on the rating index find where the range starts and ends,
+   then it's a straight walk, so O(log n + results) */
+int for_each_movie_in_rating_range(const movie_db_t *p_db, float lowest, float highest, hit_visitor_t p_visit, void *p_context)
+{
+    const rating_index_t *p_index = &p_db->rating_index;
+    // begin: first one not above highest. end: first one below lowest
+    int begin = find_rating_position(p_index, highest, 1);
+    int end = find_rating_position(p_index, lowest, 0);
+    movie_hit_t hit;
+
+    if (NULL != p_db->p_stream_path)
+        return -1;
+
+    stats_count(COUNT_NODES_VISITED, (uint64_t) ((end > begin) ? end - begin : 0));
+    for (int index = begin; index < end; index++)
+    {
+        hit_from_db_row(p_db, p_index->p_rows[index], &hit);
+        p_visit(p_context, &hit);
+    }
+    return (end > begin) ? end - begin : 0;
+}
+
+/* ---- batch mode ----
+   every query runs against the one loaded dataset and the results go out
+   through out_buffer_t: one big buffer, flushed with write() when it fills,
+   instead of a printf per row */
+
+/* growable output buffer that gets written to fd in big pieces.
+   with fd < 0 it never flushes, it just grows (the server builds replies this way) */
+typedef struct out_buffer
+{
+    int fd;
+    char *p_data;
+    size_t used;
+    size_t capacity;
+    int failed;     // a write went wrong, the rest is dropped
+} out_buffer_t;
+
+/* push everything buffered so far out to the fd (write can come up short, so loop) */
+void out_flush(out_buffer_t *p_out)
+{
+    size_t written = 0;
+
+    while (written < p_out->used && !p_out->failed)
+    {
+        ssize_t result = write(p_out->fd, p_out->p_data + written, p_out->used - written);
+        if (result < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            perror("write");
+            p_out->failed = 1;
+            break;
+        }
+        written += (size_t) result;
+    }
+
+    p_out->used = 0;
+}
+
+void out_bytes(out_buffer_t *p_out, const char *p_bytes, size_t length)
+{
+    // memory-only buffer: double until it fits
+    if (p_out->fd < 0)
+    {
+        if (p_out->failed)
+            return;
+        if (p_out->used + length > p_out->capacity)
+        {
+            size_t new_capacity = (0 == p_out->capacity) ? 256 : p_out->capacity * 2;
+            while (new_capacity < p_out->used + length)
+                new_capacity *= 2;
+
+            char *p_grown = realloc(p_out->p_data, new_capacity);
+            if (NULL == p_grown)
+            {
+                p_out->failed = 1;
+                return;
+            }
+            p_out->p_data = p_grown;
+            p_out->capacity = new_capacity;
+        }
+        memcpy(p_out->p_data + p_out->used, p_bytes, length);
+        p_out->used += length;
+        return;
+    }
+
+    if (p_out->used + length > p_out->capacity)
+        out_flush(p_out);
+
+    // bigger than the whole buffer (a monster title): skip the copy
+    if (length > p_out->capacity)
+    {
+        out_buffer_t direct = { p_out->fd, (char *) p_bytes, length, length, p_out->failed };
+        out_flush(&direct);
+        p_out->failed = direct.failed;
+        return;
+    }
+
+    memcpy(p_out->p_data + p_out->used, p_bytes, length);
+    p_out->used += length;
+}
+
+static void out_text(out_buffer_t *p_out, const char *p_text)
+{
+    out_bytes(p_out, p_text, strlen(p_text));
+}
+
+/* decimal int without going through printf */
+static void out_int(out_buffer_t *p_out, int value)
+{
+    char digits[12];
+    int position = sizeof(digits);
+    unsigned int magnitude = (value < 0) ? 0u - (unsigned int) value : (unsigned int) value;
+
+    do
+    {
+        digits[--position] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+        digits[--position] = '-';
+
+    out_bytes(p_out, digits + position, sizeof(digits) - position);
+}
+
+/* ratings keep the menu's %.1f so the numbers round exactly the same way */
+static void out_rating(out_buffer_t *p_out, float rating)
+{
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.1f", rating);
+    out_bytes(p_out, text, (size_t) length);
+}
+
+/* title as a TSV field: tabs, newlines and backslashes get backslash escapes */
+static void out_tsv_field(out_buffer_t *p_out, const char *p_text, size_t length)
+{
+    size_t run = 0;
+
+    for (size_t index = 0; index < length; index++)
+    {
+        char escape = 0;
+        switch (p_text[index])
+        {
+            case '\t': escape = 't'; break;
+            case '\n': escape = 'n'; break;
+            case '\r': escape = 'r'; break;
+            case '\\': escape = '\\'; break;
+        }
+        if (0 == escape)
+            continue;
+
+        out_bytes(p_out, p_text + run, index - run);
+        char pair[2] = { '\\', escape };
+        out_bytes(p_out, pair, 2);
+        run = index + 1;
+    }
+
+    out_bytes(p_out, p_text + run, length - run);
+}
+
+/* title (or query text) as a JSON string, quotes included */
+static void out_json_string(out_buffer_t *p_out, const char *p_text, size_t length)
+{
+    size_t run = 0;
+
+    out_bytes(p_out, "\"", 1);
+    for (size_t index = 0; index < length; index++)
+    {
+        unsigned char curr = (unsigned char) p_text[index];
+        if (curr >= 0x20 && '"' != curr && '\\' != curr)
+            continue;
+
+        out_bytes(p_out, p_text + run, index - run);
+        char escaped[8];
+        int escaped_length = ('"' == curr || '\\' == curr)
+                           ? snprintf(escaped, sizeof(escaped), "\\%c", curr)
+                           : snprintf(escaped, sizeof(escaped), "\\u%04x", curr);
+        out_bytes(p_out, escaped, (size_t) escaped_length);
+        run = index + 1;
+    }
+    out_bytes(p_out, p_text + run, length - run);
+    out_bytes(p_out, "\"", 1);
+}
+
+typedef enum batch_format
+{
+    FORMAT_TSV = 0,   // query, year, rating, title -- one line per result
+    FORMAT_JSON,      // one JSON object per query (JSON lines)
+    FORMAT_MENU       // the interactive menu's plain lines (year=, best-per-year, lang= only)
+} batch_format_t;
+
+/* state the batch visitors need while one query runs */
+typedef struct batch_context
+{
+    out_buffer_t *p_out;
+    batch_format_t format;
+    const char *p_query;
+    int emitted;
+} batch_context_t;
+
+static void emit_batch_hit(void *p_context, const movie_hit_t *p_hit)
+{
+    batch_context_t *p_batch = p_context;
+    out_buffer_t *p_out = p_batch->p_out;
+
+    if (FORMAT_JSON == p_batch->format)
+    {
+        out_text(p_out, (0 == p_batch->emitted) ? "{\"year\":" : ",{\"year\":");
+        out_int(p_out, p_hit->year);
+        out_text(p_out, ",\"rating\":");
+        out_rating(p_out, p_hit->rating);
+        out_text(p_out, ",\"title\":");
+        out_json_string(p_out, p_hit->p_title, p_hit->title_length);
+        out_bytes(p_out, "}", 1);
+    }
+    else
+    {
+        out_tsv_field(p_out, p_batch->p_query, strlen(p_batch->p_query));
+        out_bytes(p_out, "\t", 1);
+        out_int(p_out, p_hit->year);
+        out_bytes(p_out, "\t", 1);
+        out_rating(p_out, p_hit->rating);
+        out_bytes(p_out, "\t", 1);
+        out_tsv_field(p_out, p_hit->p_title, p_hit->title_length);
+        out_bytes(p_out, "\n", 1);
+    }
+
+    p_batch->emitted++;
+}
+
+/* reads a whole-string positive count for top=N / top-per-year=K, -1 if it isn't one */
+static int parse_query_count(const char *p_text)
+{
+    char *p_end = NULL;
+    long value = strtol(p_text, &p_end, 10);
+
+    if (p_end == p_text || '\0' != *p_end || value < 1 || value > INT_MAX)
+        return -1;
+    return (int) value;
+}
+
+/* which --stats phase a query line is timed as (PHASE_COUNT: not a query) */
+static stats_phase_t query_phase(const char *p_query)
+{
+    if (strncmp(p_query, "year=", 5) == 0)
+        return PHASE_QUERY_YEAR;
+    if (strcmp(p_query, "best-per-year") == 0)
+        return PHASE_QUERY_BEST;
+    if (strncmp(p_query, "lang=", 5) == 0)
+        return PHASE_QUERY_LANGUAGE;
+    if (strncmp(p_query, "top=", 4) == 0)
+        return PHASE_QUERY_TOP;
+    if (strncmp(p_query, "top-per-year=", 13) == 0)
+        return PHASE_QUERY_TOP_PER_YEAR;
+    if (strncmp(p_query, "rating=", 7) == 0)
+        return PHASE_QUERY_RATING;
+    return PHASE_COUNT;
+}
+
+/* render one query line: year=YYYY, best-per-year, lang=NAME, top=N,
+   top-per-year=K (K up to TOP_PER_YEAR) or rating=LO..HI.
+   returns -1 if the query doesn't make sense (or can't run on a streamed file) */
+static int render_batch_query(const movie_db_t *p_db, const char *p_query, batch_format_t format, out_buffer_t *p_out)
+{
+    batch_context_t batch = { p_out, format, p_query, 0 };
+    int is_valid = 1;
+    const char *p_error = "unknown query";
+    stats_timer_t timer;
+    stats_begin(&timer, query_phase(p_query));
+
+    if (FORMAT_JSON == format)
+    {
+        out_text(p_out, "{\"query\":");
+        out_json_string(p_out, p_query, strlen(p_query));
+        out_text(p_out, ",\"results\":[");
+    }
+
+    // the top/rating queries answer from indexes a streamed file never gets
+    if (NULL != p_db->p_stream_path && (strncmp(p_query, "top", 3) == 0 || strncmp(p_query, "rating=", 7) == 0))
+    {
+        is_valid = 0;
+        p_error = "not available when streaming";
+    }
+    else if (strncmp(p_query, "year=", 5) == 0)
+    {
+        char *p_end = NULL;
+        long year = strtol(p_query + 5, &p_end, 10);
+
+        // past an int it would wrap around to some other year
+        if (p_end == p_query + 5 || '\0' != *p_end || year < INT_MIN || year > INT_MAX)
+            is_valid = 0;
+        else
+            for_each_movie_in_year(p_db, (int) year, emit_batch_hit, &batch);
+    }
+    else if (strcmp(p_query, "best-per-year") == 0)
+    {
+        for_each_best_per_year(p_db, emit_batch_hit, &batch);
+    }
+    else if (strncmp(p_query, "lang=", 5) == 0)
+    {
+        for_each_movie_in_language(p_db, p_query + 5, emit_batch_hit, &batch);
+    }
+    else if (strncmp(p_query, "top=", 4) == 0)
+    {
+        int top_count = parse_query_count(p_query + 4);
+
+        if (top_count < 0 || for_each_top_rated(p_db, top_count, emit_batch_hit, &batch) < 0)
+            is_valid = 0;
+    }
+    else if (strncmp(p_query, "top-per-year=", 13) == 0)
+    {
+        int top_count = parse_query_count(p_query + 13);
+
+        if (top_count < 0 || for_each_top_per_year(p_db, top_count, emit_batch_hit, &batch) < 0)
+            is_valid = 0;
+    }
+    else if (strncmp(p_query, "rating=", 7) == 0)
+    {
+        char *p_end = NULL;
+        float lowest = strtof(p_query + 7, &p_end);
+        float highest = 0;
+
+        // LO..HI, both needed and both real numbers (nan compares false both ways, so it matched everything)
+        if (p_end == p_query + 7 || strncmp(p_end, "..", 2) != 0 || !isfinite(lowest))
+            is_valid = 0;
+        else
+        {
+            const char *p_high = p_end + 2;
+            highest = strtof(p_high, &p_end);
+            if (p_end == p_high || '\0' != *p_end || !isfinite(highest) || lowest > highest
+                || for_each_movie_in_rating_range(p_db, lowest, highest, emit_batch_hit, &batch) < 0)
+                is_valid = 0;
+        }
+    }
+    else
+    {
+        is_valid = 0;
+    }
+
+    if (FORMAT_JSON == format)
+    {
+        out_text(p_out, "],\"count\":");
+        out_int(p_out, batch.emitted);
+        if (!is_valid)
+        {
+            out_text(p_out, ",\"error\":");
+            out_json_string(p_out, p_error, strlen(p_error));
+        }
+        out_text(p_out, "}\n");
+    }
+
+    stats_count(COUNT_HITS, (uint64_t) batch.emitted);
+    stats_end(&timer);
+
+    if (!is_valid)
+    {
+        fprintf(stderr, "skipping query (%s): %s\n", p_error, p_query);
+        return -1;
+    }
+    return 0;
+}
+
+/* menu output formats, one per option */
+static void print_title_line(void *p_context, const movie_hit_t *p_hit)
+{
+    out_buffer_t *p_out = p_context;
+    out_bytes(p_out, p_hit->p_title, p_hit->title_length);
+    out_bytes(p_out, "\n", 1);
+}
+
+static void print_year_rating_title_line(void *p_context, const movie_hit_t *p_hit)
+{
+    out_buffer_t *p_out = p_context;
+    out_int(p_out, p_hit->year);
+    out_bytes(p_out, " ", 1);
+    out_rating(p_out, p_hit->rating);
+    out_bytes(p_out, " ", 1);
+    out_bytes(p_out, p_hit->p_title, p_hit->title_length);
+    out_bytes(p_out, "\n", 1);
+}
+
+static void print_year_title_line(void *p_context, const movie_hit_t *p_hit)
+{
+    out_buffer_t *p_out = p_context;
+    out_int(p_out, p_hit->year);
+    out_bytes(p_out, " ", 1);
+    out_bytes(p_out, p_hit->p_title, p_hit->title_length);
+    out_bytes(p_out, "\n", 1);
+}
+
+/* render one of the menu's own queries (year=YYYY, best-per-year, lang=NAME)
+   the way the menu always printed them */
+static int render_menu_query(const movie_db_t *p_db, const char *p_query, batch_format_t format, out_buffer_t *p_out)
+{
+    (void) format;
+    int found = 0;
+    stats_timer_t timer;
+    stats_begin(&timer, query_phase(p_query));
+
+    if (strncmp(p_query, "year=", 5) == 0)
+    {
+        int target_year = atoi(p_query + 5);
+        found = for_each_movie_in_year(p_db, target_year, print_title_line, p_out);
+
+        // if we didn't find any movie from that year, say so
+        if (0 == found)
+        {
+            out_text(p_out, "No data about movies released in the year ");
+            out_int(p_out, target_year);
+            out_bytes(p_out, "\n", 1);
+        }
+    }
+    else if (strcmp(p_query, "best-per-year") == 0)
+    {
+        found = for_each_best_per_year(p_db, print_year_rating_title_line, p_out);
+    }
+    else if (strncmp(p_query, "lang=", 5) == 0)
+    {
+        found = for_each_movie_in_language(p_db, p_query + 5, print_year_title_line, p_out);
+
+        // if we never hit a match, tell the user
+        if (0 == found)
+        {
+            out_text(p_out, "No data about movies released in ");
+            out_text(p_out, p_query + 5);
+            out_bytes(p_out, "\n", 1);
+        }
+    }
+
+    stats_count(COUNT_HITS, (uint64_t) ((found > 0) ? found : 0));
+    stats_end(&timer);
+    return 0;
+}
+
+typedef int (*query_renderer_t)(const movie_db_t *p_db, const char *p_query, batch_format_t format, out_buffer_t *p_out);
+
+/* render a query through the dataset's cache: a hit is one copy of the bytes
+   the same query (in the same format) came out as last time, a miss is
+   rendered off to the side, copied out, then kept. queries that fail aren't
+   kept, so their error shows up every time */
+static int run_cached_query(const movie_db_t *p_db, const char *p_query, batch_format_t format,
+                            query_renderer_t render, out_buffer_t *p_out)
+{
+    char key[QUERY_CACHE_MAX_KEY];
+    size_t query_length = strlen(p_query);
+
+    if (NULL == p_db->p_cache || query_length + 1 >= sizeof(key))
+        return render(p_db, p_query, format, p_out);
+
+    key[0] = "tjm"[format];
+    memcpy(key + 1, p_query, query_length);
+    size_t key_length = query_length + 1;
+
+    cached_output_t *p_entry = query_cache_get(p_db->p_cache, key, key_length);
+    if (NULL != p_entry)
+    {
+        if (p_entry->length > 0)
+            out_bytes(p_out, p_entry->p_data, p_entry->length);
+        query_cache_release(p_db->p_cache, p_entry);
+        return 0;
+    }
+
+    out_buffer_t rendered = { -1, NULL, 0, 0, 0 };
+    int result = render(p_db, p_query, format, &rendered);
+    if (rendered.failed)
+    {
+        // no memory to hold it off to the side, go straight out instead
+        free(rendered.p_data);
+        return render(p_db, p_query, format, p_out);
+    }
+
+    if (rendered.used > 0)
+        out_bytes(p_out, rendered.p_data, rendered.used);
+    if (0 == result)
+        query_cache_put(p_db->p_cache, key, key_length, rendered.p_data, rendered.used);
+    else
+        free(rendered.p_data);
+    return result;
+}
+
+/* run one query line (see render_batch_query), answered from the cache when it can be */
+int run_batch_query(const movie_db_t *p_db, const char *p_query, batch_format_t format, out_buffer_t *p_out)
+{
+    return run_cached_query(p_db, p_query, format, render_batch_query, p_out);
+}
+
+/* what every menu option ends in: the whole answer goes to stdout in a
+   single write (a cache hit never formats anything). without a cache it's
+   rendered into the usual 1 MiB batch buffer instead */
+static void print_menu_query(const movie_db_t *p_db, const char *p_query)
+{
+    out_buffer_t out = { STDOUT_FILENO, NULL, 0, 0, 0 };
+
+    // the prompts before this are still printf'd, they go first
+    fflush(stdout);
+    if (NULL == p_db->p_cache)
+    {
+        out.p_data = malloc(OUT_BUFFER_SIZE);
+        out.capacity = (NULL == out.p_data) ? 0 : OUT_BUFFER_SIZE;
+    }
+
+    run_cached_query(p_db, p_query, FORMAT_MENU, render_menu_query, &out);
+    out_flush(&out);
+    free(out.p_data);
+}
+
+ /* this one prints movies from a specific year */
+void print_movies_by_year(const movie_db_t *p_db, int target_year)
+{
+    char query[32];
+    snprintf(query, sizeof(query), "year=%d", target_year);
+    print_menu_query(p_db, query);
+}
+
+
+/* this one finds the highest-rated movie for each year */
+void print_highest_rated_by_year(const movie_db_t *p_db)
+{
+    print_menu_query(p_db, "best-per-year");
+}
+
+
+/* this one shows movies that were available in a specific language */
+void print_movies_by_language(const movie_db_t *p_db, const char *p_target_language)
+{
+    char query[QUERY_CACHE_MAX_KEY];
+    snprintf(query, sizeof(query), "lang=%s", p_target_language);
+    print_menu_query(p_db, query);
+}
+
+/* run every --query and every line of every --batch file, in order.
+   returns EXIT_FAILURE if any query was bad or the output couldn't be written */
+int run_batch(const movie_db_t *p_db, char **pp_queries, int query_count, batch_format_t format)
+{
+    out_buffer_t out = { STDOUT_FILENO, malloc(OUT_BUFFER_SIZE), 0, OUT_BUFFER_SIZE, 0 };
+    int status = EXIT_SUCCESS;
+
+    if (NULL == out.p_data)
+    {
+        fprintf(stderr, "couldn't allocate the output buffer\n");
+        return EXIT_FAILURE;
+    }
+
+    if (FORMAT_TSV == format)
+        out_text(&out, "query\tyear\trating\ttitle\n");
+
+    for (int index = 0; index < query_count; index++)
+    {
+        if (run_batch_query(p_db, pp_queries[index], format, &out) != 0)
+            status = EXIT_FAILURE;
+    }
+
+    out_flush(&out);
+    if (out.failed)
+        status = EXIT_FAILURE;
+
+    free(out.p_data);
+    return status;
+}
+
+/* append one query to the growable list main() collects them in */
+static int add_batch_query(char ***ppp_queries, int *p_count, int *p_capacity, char *p_query)
+{
+    if (*p_count == *p_capacity)
+    {
+        int new_capacity = (0 == *p_capacity) ? 16 : *p_capacity * 2;
+        char **pp_grown = realloc(*ppp_queries, new_capacity * sizeof(char *));
+        if (NULL == pp_grown)
+            return -1;
+        *ppp_queries = pp_grown;
+        *p_capacity = new_capacity;
+    }
+
+    (*ppp_queries)[(*p_count)++] = p_query;
+    return 0;
+}
+
+/* read a --batch file (or stdin for "-"): one query per line, blank lines and
+   # comments skipped. every query is strdup'd onto the list */
+static int read_batch_file(const char *p_path, char ***ppp_queries, int *p_count, int *p_capacity)
+{
+    FILE *p_file = (strcmp(p_path, "-") == 0) ? stdin : fopen(p_path, "r");
+    if (NULL == p_file)
+    {
+        fprintf(stderr, "couldn't open batch file %s\n", p_path);
+        return -1;
+    }
+
+    char *p_line = NULL;
+    size_t line_capacity = 0;
+    ssize_t read;
+    int result = 0;
+
+    while ((read = getline(&p_line, &line_capacity, p_file)) != -1)
+    {
+        // trim the newline (and a \r from windows files) off the end
+        while (read > 0 && ('\n' == p_line[read - 1] || '\r' == p_line[read - 1]))
+            p_line[--read] = '\0';
+
+        if (0 == read || '#' == p_line[0])
+            continue;
+
+        char *p_query = strdup(p_line);
+        if (NULL == p_query || add_batch_query(ppp_queries, p_count, p_capacity, p_query) != 0)
+        {
+            free(p_query);
+            result = -1;
+            break;
+        }
+    }
+
+    free(p_line);
+    if (stdin != p_file)
+        fclose(p_file);
+    return result;
+}
+ 
+/* ---- server mode (--serve PATH) ----
+   one epoll loop owns the listening socket and every connection. each
+   complete request line becomes a job for the worker pool, the workers
+   render the reply (one JSON line, same as --format json) into memory, and
+   hand it back through an eventfd. replies go out in request order even
+   when the workers finish out of order, so clients can pipeline */
+
+struct server_conn;
+
+/* one published state of the data for --watch. queries pin the current
+   version while they run; a reload builds the next one on the side and swaps
+   the pointer, so nothing in flight ever waits on it or sees it half done */
+typedef struct db_version
+{
+    movie_db_t db;
+    int readers;                // queries running against this version right now
+    struct db_version *p_next;  // retired list, oldest first
+} db_version_t;
+
+/* one request line on its way through the worker pool */
+typedef struct server_job
+{
+    struct server_conn *p_conn;
+    unsigned long seq;          // position of this request on its connection
+    char *p_query;
+    out_buffer_t reply;         // memory-only, filled in by the worker
+    struct server_job *p_next;
+} server_job_t;
+
+/* one client connection */
+typedef struct server_conn
+{
+    int fd;                     // -1 once the client has gone away
+    char *p_in;                 // bytes read but not yet split into lines
+    size_t in_used;
+    size_t in_capacity;
+    unsigned long next_seq;     // seq for the next request line
+    unsigned long next_to_send; // seq whose reply has to go out next
+    server_job_t *p_done;       // finished early, waiting on an earlier reply (sorted by seq)
+    out_buffer_t send;          // replies in order, not written to the socket yet
+    size_t send_offset;         // how much of send has been written
+    int pending;                // jobs the workers still have
+    int wants_out;              // EPOLLOUT is on because the socket was full
+    int read_closed;            // client shut its end, finish the replies and hang up
+} server_conn_t;
+
+/* mutex + condvar queue of jobs, used both ways (to the workers and back) */
+typedef struct job_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    server_job_t *p_head;
+    server_job_t *p_tail;
+    int stopping;
+} job_queue_t;
+
+/* everything the workers share */
+typedef struct server
+{
+    pthread_mutex_t version_lock;   // guards p_current, readers and the retired list
+    db_version_t *p_current;
+    db_version_t *p_retired;        // swapped out, freed once they (and everything older) have no readers
+    db_version_t *p_retired_tail;
+    job_queue_t todo;           // main loop -> workers
+    job_queue_t done;           // workers -> main loop
+    int wake_fd;                // eventfd poked whenever done gets a job
+    int epoll_fd;
+
+    // --watch
+    const char *p_watch_path;       // NULL if not watching
+    const load_options_t *p_load_options;
+    int inotify_fd;
+    int file_watch;                 // watch on the file itself (-1 while it's missing)
+    int dir_watch;                  // watch on its directory, to catch it being replaced
+    const char *p_watch_name;       // the file's name inside that directory
+    ino_t loaded_inode;             // the file the current version came from
+    pthread_t watch_thread;         // does the reloads (watch_worker)
+    int watch_stop_fd;              // eventfd that tells it to finish
+    uint64_t cache_hits;            // query cache totals of the versions already freed
+    uint64_t cache_misses;
+} server_t;
+
+static volatile sig_atomic_t g_server_stop = 0;
+
+static void handle_server_stop(int signal_number)
+{
+    (void) signal_number;
+    g_server_stop = 1;
+}
+
+static void push_job(job_queue_t *p_queue, server_job_t *p_job)
+{
+    p_job->p_next = NULL;
+
+    pthread_mutex_lock(&p_queue->lock);
+    if (NULL == p_queue->p_tail)
+        p_queue->p_head = p_job;
+    else
+        p_queue->p_tail->p_next = p_job;
+    p_queue->p_tail = p_job;
+    pthread_cond_signal(&p_queue->ready);
+    pthread_mutex_unlock(&p_queue->lock);
+}
+
+/* worker thread: take a job, run the query into its reply buffer, send it back */
+static void * server_worker(void *p_arg)
+{
+    server_t *p_server = p_arg;
+    job_queue_t *p_todo = &p_server->todo;
+
+    while (1)
+    {
+        pthread_mutex_lock(&p_todo->lock);
+        while (NULL == p_todo->p_head && !p_todo->stopping)
+            pthread_cond_wait(&p_todo->ready, &p_todo->lock);
+
+        if (NULL == p_todo->p_head)
+        {
+            pthread_mutex_unlock(&p_todo->lock);
+            return NULL;
+        }
+
+        server_job_t *p_job = p_todo->p_head;
+        p_todo->p_head = p_job->p_next;
+        if (NULL == p_todo->p_head)
+            p_todo->p_tail = NULL;
+        pthread_mutex_unlock(&p_todo->lock);
+
+        // pin whatever version is current for just this query
+        pthread_mutex_lock(&p_server->version_lock);
+        db_version_t *p_version = p_server->p_current;
+        p_version->readers++;
+        pthread_mutex_unlock(&p_server->version_lock);
+
+        run_batch_query(&p_version->db, p_job->p_query, FORMAT_JSON, &p_job->reply);
+
+        pthread_mutex_lock(&p_server->version_lock);
+        p_version->readers--;
+        pthread_mutex_unlock(&p_server->version_lock);
+
+        push_job(&p_server->done, p_job);
+        uint64_t one = 1;
+        if (write(p_server->wake_fd, &one, sizeof(one)) < 0 && EAGAIN != errno)
+            perror("eventfd write");
+    }
+}
+
+static void free_job(server_job_t *p_job)
+{
+    free(p_job->p_query);
+    free(p_job->reply.p_data);
+    free(p_job);
+}
+
+/* drop a connection. if the workers still hold jobs for it, it lingers
+   (fd closed) until the last one comes back */
+static void close_server_conn(server_t *p_server, server_conn_t *p_conn)
+{
+    if (p_conn->fd >= 0)
+    {
+        epoll_ctl(p_server->epoll_fd, EPOLL_CTL_DEL, p_conn->fd, NULL);
+        close(p_conn->fd);
+        p_conn->fd = -1;
+    }
+
+    if (p_conn->pending > 0)
+        return;
+
+    while (NULL != p_conn->p_done)
+    {
+        server_job_t *p_next = p_conn->p_done->p_next;
+        free_job(p_conn->p_done);
+        p_conn->p_done = p_next;
+    }
+    free(p_conn->p_in);
+    free(p_conn->send.p_data);
+    free(p_conn);
+}
+
+/* write as much of the send buffer as the socket takes, and flip EPOLLOUT
+   on or off depending on whether anything is left. returns -1 if the client is gone */
+static int flush_server_conn(server_t *p_server, server_conn_t *p_conn)
+{
+    while (p_conn->send_offset < p_conn->send.used)
+    {
+        ssize_t written = send(p_conn->fd, p_conn->send.p_data + p_conn->send_offset,
+                               p_conn->send.used - p_conn->send_offset, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                break;
+            return -1;
+        }
+        p_conn->send_offset += (size_t) written;
+    }
+
+    if (p_conn->send_offset == p_conn->send.used)
+    {
+        p_conn->send.used = 0;
+        p_conn->send_offset = 0;
+    }
+
+    int wants_out = (p_conn->send.used > 0);
+    if (wants_out != p_conn->wants_out)
+    {
+        struct epoll_event event;
+        event.events = (p_conn->read_closed ? 0 : EPOLLIN) | (wants_out ? EPOLLOUT : 0);
+        event.data.ptr = p_conn;
+        epoll_ctl(p_server->epoll_fd, EPOLL_CTL_MOD, p_conn->fd, &event);
+        p_conn->wants_out = wants_out;
+    }
+
+    return 0;
+}
+
+/* a worker finished: park the reply, then move every reply that's now next in line to the send buffer */
+static void finish_server_job(server_t *p_server, server_job_t *p_job)
+{
+    server_conn_t *p_conn = p_job->p_conn;
+    p_conn->pending--;
+
+    // client left while this was running
+    if (p_conn->fd < 0)
+    {
+        free_job(p_job);
+        close_server_conn(p_server, p_conn);
+        return;
+    }
+
+    server_job_t **pp_slot = &p_conn->p_done;
+    while (NULL != *pp_slot && (*pp_slot)->seq < p_job->seq)
+        pp_slot = &(*pp_slot)->p_next;
+    p_job->p_next = *pp_slot;
+    *pp_slot = p_job;
+
+    while (NULL != p_conn->p_done && p_conn->p_done->seq == p_conn->next_to_send)
+    {
+        server_job_t *p_ready = p_conn->p_done;
+        p_conn->p_done = p_ready->p_next;
+        p_conn->next_to_send++;
+
+        if (p_ready->reply.failed)
+            out_text(&p_conn->send, "{\"error\":\"out of memory\"}\n");
+        else
+            out_bytes(&p_conn->send, p_ready->reply.p_data, p_ready->reply.used);
+        free_job(p_ready);
+    }
+
+    if (flush_server_conn(p_server, p_conn) != 0 || p_conn->send.failed)
+        close_server_conn(p_server, p_conn);
+    else if (p_conn->read_closed && 0 == p_conn->pending && 0 == p_conn->send.used)
+        close_server_conn(p_server, p_conn);
+}
+
+/* read what the client sent and queue a job per complete line.
+   returns -1 if the connection should be closed */
+static int read_server_conn(server_t *p_server, server_conn_t *p_conn)
+{
+    while (1)
+    {
+        if (p_conn->in_used == p_conn->in_capacity)
+        {
+            // a request line is a few dozen bytes, anything this long is garbage
+            if (p_conn->in_capacity >= SERVER_MAX_LINE)
+                return -1;
+
+            size_t new_capacity = (0 == p_conn->in_capacity) ? 4096 : p_conn->in_capacity * 2;
+            char *p_grown = realloc(p_conn->p_in, new_capacity);
+            if (NULL == p_grown)
+                return -1;
+            p_conn->p_in = p_grown;
+            p_conn->in_capacity = new_capacity;
+        }
+
+        ssize_t got = read(p_conn->fd, p_conn->p_in + p_conn->in_used, p_conn->in_capacity - p_conn->in_used);
+        if (got < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                break;
+            return -1;
+        }
+        if (0 == got)
+        {
+            // client is done sending: stop watching for input, but still answer what it asked
+            p_conn->read_closed = 1;
+            if (0 == p_conn->pending && 0 == p_conn->send.used)
+                return -1;
+
+            struct epoll_event event;
+            event.events = p_conn->wants_out ? EPOLLOUT : 0;
+            event.data.ptr = p_conn;
+            epoll_ctl(p_server->epoll_fd, EPOLL_CTL_MOD, p_conn->fd, &event);
+            break;
+        }
+
+        p_conn->in_used += (size_t) got;
+
+        // split off every complete line as a job, keep the partial tail for next time
+        char *p_line = p_conn->p_in;
+        char *p_end = p_conn->p_in + p_conn->in_used;
+        char *p_newline;
+        while ((p_newline = memchr(p_line, '\n', (size_t) (p_end - p_line))) != NULL)
+        {
+            size_t length = (size_t) (p_newline - p_line);
+            if (length > 0 && '\r' == p_line[length - 1])
+                length--;
+
+            if (length > 0)
+            {
+                server_job_t *p_job = calloc(1, sizeof(server_job_t));
+                if (NULL == p_job || NULL == (p_job->p_query = strndup(p_line, length)))
+                {
+                    free(p_job);
+                    return -1;
+                }
+                p_job->p_conn = p_conn;
+                p_job->seq = p_conn->next_seq++;
+                p_job->reply.fd = -1;
+                p_conn->pending++;
+                push_job(&p_server->todo, p_job);
+            }
+            p_line = p_newline + 1;
+        }
+
+        p_conn->in_used = (size_t) (p_end - p_line);
+        memmove(p_conn->p_in, p_line, p_conn->in_used);
+    }
+
+    return 0;
+}
+
+/* ---- --watch: picking up rows appended to the CSV ---- */
+
+/* start the next version of a list-layout db. it gets its own copy of the small
+   index arrays (year buckets, language entries, the name hash), whose contents
+   change on every append. the row table and the posting lists are shared: rows
+   only get added past the end, and an older version never looks past its own
+   counts, so it can't see them. one that has to grow is copied, not realloc'd
+   (grow_index_array), and the version that copied it hands the old array back
+   (hand_over_index_arrays). nodes, titles, language names and the mapping move
+   to the new version (p_old->storage_moved), so storage only ever belongs to the
+   newest version that uses it. returns -1 if out of memory */
+static int clone_movie_db(movie_db_t *p_old, movie_db_t *p_new)
+{
+    *p_new = *p_old;
+    p_new->p_cache = NULL;  // its results are about to go stale, the new version starts its own
+    memset(&p_new->rating_index, 0, sizeof(p_new->rating_index));
+    p_new->rows_shared = 1;
+    p_new->rows_moved = 0;
+    p_new->year_index.p_buckets = malloc((p_old->year_index.bucket_capacity + 1) * sizeof(year_bucket_t));
+    p_new->lang_dict.p_entries = malloc((p_old->lang_dict.lang_capacity + 1) * sizeof(lang_entry_t));
+    p_new->lang_dict.p_slots = malloc((p_old->lang_dict.slot_count + 1) * sizeof(unsigned int));
+
+    if (NULL == p_new->year_index.p_buckets || NULL == p_new->lang_dict.p_entries || NULL == p_new->lang_dict.p_slots)
+    {
+        fprintf(stderr, "couldn't copy the indexes for the reload\n");
+        free(p_new->year_index.p_buckets);
+        free(p_new->lang_dict.p_entries);
+        free(p_new->lang_dict.p_slots);
+        return -1;
+    }
+
+    memcpy(p_new->year_index.p_buckets, p_old->year_index.p_buckets, p_old->year_index.bucket_count * sizeof(year_bucket_t));
+    memcpy(p_new->lang_dict.p_slots, p_old->lang_dict.p_slots, p_old->lang_dict.slot_count * sizeof(unsigned int));
+    for (int id = 0; id < p_old->lang_dict.lang_count; id++)
+    {
+        lang_entry_t *p_copy = &p_new->lang_dict.p_entries[id];
+        *p_copy = p_old->lang_dict.p_entries[id];
+        p_copy->postings_shared = 1;
+        p_copy->postings_moved = 0;
+    }
+    p_old->storage_moved = 1;
+    return 0;
+}
+
+/* p_new is about to replace p_old: every shared array p_new kept is p_new's to
+   free now, and every one it had to copy is p_old's again */
+static void hand_over_index_arrays(movie_db_t *p_old, const movie_db_t *p_new)
+{
+    p_old->rows_moved = (p_new->pp_rows == p_old->pp_rows);
+    for (int id = 0; id < p_old->lang_dict.lang_count; id++)
+    {
+        lang_entry_t *p_entry = &p_old->lang_dict.p_entries[id];
+        p_entry->postings_moved = (p_new->lang_dict.p_entries[id].pp_postings == p_entry->pp_postings);
+    }
+}
+
+/* parse the complete lines in [parsed_bytes, file_size) into p_db.
+   an unfinished last line is left for the next time round.
+   returns how many rows were added, -1 if the file couldn't be read */
+static int apply_appended_rows(const char *p_path, off_t file_size, movie_db_t *p_db)
+{
+    size_t length = (size_t) (file_size - (off_t) p_db->parsed_bytes);
+    char *p_delta = malloc(length);
+    int fd = open(p_path, O_RDONLY | O_CLOEXEC);
+    size_t got = 0;
+
+    if (NULL == p_delta || fd < 0)
+    {
+        free(p_delta);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    while (got < length)
+    {
+        ssize_t count = pread(fd, p_delta + got, length - got, (off_t) (p_db->parsed_bytes + got));
+        if (count < 0 && EINTR == errno)
+            continue;
+        if (count <= 0)
+            break;
+        got += (size_t) count;
+    }
+    close(fd);
+
+    // only whole records, the writer may be halfway through the last one
+    int before = p_db->total_count;
+    char *p_curr = p_delta;
+    char *p_end = p_delta + got;
+    while (p_curr < p_end)
+    {
+        char *p_newline = find_record_end(p_curr, p_end);
+        if (p_newline == p_end)
+            break;
+
+        movie_row_t row;
+        if (p_newline > p_curr && 0 == parse_movie_view(p_curr, (size_t) (p_newline - p_curr), &p_db->lang_dict, &row))
+            store_movie_row(p_db, &row);
+
+        p_curr = p_newline + 1;
+    }
+
+    p_db->parsed_bytes += (size_t) (p_curr - p_delta);
+    free(p_delta);
+    return p_db->total_count - before;
+}
+
+/* make p_version the current one. the old one goes on the retired list */
+static void publish_version(server_t *p_server, db_version_t *p_version)
+{
+    pthread_mutex_lock(&p_server->version_lock);
+    db_version_t *p_old = p_server->p_current;
+    p_server->p_current = p_version;
+
+    p_old->p_next = NULL;
+    if (NULL == p_server->p_retired_tail)
+        p_server->p_retired = p_old;
+    else
+        p_server->p_retired_tail->p_next = p_old;
+    p_server->p_retired_tail = p_old;
+    pthread_mutex_unlock(&p_server->version_lock);
+}
+
+/* keep a version's cache hits/misses before it goes away (no readers left, so no lock) */
+static void add_cache_totals(server_t *p_server, const movie_db_t *p_db)
+{
+    if (NULL != p_db->p_cache)
+    {
+        p_server->cache_hits += p_db->p_cache->hits;
+        p_server->cache_misses += p_db->p_cache->misses;
+    }
+}
+
+/* free retired versions nobody is reading anymore. strictly oldest first:
+   an old version can share nodes with the next one, and it's the newer one
+   that owns (and frees) them */
+static void reap_versions(server_t *p_server)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&p_server->version_lock);
+        db_version_t *p_oldest = p_server->p_retired;
+        if (NULL == p_oldest || p_oldest->readers > 0)
+        {
+            pthread_mutex_unlock(&p_server->version_lock);
+            return;
+        }
+        p_server->p_retired = p_oldest->p_next;
+        if (NULL == p_server->p_retired)
+            p_server->p_retired_tail = NULL;
+        pthread_mutex_unlock(&p_server->version_lock);
+
+        add_cache_totals(p_server, &p_oldest->db);
+        free_movie_db(&p_oldest->db);
+        free(p_oldest);
+    }
+}
+
+/* (re)point the file watch at whatever is at the path now (-1 if nothing is) */
+static void watch_movies_file(server_t *p_server)
+{
+    if (p_server->file_watch >= 0)
+        inotify_rm_watch(p_server->inotify_fd, p_server->file_watch);
+    p_server->file_watch = inotify_add_watch(p_server->inotify_fd, p_server->p_watch_path,
+                                             IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+}
+
+/* the file changed: parse just the new bytes if it only grew, otherwise
+   (truncated or replaced) load it again from scratch. either way the result
+   becomes a new version and the queries move over to it. runs on the watch
+   thread (and once before the server starts), never on the event loop */
+static void refresh_watched_file(server_t *p_server, int is_replaced)
+{
+    db_version_t *p_current = p_server->p_current;   // only this thread ever swaps it
+    struct stat file_stat;
+
+    if (is_replaced)
+        watch_movies_file(p_server);
+    if (p_server->file_watch < 0 || stat(p_server->p_watch_path, &file_stat) != 0)
+        return; // gone for now, the directory watch tells us when it's back
+
+    int is_rewritten = (file_stat.st_ino != p_server->loaded_inode || file_stat.st_size < (off_t) p_current->db.parsed_bytes);
+    if (!is_rewritten && file_stat.st_size == (off_t) p_current->db.parsed_bytes)
+        return;
+
+    db_version_t *p_next = calloc(1, sizeof(db_version_t));
+    if (NULL == p_next)
+        return;
+
+    if (is_rewritten)
+    {
+        if (load_movies_from_csv((char *) p_server->p_watch_path, p_server->p_load_options, &p_next->db) <= 0)
+        {
+            fprintf(stderr, "reload of %s found no movies, keeping the old data\n", p_server->p_watch_path);
+            free_movie_db(&p_next->db);
+            free(p_next);
+            return;
+        }
+        p_server->loaded_inode = file_stat.st_ino;
+        fprintf(stderr, "reloaded %s from scratch: %d movies\n", p_server->p_watch_path, p_next->db.total_count);
+    }
+    else
+    {
+        if (clone_movie_db(&p_current->db, &p_next->db) != 0)
+        {
+            free(p_next);
+            return;
+        }
+        p_next->db.p_cache = query_cache_create(p_server->p_load_options->cache_bytes);
+
+        stats_timer_t timer;
+        stats_begin(&timer, PHASE_WATCH_APPEND);
+        int added = apply_appended_rows(p_server->p_watch_path, file_stat.st_size, &p_next->db);
+        if (p_current->db.rating_index.count == p_current->db.total_count)
+            extend_rating_index(&p_next->db, &p_current->db.rating_index);
+        else
+            build_rating_index(&p_next->db); // the old one never got built, nothing to merge into
+        stats_end(&timer);
+        hand_over_index_arrays(&p_current->db, &p_next->db);
+        if (added > 0)
+            fprintf(stderr, "picked up %d appended movies (%d total)\n", added, p_next->db.total_count);
+    }
+
+    publish_version(p_server, p_next);
+
+    // the event loop frees the old version once its last query is done
+    uint64_t one = 1;
+    if (write(p_server->wake_fd, &one, sizeof(one)) < 0 && EAGAIN != errno)
+        perror("eventfd write");
+}
+
+/* drain the inotify fd and refresh if anything touched our file */
+static void handle_watch_events(server_t *p_server)
+{
+    char buffer[WATCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int is_changed = 0;
+    int is_replaced = 0;
+    ssize_t got;
+
+    while ((got = read(p_server->inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *p_curr = buffer; p_curr < buffer + got; )
+        {
+            const struct inotify_event *p_event = (const struct inotify_event *) p_curr;
+
+            if (p_event->wd == p_server->file_watch)
+            {
+                is_changed = 1;
+                if (p_event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+                    is_replaced = 1;
+            }
+            else if (p_event->wd == p_server->dir_watch && p_event->len > 0
+                     && strcmp(p_event->name, p_server->p_watch_name) == 0)
+            {
+                // something new was created / renamed onto our name
+                is_changed = 1;
+                is_replaced = 1;
+            }
+            p_curr += sizeof(struct inotify_event) + p_event->len;
+        }
+    }
+
+    if (is_changed)
+        refresh_watched_file(p_server, is_replaced);
+}
+
+/* --watch thread: sleeps on the inotify fd and does every reload itself, so a big
+   one (a from-scratch load of the whole file) never holds up the event loop.
+   events that come in during a reload are all handled by the next one */
+static void * watch_worker(void *p_arg)
+{
+    server_t *p_server = p_arg;
+    struct pollfd fds[2];
+    fds[0].fd = p_server->inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = p_server->watch_stop_fd;
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            perror("poll");
+            return NULL;
+        }
+        if (fds[1].revents)
+            return NULL;
+        if (fds[0].revents)
+            handle_watch_events(p_server);
+    }
+}
+
+/* serve queries on a unix socket at p_path until SIGINT / SIGTERM.
+   takes the loaded db over (*p_db is left empty). with p_watch_path set it
+   also follows that CSV: appended rows show up in the answers without a restart */
+int run_server(movie_db_t *p_db, const char *p_path, int worker_count, const char *p_watch_path, const load_options_t *p_options)
+{
+    // markers so the epoll loop can tell the listening socket and eventfd from connections
+    static char listen_marker;
+    static char wake_marker;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(p_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "socket path is too long\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, p_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    unlink(p_path); // left over from a run that didn't clean up
+    if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0)
+    {
+        perror("couldn't listen on the socket");
+        close(listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    server_t server;
+    memset(&server, 0, sizeof(server));
+    server.p_current = calloc(1, sizeof(db_version_t));
+    if (NULL == server.p_current)
+    {
+        fprintf(stderr, "out of memory\n");
+        close(listen_fd);
+        return EXIT_FAILURE;
+    }
+    server.p_current->db = *p_db;
+    memset(p_db, 0, sizeof(*p_db));
+    pthread_mutex_init(&server.version_lock, NULL);
+    pthread_mutex_init(&server.todo.lock, NULL);
+    pthread_cond_init(&server.todo.ready, NULL);
+    pthread_mutex_init(&server.done.lock, NULL);
+    pthread_cond_init(&server.done.ready, NULL);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.wake_fd < 0 || server.epoll_fd < 0)
+    {
+        perror("couldn't set up epoll");
+        close(listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_marker;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.ptr = &wake_marker;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &event);
+
+    // --watch: the file itself for appends, its directory for it being swapped out
+    server.inotify_fd = -1;
+    server.file_watch = -1;
+    server.dir_watch = -1;
+    char *p_watch_dir = NULL;
+    if (NULL != p_watch_path)
+    {
+        struct stat file_stat;
+        const char *p_slash = strrchr(p_watch_path, '/');
+
+        server.p_watch_path = p_watch_path;
+        server.p_watch_name = (NULL == p_slash) ? p_watch_path : p_slash + 1;
+        server.p_load_options = p_options;
+        p_watch_dir = (NULL == p_slash) ? strdup(".") : strndup(p_watch_path, (size_t) (p_slash - p_watch_path) + 1);
+        server.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (NULL == p_watch_dir || server.inotify_fd < 0 || stat(p_watch_path, &file_stat) != 0)
+        {
+            perror("couldn't watch the file");
+            close(listen_fd);
+            return EXIT_FAILURE;
+        }
+        server.loaded_inode = file_stat.st_ino;
+        watch_movies_file(&server);
+        server.dir_watch = inotify_add_watch(server.inotify_fd, p_watch_dir, IN_CREATE | IN_MOVED_TO);
+
+        // anything appended between the load and now
+        refresh_watched_file(&server, 0);
+
+        // the reloads get their own thread. it leaves SIGINT / SIGTERM to the event loop,
+        // they have to interrupt its epoll_wait to stop the server
+        sigset_t stop_signals;
+        sigset_t old_mask;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+        server.watch_stop_fd = eventfd(0, EFD_CLOEXEC);
+        int is_started = (server.watch_stop_fd >= 0 && 0 == pthread_create(&server.watch_thread, NULL, watch_worker, &server));
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        if (!is_started)
+        {
+            perror("couldn't start the watch thread");
+            close(listen_fd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_t *p_workers = calloc(worker_count, sizeof(pthread_t));
+    int started = 0;
+    while (NULL != p_workers && started < worker_count
+           && 0 == pthread_create(&p_workers[started], NULL, server_worker, &server))
+        started++;
+    if (0 == started)
+    {
+        fprintf(stderr, "couldn't start any worker threads\n");
+        close(listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_server_stop;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    fprintf(stderr, "serving %d movies on %s with %d workers%s\n", server.p_current->db.total_count, p_path, started,
+            (NULL != p_watch_path) ? ", watching the file for new rows" : "");
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!g_server_stop)
+    {
+        int ready = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int index = 0; index < ready; index++)
+        {
+            void *p_tag = events[index].data.ptr;
+
+            if (&listen_marker == p_tag)
+            {
+                int client_fd;
+                while ((client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    server_conn_t *p_conn = calloc(1, sizeof(server_conn_t));
+                    if (NULL == p_conn)
+                    {
+                        close(client_fd);
+                        continue;
+                    }
+                    p_conn->fd = client_fd;
+                    p_conn->send.fd = -1;
+
+                    struct epoll_event conn_event;
+                    conn_event.events = EPOLLIN;
+                    conn_event.data.ptr = p_conn;
+                    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, client_fd, &conn_event);
+                }
+            }
+            else if (&wake_marker == p_tag)
+            {
+                uint64_t count;
+                while (read(server.wake_fd, &count, sizeof(count)) > 0)
+                    ;
+
+                // grab everything the workers finished in one go
+                pthread_mutex_lock(&server.done.lock);
+                server_job_t *p_job = server.done.p_head;
+                server.done.p_head = server.done.p_tail = NULL;
+                pthread_mutex_unlock(&server.done.lock);
+
+                while (NULL != p_job)
+                {
+                    server_job_t *p_next = p_job->p_next;
+                    finish_server_job(&server, p_job);
+                    p_job = p_next;
+                }
+
+                // finished queries may have been the last readers of an old version
+                reap_versions(&server);
+            }
+            else
+            {
+                server_conn_t *p_conn = p_tag;
+                int is_dead = (events[index].events & (EPOLLERR | EPOLLHUP)) && !(events[index].events & EPOLLIN);
+
+                if (!is_dead && (events[index].events & EPOLLOUT))
+                    is_dead = (flush_server_conn(&server, p_conn) != 0)
+                           || (p_conn->read_closed && 0 == p_conn->pending && 0 == p_conn->send.used);
+                if (!is_dead && (events[index].events & EPOLLIN))
+                    is_dead = (read_server_conn(&server, p_conn) != 0);
+
+                if (is_dead)
+                    close_server_conn(&server, p_conn);
+            }
+        }
+    }
+
+    // no more reloads: the watch thread finishes the one it's on, if any
+    if (NULL != p_watch_path)
+    {
+        uint64_t one = 1;
+        if (write(server.watch_stop_fd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+        pthread_join(server.watch_thread, NULL);
+        close(server.watch_stop_fd);
+    }
+
+    // let the workers drain what they have, then stop them
+    pthread_mutex_lock(&server.todo.lock);
+    server.todo.stopping = 1;
+    pthread_cond_broadcast(&server.todo.ready);
+    pthread_mutex_unlock(&server.todo.lock);
+    for (int index = 0; index < started; index++)
+        pthread_join(p_workers[index], NULL);
+    free(p_workers);
+
+    close(listen_fd);
+    close(server.wake_fd);
+    close(server.epoll_fd);
+    if (server.inotify_fd >= 0)
+        close(server.inotify_fd);
+    free(p_watch_dir);
+    unlink(p_path);
+
+    // workers are gone, so every retired version is unread; oldest first, then the current one
+    reap_versions(&server);
+    add_cache_totals(&server, &server.p_current->db);
+    free_movie_db(&server.p_current->db);
+    free(server.p_current);
+    pthread_mutex_destroy(&server.version_lock);
+
+    if (0 != p_options->cache_bytes)
+        fprintf(stderr, "query cache: %llu hits, %llu misses\n",
+                (unsigned long long) server.cache_hits, (unsigned long long) server.cache_misses);
+    fprintf(stderr, "server stopped\n");
+    return EXIT_SUCCESS;
+}
+ 
+/* 512, 64K, 200M, 8G -> bytes. -1 if it isn't a size */
+static long long parse_size(const char *p_text)
+{
+    char *p_end = NULL;
+    long long size = strtoll(p_text, &p_end, 10);
+
+    if (p_end == p_text || size < 0)
+        return -1;
+
+    int shift = 0;
+    if ('K' == *p_end || 'k' == *p_end)
+        shift = 10;
+    else if ('M' == *p_end || 'm' == *p_end)
+        shift = 20;
+    else if ('G' == *p_end || 'g' == *p_end)
+        shift = 30;
+    if (shift > 0)
+        p_end++;
+
+    return ('\0' == *p_end) ? size << shift : -1;
+}
+
+int main(int argc, char **pp_args)
+{
+    // options come first, the last thing that isn't an option is the file
+    load_options_t options = { LAYOUT_LIST, 0, 1, 0, 0, 0, QUERY_CACHE_DEFAULT, 0 };
+    char * p_filename = NULL;
+
+    // batch mode: queries collected from --query / --batch, in the order given
+    char ** pp_queries = NULL;
+    int query_count = 0;
+    int query_capacity = 0;
+    int is_batch = 0;
+    batch_format_t format = FORMAT_TSV;
+
+    // server mode
+    char * p_socket_path = NULL;
+    int worker_count = SERVER_DEFAULT_WORKERS;
+    int is_watching = 0;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(pp_args[arg], "--columnar") == 0)
+            options.layout = LAYOUT_COLUMNAR;
+        else if (strcmp(pp_args[arg], "--compact") == 0)
+            options.layout = LAYOUT_COMPACT;
+        else if (strcmp(pp_args[arg], "--mmap") == 0)
+            options.use_mmap = 1;
+        else if (strcmp(pp_args[arg], "--snapshot") == 0)
+            options.use_snapshot = 1;
+        else if (strcmp(pp_args[arg], "--stream") == 0)
+            options.use_stream = 1;
+        else if (strcmp(pp_args[arg], "--stream-over") == 0 && arg + 1 < argc)
+        {
+            options.stream_over = parse_size(pp_args[++arg]);
+            if (options.stream_over <= 0)
+            {
+                printf("--stream-over wants a size like 512M or 8G\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(pp_args[arg], "--cache-size") == 0 && arg + 1 < argc)
+        {
+            long long cache_bytes = parse_size(pp_args[++arg]);
+            if (cache_bytes < 0)
+            {
+                printf("--cache-size wants a size like 64M (0 turns the cache off)\n");
+                return EXIT_FAILURE;
+            }
+            options.cache_bytes = (size_t) cache_bytes;
+        }
+        else if (strcmp(pp_args[arg], "--query") == 0 && arg + 1 < argc)
+        {
+            // strdup'd so they get freed the same way as the batch file lines
+            char * p_query = strdup(pp_args[++arg]);
+            if (NULL == p_query || add_batch_query(&pp_queries, &query_count, &query_capacity, p_query) != 0)
+            {
+                fprintf(stderr, "couldn't store the query\n");
+                return EXIT_FAILURE;
+            }
+            is_batch = 1;
+        }
+        else if (strcmp(pp_args[arg], "--batch") == 0 && arg + 1 < argc)
+        {
+            if (read_batch_file(pp_args[++arg], &pp_queries, &query_count, &query_capacity) != 0)
+                return EXIT_FAILURE;
+            is_batch = 1;
+        }
+        else if (strcmp(pp_args[arg], "--serve") == 0 && arg + 1 < argc)
+            p_socket_path = pp_args[++arg];
+        else if (strcmp(pp_args[arg], "--watch") == 0)
+            is_watching = options.whole_records_only = 1;
+        else if (strcmp(pp_args[arg], "--workers") == 0 && arg + 1 < argc)
+        {
+            worker_count = atoi(pp_args[++arg]);
+            if (worker_count < 1 || worker_count > MAX_LOAD_THREADS)
+            {
+                printf("--workers wants a number from 1 to %d\n", MAX_LOAD_THREADS);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(pp_args[arg], "--format") == 0 && arg + 1 < argc)
+        {
+            arg++;
+            if (strcmp(pp_args[arg], "json") == 0)
+                format = FORMAT_JSON;
+            else if (strcmp(pp_args[arg], "tsv") == 0)
+                format = FORMAT_TSV;
+            else
+            {
+                printf("--format wants tsv or json\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(pp_args[arg], "--stats") == 0)
+            enable_stats(NULL);
+        else if (strncmp(pp_args[arg], "--stats=", 8) == 0)
+            enable_stats(pp_args[arg] + 8);
+        else if (strcmp(pp_args[arg], "--threads") == 0 && arg + 1 < argc)
+        {
+            options.thread_count = atoi(pp_args[++arg]);
+            if (options.thread_count < 1 || options.thread_count > MAX_LOAD_THREADS)
+            {
+                printf("--threads wants a number from 1 to %d\n", MAX_LOAD_THREADS);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+            p_filename = pp_args[arg];
+    }
+
+    // check if the user gave us a filename (we expect: ./movies somefile.csv)
+    if (NULL == p_filename)
+    {
+        // let them know what they did wrong and how to fix it
+        printf("You must provide the name of the file to process\n");
+        printf("Example usage: ./movies movies_sample_1.csv\n");
+        return EXIT_FAILURE; // standard error code for bad run
+    }
+
+    // appends get spliced into the list and its indexes, the other layouts can't take that
+    if (is_watching && (NULL == p_socket_path || LAYOUT_LIST != options.layout || options.use_snapshot
+                        || options.use_stream || options.stream_over > 0))
+    {
+        printf("--watch goes with --serve and the default list layout (no --columnar, --compact, --snapshot or --stream)\n");
+        return EXIT_FAILURE;
+    }
+
+    // MOVIES_STATS=1 (stderr) or MOVIES_STATS=FILE does the same as --stats, for runs we can't add a flag to
+    if (NULL != getenv("MOVIES_STATS") && strcmp(getenv("MOVIES_STATS"), "0") != 0)
+        enable_stats(getenv("MOVIES_STATS"));
+
+    // choose SSE2/AVX2/plain C once up front, for the column scans and the CSV tokenizer
+    pick_scan_kernels();
+    csv_pick_kernels();
+
+    // this will hold the list, the count and the per-year index
+    movie_db_t movie_db;
+
+    // call the CSV loading function and also give it a pointer to movie_db
+    // so it can fill it in for us as it reads the file
+    // good example of passing around pointers vs global variables
+    int load_result = load_movies_from_csv(p_filename, &options, &movie_db);
+
+    // if loading failed or nothing came back, bail (a streamed file only gets read by the queries).
+    // a failed load can still have some rows in it, those don't count
+    if (load_result < 0 || (0 == movie_db.total_count && NULL == movie_db.p_stream_path))
     {
         fprintf(stderr, "Failed to process file or no movies parsed.\n");
         return EXIT_FAILURE;
     }
 
+    // server mode: answer queries over the socket until told to stop
+    if (NULL != p_socket_path && NULL != movie_db.p_stream_path)
+    {
+        fprintf(stderr, "--serve needs the file loaded, it can't stream %s\n", p_filename);
+        return EXIT_FAILURE;
+    }
+    if (NULL != p_socket_path)
+    {
+        int status = run_server(&movie_db, p_socket_path, worker_count, is_watching ? p_filename : NULL, &options);
+        free_movie_db(&movie_db);
+        return status;
+    }
+
+    // batch mode: run the queries, no menu, nothing on stdout but the results
+    if (is_batch)
+    {
+        int status = run_batch(&movie_db, pp_queries, query_count, format);
+
+        for (int index = 0; index < query_count; index++)
+            free(pp_queries[index]);
+        free(pp_queries);
+        free_movie_db(&movie_db);
+        return status;
+    }
+
     // success! show how many movies we parsed
-    printf("Processed file %s and parsed data for %d movies\n", pp_args[1], total_movies);
+    if (NULL != movie_db.p_stream_path)
+        printf("Streaming file %s, each choice reads it once from start to end\n", p_filename);
+    else
+        printf("Processed file %s and parsed data for %d movies\n", p_filename, movie_db.total_count);
 
     // start a menu loop for the user to pick options
     int user_choice = 0;
@@ -378,12 +5259,12 @@ int main(int argc, char **pp_args)
             int target_year;
             printf("Enter the year for which you want to see movies: ");
             scanf("%d", &target_year); // get the year they want
-            print_movies_by_year(p_movie_list, target_year); // call helper to print matches
+            print_movies_by_year(&movie_db, target_year); // call helper to print matches
         }
         // option 2: show top-rated movie per year
         else if (user_choice == 2)
         {
-            print_highest_rated_by_year(p_movie_list);
+            print_highest_rated_by_year(&movie_db);
         }
         // option 3: filter by language
         else if (user_choice == 3)
@@ -391,7 +5272,7 @@ int main(int argc, char **pp_args)
             char input_language[MAX_LANGUAGE_LENGTH]; // where we'll put their input
             printf("Enter the language for which you want to see movies: ");
             scanf("%s", input_language); // grab a string from the user
-            print_movies_by_language(p_movie_list, input_language); // show results
+            print_movies_by_language(&movie_db, input_language); // show results
         }
         // option 4: exit the loop and end the program
         else if (user_choice == 4)
@@ -405,8 +5286,8 @@ int main(int argc, char **pp_args)
         }
     }
 
-    // before we quit, clean up the memory we allocated for the movie list
-    free_movie_list(p_movie_list);
+    // before we quit, clean up the memory we allocated for the movie list and its index
+    free_movie_db(&movie_db);
 
     return EXIT_SUCCESS; // everything went fine turns
 }
@@ -8,11 +8,83 @@
  *   this program lets you choose a csv file of movies,
  *   then sorts movies into folders by year
  *
+ *   the titles get collected per year in memory while the csv is read,
+ *   then each YYYY.txt is written in one go: one open, one write, one
+ *   chmod and one close per year file instead of per movie. past
+ *   BUCKET_FLUSH_BYTES of titles everything buffered goes out early so a
+ *   huge csv doesn't have to fit in memory
+ *
+ *   with --all there's no menu: every movies_*.csv in the current folder
+ *   gets split, each into its own phamjac.movies.NNNNN folder like the
+ *   menu does, by a pool of --jobs threads (one per cpu by default, never
+ *   more than the open file limit allows). a line is printed as each file
+ *   finishes and a throughput total at the end
+ *
+ *   a csv of PARALLEL_MIN_BYTES or more gets split by --threads threads
+ *   (one per cpu in the menu, 1 with --all since the jobs already use the
+ *   cpus): the file is mmap'd and cut into CHUNK_BYTES pieces at record
+ *   boundaries, each thread sorts its piece into its own year buckets, and
+ *   the pieces are merged per year in file order, so every YYYY.txt comes
+ *   out byte for byte the same as the one-thread split
+ *
+ *   picking the largest/smallest file is one getdents64 pass over the
+ *   folder with an fstatat per movies_*.csv (no path lookups from the
+ *   top), which finds both plus a size-sorted list of every candidate.
+ *   that list is kept between menu picks and only rebuilt once inotify
+ *   says a movies_*.csv was added, removed, renamed or written to
+ *
+ *   --by picks the splits made in the one read of the csv: year (the
+ *   YYYY.txt files, the default), language (by_language/English.txt, a
+ *   title goes in every language it lists) and rating (by_rating/7.txt
+ *   holds 7.0 up to 7.9). every split is a partition of buckets keyed by
+ *   the file name, and all of them share the same buffered writers and
+ *   the BUCKET_FLUSH_BYTES limit
+ *
+ *   with --uring the output files go through io_uring (raw syscalls, no
+ *   liburing) instead of open/write/fchmod/close one file at a time: the
+ *   opens of up to URING_BATCH files go in as one submit, then every
+ *   file's write with its close hard-linked behind it goes in as another,
+ *   and the flush returns without waiting so the kernel writes while the
+ *   next part of the csv is parsed. at most two batches of files are open
+ *   at once, and a tight open file limit (ulimit -n, shared by the --all
+ *   jobs) makes the batches smaller. the buffers are handed to the kernel
+ *   and freed when their writes complete. fchmod is skipped (on either
+ *   path) when the umask leaves 0640 alone anyway. if io_uring can't be
+ *   set up (old kernel, seccomp, io_uring_disabled) it quietly does it
+ *   the old way
+ *
+ *   nothing shows up as phamjac.movies.NNNNN half written: each split goes
+ *   into a mkdtemp'd .phamjac.staging.XXXXXX folder, then one syncfs gets
+ *   all of it on disk (an fdatasync per file if syncfs isn't there), then
+ *   one renameat2(RENAME_NOREPLACE) gives it its real name, and an fsync
+ *   of the current folder keeps the rename. a taken name just rolls a new
+ *   number, so two runs in the same second can't land in one folder.
+ *   --all syncs once for every file and publishes them all after.
+ *   --no-sync skips the syncing (scratch runs), the rename still happens.
+ *   a crash leaves only a .phamjac.staging.* folder behind. a split that
+ *   couldn't write all of its files (disk full, out of fds or memory) is
+ *   never published: its staging folder is removed, and --all counts it
+ *   as failed and exits non-zero
+ *
+ *   --input PATH skips the menu and splits one csv from anywhere: a file,
+ *   a fifo, or stdin with "-" (zcat movies.csv.gz | ./file_search
+ *   --input -). the csv is read in STREAM_BLOCK_BYTES reads and split as
+ *   it comes, a record cut off at the end of a block just waits at the
+ *   front for the next read, so memory stays at the block plus the
+ *   buckets however long the input is. the throughput is printed at the
+ *   end. the menu's files go through the same reader
+ *
  * Compile:                                      
- gcc --std=gnu99 -Wall -o file_search phamjac_assignment3.c
+ gcc --std=gnu99 -Wall -pthread -o file_search phamjac_assignment3.c
  *
  * Run:                                          
  ./file_search
+ ./file_search --all --jobs 8    (split every movies_*.csv here, 8 at a time)
+ ./file_search --threads 16      (menu, big files split on 16 threads)
+ ./file_search --by year,language,rating   (all three splits from one read)
+ ./file_search --all --uring     (write the year files through io_uring)
+ ./file_search --all --no-sync   (scratch run, don't wait for the disk)
+ zcat movies.csv.gz | ./file_search --input -   (no temp file, stats at the end)
  *************************************************/
 
 /*
@@ -38,29 +110,315 @@ https://canvas.oregonstate.edu/courses/1999732/pages/exploration-stdin-stdout-st
  #include <sys/stat.h>   // for file metadata and mkdir
  #include <unistd.h>     // for access and other posix stuff
  #include <fcntl.h>      // for file flags like O_CREAT
+ #include <errno.h>      // for EINTR
+ #include <limits.h>     // for INT_MIN/INT_MAX (the year check)
  #include <time.h>       // for time-related stuff like seeding rand
+ #include <pthread.h>    // for the --all worker pool
+ #include <sys/resource.h> // for the open file limit
+ #include <sys/mman.h>   // for mmap (the --threads split)
+ #include <sys/syscall.h> // for SYS_getdents64
+ #include <sys/inotify.h> // for noticing when the folder changes
+ #include <stdint.h>     // for the getdents64 record fields
+ #include <linux/io_uring.h> // for the --uring rings, sqes and opcodes
+ #include "../common/csv_tokenizer.h" // shared csv splitter (handles quoted titles)
  
  #define PREFIX "movies_"          // files should start with this
  #define EXT ".csv"               // files should end with this
- #define MAX_LINE_LEN 1024         // max size of one line in csv
  #define MAX_FILENAME_LEN 256      // max length of file name
  #define ONID "phamjac"           // my id
+ #define BUCKET_FLUSH_BYTES (64 * 1024 * 1024) // titles held in memory before the year files get written early
+ #define MAX_JOBS 64               // most files --all splits at once
+ #define FDS_PER_JOB 4             // a job holds the csv, a year file and a spare or two open
+ #define MAX_SPLIT_THREADS 64      // most threads one csv gets split on
+ #define PARALLEL_MIN_BYTES (32 * 1024 * 1024) // smaller files aren't worth the threads
+ #define CHUNK_BYTES (8 * 1024 * 1024) // one thread's piece of the csv per round
+ #define STREAM_BLOCK_BYTES (1024 * 1024) // one read() of the csv
+ #define DIRENT_BUFFER_BYTES (64 * 1024) // directory entries per getdents64 call
+ #define MAX_KEY_LEN 64            // longest bucket key (file name without .txt)
+ #define MAX_LANGUAGES 5           // languages looked at per movie, same as prog2
+ #define URING_ENTRIES 256         // submission queue size (the completion queue is twice that)
+ #define URING_BATCH (URING_ENTRIES / 2) // files per submit: a write + a close each
+ #define FILE_MODE 0640            // every output file
+ #define DIR_MODE 0750             // every output folder
+ #define STAGING_TEMPLATE "." ONID ".staging.XXXXXX" // hidden until it's published
+ #ifndef RENAME_NOREPLACE
+ #define RENAME_NOREPLACE (1 << 0) // renameat2 flag, not every libc has it
+ #endif
+ 
+ // the ways the titles can be split, each into its own folder under the output folder
+ typedef enum partition_kind
+ {
+     PART_YEAR,         // YYYY.txt straight in the folder, what the assignment asks for
+     PART_LANGUAGE,     // by_language/English.txt
+     PART_RATING,       // by_rating/7.txt for 7.0 up to 7.9
+     PART_KIND_COUNT
+ } partition_kind_t;
+ 
+ static const char * const partition_names[PART_KIND_COUNT] = { "year", "language", "rating" }; // what --by takes
+ static const char * const partition_subdirs[PART_KIND_COUNT] = { "", "by_language", "by_rating" };
+ 
+ // titles for one output file, held until they can go out in one write
+ typedef struct title_bucket
+ {
+     char key[MAX_KEY_LEN]; // the file name without .txt: "2008", "English", "7"
+     size_t key_len;
+     char * p_data;     // "title\n" after "title\n", file order
+     size_t used;
+     size_t capacity;
+     int is_created;    // the file already exists with its permissions set
+ } title_bucket_t;
+ 
+ // one split: every key seen so far, kept sorted so finding one is a binary search
+ typedef struct partition
+ {
+     partition_kind_t kind;
+     title_bucket_t * p_buckets;
+     int count;
+     int capacity;
+     int is_dir_created; // its by_* folder is made (the year one never needs it)
+ } partition_t;
+ 
+ // one output file the kernel is working on for --uring
+ typedef struct uring_file
+ {
+     char path[400];
+     char * p_data;     // the bucket's buffer, ours to free once the write is done
+     size_t length;
+     int fd;
+ } uring_file_t;
+ 
+ // a raw io_uring: the kernel's rings mapped in, plus the files still in flight
+ typedef struct uring_writer
+ {
+     int ring_fd;
+     void * p_sq_ring;
+     size_t sq_ring_size;
+     void * p_cq_ring;  // the same mapping as p_sq_ring on kernels with IORING_FEAT_SINGLE_MMAP
+     size_t cq_ring_size;
+     struct io_uring_sqe * p_sqes;
+     size_t sqes_size;
+     unsigned int * p_sq_head;
+     unsigned int * p_sq_tail;
+     unsigned int * p_sq_mask;
+     unsigned int * p_sq_array;
+     unsigned int * p_cq_head;
+     unsigned int * p_cq_tail;
+     unsigned int * p_cq_mask;
+     struct io_uring_cqe * p_cqes;
+     unsigned int queued;       // sqes filled in but not submitted yet
+     int in_flight;             // completions still coming
+     int open_files;            // fds the ring opened that haven't been closed yet
+     int has_failed;            // an open or a write didn't make it, sticky until the writer closes
+     uring_file_t * p_files;    // this flush's files, until every completion is in
+     int file_count;
+     int file_capacity;
+ } uring_writer_t;
+ 
+ // the splits one read of the csv feeds
+ typedef struct partition_set
+ {
+     partition_t parts[PART_KIND_COUNT];
+     int part_count;
+     size_t buffered;   // bytes waiting across every bucket of every split
+     uring_writer_t * p_uring; // --uring and it worked, NULL: plain write()
+     int is_missing_titles; // a title didn't fit in memory, so the split's incomplete
+ } partition_set_t;
+ 
+ // what splitting one csv got through, for the progress lines
+ typedef struct partition_stats
+ {
+     long long rows;    // titles written out
+     long long bytes;   // csv bytes read
+ } partition_stats_t;
+ 
+ // one split thread's piece of the csv and the titles it sorted out of it
+ typedef struct split_chunk
+ {
+     const char * p_begin;     // first byte of the first record
+     const char * p_end;       // one past the last record's newline
+     partition_set_t buckets;  // this piece's titles by key, file order
+     long long rows;
+ } split_chunk_t;
+ 
+ // one record out of getdents64 (glibc doesn't declare it)
+ typedef struct dirent64_record
+ {
+     uint64_t d_ino;
+     int64_t d_off;
+     unsigned short d_reclen; // bytes to the next record
+     unsigned char d_type;
+     char d_name[];
+ } dirent64_record_t;
+ 
+ // one movies_*.csv the scan found
+ typedef struct movie_candidate
+ {
+     size_t name_offset; // into the cache's name pool
+     off_t size;
+     int order;          // where it was in the folder, so ties sort the way readdir saw them
+ } movie_candidate_t;
+ 
+ // what the last folder scan found, reused until inotify says it's stale
+ typedef struct candidate_cache
+ {
+     movie_candidate_t * p_list; // smallest first
+     int count;
+     int capacity;
+     char * p_names;     // every name, '\0' after each
+     size_t names_used;
+     size_t names_capacity;
+     int has_files;
+     size_t largest_name; // first biggest file in folder order, same pick as before
+     size_t smallest_name;
+     int is_valid;       // p_list matches the folder
+     int is_watching;    // inotify got set up (tried once)
+     int inotify_fd;     // -1: no inotify, so scan every time
+ } candidate_cache_t;
+ 
+ // --all: the files to split and the totals so far, shared by the workers
+ typedef struct batch_run
+ {
+     pthread_mutex_t lock;  // guards everything below pp_staged
+     char ** pp_files;
+     char ** pp_staged;     // each file's staging folder once it's split, NULL if it failed
+     int file_count;
+     int next_file;         // next one a worker should take
+     int done_count;
+     int failed_count;
+     long long rows;
+     long long bytes;
+ } batch_run_t;
  
  // function declarations up top so compiler knows about them
  char * find_largest_file (void);            
  char * find_smallest_file (void);           
  char * prompt_for_filename (void);          
+ candidate_cache_t * get_movie_candidates (void); // the scan, redone only if the folder changed
+ int scan_movie_files (candidate_cache_t * p_cache); // getdents64 + fstatat, one pass
+ int add_candidate (candidate_cache_t * p_cache, const char * p_name, off_t size);
+ int candidates_changed (candidate_cache_t * p_cache); // drains inotify, 1 if a movies_*.csv changed
+ int compare_candidates (const void * p_left, const void * p_right);
+ void free_movie_candidates (void);
  void process_file (const char * p_filename); // does all the work for a file
- char * create_directory (void);             
- void write_movies_by_year (const char * p_filename, const char * p_dirname); // splits movie titles by year
+ char * create_directory (void);                  // the staging folder
+ char * publish_directory (const char * p_staging); // renames it to a free phamjac.movies.NNNNN
+ void discard_directory (const char * p_staging);  // a split that failed, the folder and whatever got written
+ int sync_staged (char ** pp_dirs, int count);     // everything in them on disk
+ void sync_current_directory (void);               // the renames on disk
+ void seed_random (void);
+ int write_movies_by_year (const char * p_filename, const char * p_dirname, partition_stats_t * p_stats); // splits movie titles by year
+ int write_movies_from_fd (int fd, const char * p_dirname, partition_stats_t * p_stats); // same, streamed from a file/pipe/fifo
+ int process_input (const char * p_path);           // --input
+ void init_partitions (partition_set_t * p_set); // the splits --by asked for, empty
+ int partition_movie_record (partition_set_t * p_set, const char * p_line, size_t line_len); // one record into every split
+ title_bucket_t * get_bucket (partition_t * p_part, const char * p_key, size_t key_len); // finds (or adds) a key's bucket
+ int reserve_bucket (title_bucket_t * p_bucket, size_t extra);            // room for extra more bytes
+ int add_title_to_bucket (partition_set_t * p_set, title_bucket_t * p_bucket, const csv_field_t * p_title);
+ int append_to_bucket (partition_set_t * p_set, title_bucket_t * p_bucket, const char * p_data, size_t length);
+ int write_movies_by_year_parallel (const char * p_filename, const char * p_dirname, int thread_count, partition_stats_t * p_stats);
+ void * split_chunk_worker (void * p_arg);          // one --threads thread
+ int flush_bucket (const char * p_dirname, partition_t * p_part, title_bucket_t * p_bucket); // one open/write/close for the file
+ int flush_partitions (const char * p_dirname, partition_set_t * p_set); // every bucket of every split, -1 if any failed
+ int free_partitions (partition_set_t * p_set);    // -1 if a --uring write still going failed
+ int parse_partition_list (const char * p_list);   // --by year,language,rating
+ int bucket_path (const char * p_dirname, partition_t * p_part, const title_bucket_t * p_bucket, char * p_path, size_t path_size);
+ uring_writer_t * uring_open (void);               // NULL if io_uring isn't there
+ int uring_close (uring_writer_t * p_uring);       // waits for what's in flight first, -1 if anything failed
+ int uring_flush_partitions (uring_writer_t * p_uring, const char * p_dirname, partition_set_t * p_set);
+ struct io_uring_sqe * uring_get_sqe (uring_writer_t * p_uring);
+ int uring_submit (uring_writer_t * p_uring, unsigned int wait_for);
+ void uring_reap (uring_writer_t * p_uring, int * p_opens_left);
+ void fit_uring_batch (int job_count);             // --uring batch size the open file limit leaves room for
+ int process_all_files (int job_count);            // --all
+ char ** list_movie_files (int * p_count);         // every movies_*.csv here
+ void * batch_worker (void * p_arg);               // one --all pool thread
+ double now_seconds (void);
+ 
+ static int g_split_threads = 1; // --threads, set once in main before anything runs
+ static unsigned int g_partition_mask = 1u << PART_YEAR; // --by, same deal
+ static int g_use_uring = 0;       // --uring
+ static int g_uring_batch = URING_BATCH; // files per --uring submit, set by fit_uring_batch before anything runs
+ static int g_umask_keeps_mode = 0; // the umask doesn't touch FILE_MODE, so open()'s mode is enough
+ static int g_skip_sync = 0;       // --no-sync
  
  // helper funcs
  int starts_with (const char * p_str, const char * p_prefix); // checks prefix
  int ends_with (const char * p_str, const char * p_suffix);   // checks suffix
  
- int main (void) 
+ int main (int argc, char ** pp_args) 
  {
      int main_choice = 0; // holds what the user picks from main menu
+     int is_all = 0;      // --all: no menu, split every file
+     int job_count = 0;   // --jobs, 0 = one per cpu
+     int thread_count = 0; // --threads, 0 = pick for the mode
+     const char * p_input = NULL; // --input, "-" for stdin
+ 
+     for (int arg = 1; arg < argc; arg++)
+     {
+         if (strcmp(pp_args[arg], "--all") == 0)
+         {
+             is_all = 1;
+         }
+         else if (strcmp(pp_args[arg], "--jobs") == 0 && arg + 1 < argc)
+         {
+             job_count = atoi(pp_args[++arg]);
+         }
+         else if (strcmp(pp_args[arg], "--threads") == 0 && arg + 1 < argc)
+         {
+             thread_count = atoi(pp_args[++arg]);
+         }
+         else if (strcmp(pp_args[arg], "--by") == 0 && arg + 1 < argc && parse_partition_list(pp_args[arg + 1]) == 0)
+         {
+             arg++;
+         }
+         else if (strcmp(pp_args[arg], "--uring") == 0)
+         {
+             g_use_uring = 1;
+         }
+         else if (strcmp(pp_args[arg], "--no-sync") == 0)
+         {
+             g_skip_sync = 1;
+         }
+         else if (strcmp(pp_args[arg], "--input") == 0 && arg + 1 < argc)
+         {
+             p_input = pp_args[++arg];
+         }
+         else
+         {
+             fprintf(stderr, "usage: %s [--all [--jobs N] | --input PATH|-] [--threads N] [--by year,language,rating] [--uring] [--no-sync]\n", pp_args[0]);
+             return EXIT_FAILURE;
+         }
+     }
+     if (is_all && NULL != p_input) // one or the other
+     {
+         fprintf(stderr, "%s: --all and --input don't go together\n", pp_args[0]);
+         return EXIT_FAILURE;
+     }
+ 
+     // --all already keeps the cpus busy with whole files, so one thread per file there
+     if (thread_count <= 0)
+     {
+         thread_count = is_all ? 1 : (int) sysconf(_SC_NPROCESSORS_ONLN);
+     }
+     g_split_threads = (thread_count < 1) ? 1 : ((thread_count > MAX_SPLIT_THREADS) ? MAX_SPLIT_THREADS : thread_count);
+ 
+     mode_t old_mask = umask(0); // umask can only be read by setting it
+     umask(old_mask);
+     g_umask_keeps_mode = (0 == (old_mask & FILE_MODE));
+ 
+     csv_pick_kernels(); // simd splitting if the cpu has it, picked once before any threads
+     fit_uring_batch(1); // --all does it again once it knows how many jobs there are
+ 
+     if (is_all)
+     {
+         int status = process_all_files(job_count);
+         free_movie_candidates();
+         return status;
+     }
+     if (NULL != p_input)
+     {
+         return process_input(p_input);
+     }
  
      while (1) // loop until break
      {
@@ -123,71 +481,226 @@ https://canvas.oregonstate.edu/courses/1999732/pages/exploration-stdin-stdout-st
          }
      }
  
+     free_movie_candidates();
      return EXIT_SUCCESS; // success return
  }
  
+ static candidate_cache_t g_candidates; // only the main thread touches it
+ 
  char * find_largest_file (void) // looks for biggest file
  {
-     DIR * p_dp = opendir("."); // open current folder
-     struct dirent * p_entry = NULL; // placeholder for files
-     struct stat file_stat; // holds size and info
-     off_t max_size = -1; // start low
-     char * p_max_file = NULL; // best file so far
+     candidate_cache_t * p_cache = get_movie_candidates(); // scans only if something changed
+     if (NULL == p_cache || !p_cache->has_files)
+     {
+         return NULL;
+     }
+     return strdup(p_cache->p_names + p_cache->largest_name); // caller frees it
+ }
  
-     if (NULL == p_dp) // failed to open
+ char * find_smallest_file (void) // same but smallest
+ {
+     candidate_cache_t * p_cache = get_movie_candidates();
+     if (NULL == p_cache || !p_cache->has_files)
      {
-         perror("Failed to open directory");
          return NULL;
      }
+     return strdup(p_cache->p_names + p_cache->smallest_name);
+ }
+ 
+ candidate_cache_t * get_movie_candidates (void) // the last scan, or a new one if the folder changed
+ {
+     candidate_cache_t * p_cache = &g_candidates;
+ 
+     if (!p_cache->is_watching) // first time: watch the folder before the first scan so nothing slips between
+     {
+         p_cache->is_watching = 1;
+         p_cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+         if (p_cache->inotify_fd >= 0
+             && inotify_add_watch(p_cache->inotify_fd, ".", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                  | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+         {
+             close(p_cache->inotify_fd); // no watch, no cache: scan every time like before
+             p_cache->inotify_fd = -1;
+         }
+     }
+ 
+     if (p_cache->is_valid && candidates_changed(p_cache))
+     {
+         p_cache->is_valid = 0;
+     }
+     if (!p_cache->is_valid)
+     {
+         if (p_cache->inotify_fd >= 0)
+         {
+             candidates_changed(p_cache); // what happened before this scan is in it anyway
+         }
+         if (scan_movie_files(p_cache) != 0)
+         {
+             return NULL;
+         }
+         p_cache->is_valid = (p_cache->inotify_fd >= 0); // changes during the scan show up next time
+     }
+ 
+     return p_cache;
+ }
+ 
+ int candidates_changed (candidate_cache_t * p_cache) // reads every waiting event, 1 if one was about a movies_*.csv
+ {
+     char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+     int is_changed = 0;
+     ssize_t length = 0;
+ 
+     if (p_cache->inotify_fd < 0)
+     {
+         return 1;
+     }
  
-     while ((p_entry = readdir(p_dp)) != NULL) // loop all files
+     while ((length = read(p_cache->inotify_fd, events, sizeof(events))) > 0)
      {
-         if (starts_with(p_entry->d_name, PREFIX) && ends_with(p_entry->d_name, EXT)) // only valid files
+         for (char * p_curr = events; p_curr < events + length; )
          {
-             stat(p_entry->d_name, &file_stat); // get file info
-             if (file_stat.st_size > max_size) // found a bigger one
+             const struct inotify_event * p_event = (const struct inotify_event *) p_curr;
+ 
+             // no name: the queue overflowed or the folder itself went away, assume the worst.
+             // our own phamjac.movies.* folders don't count
+             if (0 == p_event->len || (starts_with(p_event->name, PREFIX) && ends_with(p_event->name, EXT)))
              {
-                 free(p_max_file); // cleanup
-                 p_max_file = strdup(p_entry->d_name); // copy name
-                 max_size = file_stat.st_size; // update size
+                 is_changed = 1;
              }
+             p_curr += sizeof(struct inotify_event) + p_event->len;
          }
      }
  
-     closedir(p_dp); // done
-     return p_max_file; // return result
+     return is_changed;
  }
  
- char * find_smallest_file (void) // same but smallest
+ int scan_movie_files (candidate_cache_t * p_cache) // one getdents64 pass, sizes by fstatat on the folder fd
  {
-     DIR * p_dp = opendir(".");
-     struct dirent * p_entry = NULL;
-     struct stat file_stat;
-     off_t min_size = __LONG_MAX__; // start big
-     char * p_min_file = NULL;
- 
-     if (NULL == p_dp)
+     char entries[DIRENT_BUFFER_BYTES] __attribute__((aligned(8)));
+     int dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+     if (dir_fd < 0)
      {
          perror("Failed to open directory");
-         return NULL;
+         return -1;
      }
  
-     while ((p_entry = readdir(p_dp)) != NULL)
+     p_cache->count = 0;
+     p_cache->names_used = 0;
+     p_cache->has_files = 0;
+     off_t max_size = -1;
+     off_t min_size = 0;
+ 
+     long length = 0;
+     while ((length = syscall(SYS_getdents64, dir_fd, entries, sizeof(entries))) > 0)
      {
-         if (starts_with(p_entry->d_name, PREFIX) && ends_with(p_entry->d_name, EXT))
+         for (long offset = 0; offset < length; )
          {
-             stat(p_entry->d_name, &file_stat);
-             if (file_stat.st_size < min_size)
+             const dirent64_record_t * p_entry = (const dirent64_record_t *) (entries + offset);
+             offset += p_entry->d_reclen;
+ 
+             if (DT_DIR == p_entry->d_type || !starts_with(p_entry->d_name, PREFIX) || !ends_with(p_entry->d_name, EXT))
+             {
+                 continue;
+             }
+ 
+             struct stat file_stat; // follows links, same as stat() by name did
+             if (fstatat(dir_fd, p_entry->d_name, &file_stat, 0) != 0 || !S_ISREG(file_stat.st_mode))
+             {
+                 continue;
+             }
+ 
+             size_t name_offset = p_cache->names_used;
+             if (add_candidate(p_cache, p_entry->d_name, file_stat.st_size) != 0)
+             {
+                 fprintf(stderr, "Out of memory, not every file got looked at\n");
+                 break;
+             }
+ 
+             // strict < and >, so the first one seen wins a tie like the readdir loops did
+             if (!p_cache->has_files || file_stat.st_size > max_size)
+             {
+                 max_size = file_stat.st_size;
+                 p_cache->largest_name = name_offset;
+             }
+             if (!p_cache->has_files || file_stat.st_size < min_size)
              {
-                 free(p_min_file);
-                 p_min_file = strdup(p_entry->d_name);
                  min_size = file_stat.st_size;
+                 p_cache->smallest_name = name_offset;
              }
+             p_cache->has_files = 1;
          }
      }
+     if (length < 0)
+     {
+         perror("Failed to read directory");
+     }
+     close(dir_fd);
  
-     closedir(p_dp);
-     return p_min_file;
+     qsort(p_cache->p_list, p_cache->count, sizeof(movie_candidate_t), compare_candidates);
+     return 0;
+ }
+ 
+ int add_candidate (candidate_cache_t * p_cache, const char * p_name, off_t size) // name into the pool, entry on the list
+ {
+     size_t name_len = strlen(p_name) + 1;
+ 
+     if (p_cache->names_used + name_len > p_cache->names_capacity)
+     {
+         size_t new_capacity = (0 == p_cache->names_capacity) ? 4096 : p_cache->names_capacity * 2;
+         while (new_capacity < p_cache->names_used + name_len)
+         {
+             new_capacity *= 2;
+         }
+         char * p_grown = realloc(p_cache->p_names, new_capacity);
+         if (NULL == p_grown)
+         {
+             return -1;
+         }
+         p_cache->p_names = p_grown;
+         p_cache->names_capacity = new_capacity;
+     }
+     if (p_cache->count == p_cache->capacity)
+     {
+         int new_capacity = (0 == p_cache->capacity) ? 64 : p_cache->capacity * 2;
+         movie_candidate_t * p_grown = realloc(p_cache->p_list, new_capacity * sizeof(movie_candidate_t));
+         if (NULL == p_grown)
+         {
+             return -1;
+         }
+         p_cache->p_list = p_grown;
+         p_cache->capacity = new_capacity;
+     }
+ 
+     memcpy(p_cache->p_names + p_cache->names_used, p_name, name_len);
+     p_cache->p_list[p_cache->count].name_offset = p_cache->names_used;
+     p_cache->p_list[p_cache->count].size = size;
+     p_cache->p_list[p_cache->count].order = p_cache->count;
+     p_cache->count++;
+     p_cache->names_used += name_len;
+     return 0;
+ }
+ 
+ int compare_candidates (const void * p_left, const void * p_right) // by size, then folder order
+ {
+     const movie_candidate_t * p_a = p_left;
+     const movie_candidate_t * p_b = p_right;
+ 
+     if (p_a->size != p_b->size)
+     {
+         return (p_a->size < p_b->size) ? -1 : 1;
+     }
+     return p_a->order - p_b->order;
+ }
+ 
+ void free_movie_candidates (void) // cleanup at exit
+ {
+     free(g_candidates.p_list);
+     free(g_candidates.p_names);
+     if (g_candidates.inotify_fd >= 0 && g_candidates.is_watching)
+     {
+         close(g_candidates.inotify_fd);
+     }
+     memset(&g_candidates, 0, sizeof(g_candidates));
  }
  
  char * prompt_for_filename (void) // user types filename
@@ -215,20 +728,71 @@ https://canvas.oregonstate.edu/courses/1999732/pages/exploration-stdin-stdout-st
          return;
      }
  
-     char * p_dirname = create_directory(); // make folder
+     char * p_staging = create_directory(); // make folder (hidden for now)
+     if (NULL == p_staging)
+     {
+         return;
+     }
+ 
+     if (write_movies_by_year(p_filename, p_staging, NULL) != 0) // save files
+     {
+         discard_directory(p_staging); // half a split isn't published
+         free(p_staging);
+         return;
+     }
+ 
+     char * p_dirname = NULL;
+     if (0 == sync_staged(&p_staging, 1))
+     {
+         p_dirname = publish_directory(p_staging); // the one rename
+     }
+     else // written but maybe not on disk, so it's kept where it is rather than published
+     {
+         fprintf(stderr, "the titles are still in %s\n", p_staging);
+     }
      if (NULL != p_dirname)
      {
+         sync_current_directory();
          printf("Created directory with name %s\n", p_dirname);
-         write_movies_by_year(p_filename, p_dirname); // save files
-         free(p_dirname); // cleanup
-         p_dirname = NULL;
      }
+     free(p_dirname); // cleanup
+     free(p_staging);
+ }
+ 
+ void seed_random (void) // srand once per run, not once per folder
+ {
+     struct timespec now;
+     clock_gettime(CLOCK_REALTIME, &now);
+     srand((unsigned int) (now.tv_sec ^ now.tv_nsec ^ ((long) getpid() << 16))); // seed rng, two runs in one second still differ
+ }
+ 
+ char * create_directory (void) // makes the staging folder, a name nobody else can get
+ {
+     char * p_staging = strdup(STAGING_TEMPLATE);
+     if (NULL == p_staging)
+     {
+         fprintf(stderr, "Memory allocation failed\n");
+         return NULL;
+     }
+ 
+     if (NULL == mkdtemp(p_staging)) // XXXXXX filled in, made 0700
+     {
+         perror("Failed to create directory");
+         free(p_staging);
+         return NULL;
+     }
+     chmod(p_staging, DIR_MODE); // set perms
+     return p_staging;
  }
  
- char * create_directory (void) // makes new folder
+ // the staging folder gets its real name in one rename. renameat2 with RENAME_NOREPLACE fails on a
+ // taken name instead of replacing it; where that flag isn't supported the name is claimed with
+ // mkdir first and the rename replaces that empty folder, which rename does atomically too
+ char * publish_directory (const char * p_staging)
  {
-     srand(time(NULL)); // seed rng
-     int rand_val = rand() % 100000; // random id
+     static pthread_once_t seed_once = PTHREAD_ONCE_INIT;
+     static pthread_mutex_t rand_lock = PTHREAD_MUTEX_INITIALIZER; // rand() isn't promised to be thread safe
+     pthread_once(&seed_once, seed_random);
  
      char * p_dirname = calloc(100, sizeof(char)); // space for name
      if (NULL == p_dirname)
@@ -237,51 +801,1521 @@ https://canvas.oregonstate.edu/courses/1999732/pages/exploration-stdin-stdout-st
          return NULL;
      }
  
-     sprintf(p_dirname, "%s.movies.%d", ONID, rand_val); // name it
-     mkdir(p_dirname, 0750); // make it
-     chmod(p_dirname, 0750); // set perms
+     // a name that's already taken (another job, or an earlier run) just means roll again
+     for (int attempt = 0; attempt < 100; attempt++)
+     {
+         pthread_mutex_lock(&rand_lock);
+         int rand_val = rand() % 100000; // random id
+         pthread_mutex_unlock(&rand_lock);
+ 
+         sprintf(p_dirname, "%s.movies.%d", ONID, rand_val); // name it
+         if (0 == syscall(SYS_renameat2, AT_FDCWD, p_staging, AT_FDCWD, p_dirname, RENAME_NOREPLACE))
+         {
+             return p_dirname; // done
+         }
+ 
+         if (EINVAL == errno || ENOSYS == errno) // no RENAME_NOREPLACE here
+         {
+             if (0 == mkdir(p_dirname, DIR_MODE))
+             {
+                 if (0 == rename(p_staging, p_dirname))
+                 {
+                     return p_dirname;
+                 }
+                 rmdir(p_dirname);
+                 break;
+             }
+         }
+         if (EEXIST != errno && ENOTEMPTY != errno)
+         {
+             break;
+         }
+     }
  
-     return p_dirname; // done
+     perror("Failed to publish directory");
+     fprintf(stderr, "the titles are still in %s\n", p_staging);
+     free(p_dirname);
+     return NULL;
  }
  
- void write_movies_by_year (const char * p_filename, const char * p_dirname) // splits into files by year
+ static int remove_tree (const char * p_path) // every file under p_path, then the folders
  {
-     if (NULL == p_filename || NULL == p_dirname) // bad input
+     DIR * p_dp = opendir(p_path);
+     struct dirent * p_entry = NULL;
+     int result = 0;
+ 
+     if (NULL == p_dp)
      {
-         return;
+         return -1;
      }
  
-     FILE * p_fp = fopen(p_filename, "r"); // open csv
-     if (NULL == p_fp)
+     while ((p_entry = readdir(p_dp)) != NULL) // the files, and the by_* folders one level down
      {
-         perror("Error opening file");
-         return;
+         if (0 == strcmp(p_entry->d_name, ".") || 0 == strcmp(p_entry->d_name, ".."))
+         {
+             continue;
+         }
+ 
+         char path[400];
+         snprintf(path, sizeof(path), "%s/%s", p_path, p_entry->d_name);
+         struct stat entry_stat; // some filesystems don't fill in d_type
+         if (DT_DIR == p_entry->d_type
+             || (DT_UNKNOWN == p_entry->d_type && 0 == lstat(path, &entry_stat) && S_ISDIR(entry_stat.st_mode)))
+         {
+             result |= remove_tree(path);
+         }
+         else if (unlink(path) != 0)
+         {
+             result = -1;
+         }
+     }
+     closedir(p_dp);
+ 
+     return (0 == rmdir(p_path)) ? result : -1;
+ }
+ 
+ void discard_directory (const char * p_staging) // rmdir alone fails quietly once a file got written
+ {
+     if (remove_tree(p_staging) != 0)
+     {
+         perror(p_staging);
+         fprintf(stderr, "the partial split is still in %s\n", p_staging);
+     }
+ }
+ 
+ static int sync_tree (const char * p_path) // fdatasync every file under p_path, then fsync the folders
+ {
+     DIR * p_dp = opendir(p_path);
+     struct dirent * p_entry = NULL;
+     int result = 0;
+ 
+     if (NULL == p_dp)
+     {
+         perror(p_path);
+         return -1;
+     }
+ 
+     while ((p_entry = readdir(p_dp)) != NULL) // the files, and the by_* folders one level down
+     {
+         if (0 == strcmp(p_entry->d_name, ".") || 0 == strcmp(p_entry->d_name, ".."))
+         {
+             continue;
+         }
+ 
+         char path[400];
+         snprintf(path, sizeof(path), "%s/%s", p_path, p_entry->d_name);
+         struct stat entry_stat; // some filesystems don't fill in d_type
+         if (DT_DIR == p_entry->d_type
+             || (DT_UNKNOWN == p_entry->d_type && 0 == stat(path, &entry_stat) && S_ISDIR(entry_stat.st_mode)))
+         {
+             result |= sync_tree(path);
+             continue;
+         }
+ 
+         int fd = open(path, O_RDONLY | O_CLOEXEC);
+         if (fd < 0 || fdatasync(fd) != 0)
+         {
+             perror(path);
+             result = -1;
+         }
+         if (fd >= 0)
+         {
+             close(fd);
+         }
      }
+     closedir(p_dp);
  
-     char line[MAX_LINE_LEN]; // to read each line
-     fgets(line, MAX_LINE_LEN, p_fp); // skip header
+     int dir_fd = open(p_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC); // the entries themselves
+     if (dir_fd >= 0)
+     {
+         fsync(dir_fd);
+         close(dir_fd);
+     }
+     return result;
+ }
  
-     while (fgets(line, MAX_LINE_LEN, p_fp)) // read next
+ // everything written under the staging folders on disk. one syncfs does the whole filesystem at once
+ // (they're all in the current folder), instead of a sync per file; without syncfs it's an fdatasync
+ // pass over every file, still one at the end rather than one per write. 0 if it worked or --no-sync
+ int sync_staged (char ** pp_dirs, int count)
+ {
+     if (g_skip_sync || count <= 0)
      {
-         char * p_saveptr = NULL; // for strtok_r
-         char * p_title = strtok_r(line, ",", &p_saveptr); // get title
-         int year = atoi(strtok_r(NULL, ",", &p_saveptr)); // get year
-         strtok_r(NULL, ",", &p_saveptr); // skip lang
-         strtok_r(NULL, ",\n", &p_saveptr); // skip rating
+         return 0;
+     }
  
-         char path[300]; // file path buffer
-         sprintf(path, "%s/%d.txt", p_dirname, year); // make path
+     int fd = open(pp_dirs[0], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+     if (fd >= 0 && 0 == syscall(SYS_syncfs, fd))
+     {
+         close(fd);
+         return 0;
+     }
+     if (fd >= 0)
+     {
+         close(fd);
+     }
  
-         FILE * p_out = fopen(path, "a"); // open year file
-         if (NULL != p_out)
+     for (int index = 0; index < count; index++)
+     {
+         if (NULL != pp_dirs[index] && sync_tree(pp_dirs[index]) != 0)
          {
-             fprintf(p_out, "%s\n", p_title); // write title
-             fclose(p_out); // close file
-             chmod(path, 0640); // set perms
+             return -1;
          }
      }
+     return 0;
+ }
+ 
+ void sync_current_directory (void) // the folder entries the renames changed
+ {
+     if (g_skip_sync)
+     {
+         return;
+     }
+ 
+     int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+     if (fd >= 0)
+     {
+         fsync(fd);
+         close(fd);
+     }
+ }
+ 
+ int write_movies_by_year (const char * p_filename, const char * p_dirname, partition_stats_t * p_stats) // splits into files by year (and whatever --by adds), -1 if the csv won't open or a file came out short
+ {
+     if (NULL == p_filename || NULL == p_dirname) // bad input
+     {
+         return -1;
+     }
  
-     fclose(p_fp); // all done
+     int fd = open(p_filename, O_RDONLY | O_CLOEXEC); // open csv
+     if (fd < 0)
+     {
+         perror("Error opening file");
+         return -1;
+     }
+ 
+     // big enough to be worth cutting up: the threaded split, unless the file can't be mapped.
+     // a fifo says size 0, so it always streams
+     struct stat file_stat;
+     if (g_split_threads > 1 && 0 == fstat(fd, &file_stat) && S_ISREG(file_stat.st_mode)
+         && file_stat.st_size >= PARALLEL_MIN_BYTES)
+     {
+         int result = write_movies_by_year_parallel(p_filename, p_dirname, g_split_threads, p_stats);
+         if (result <= 0)
+         {
+             close(fd);
+             return result;
+         }
+     }
+ 
+     int result = write_movies_from_fd(fd, p_dirname, p_stats);
+     close(fd); // all done
+     return result;
+ }
+ 
+ // the one-thread split, reading fd in STREAM_BLOCK_BYTES blocks. records are cut straight out of
+ // the block; the one cut off at the end moves to the front and the next read goes in after it, so
+ // memory is the block (grown only for a record longer than it) plus the buckets. -1 if it couldn't
+ // get its block, the read failed or a file didn't get all its titles
+ int write_movies_from_fd (int fd, const char * p_dirname, partition_stats_t * p_stats)
+ {
+     size_t capacity = STREAM_BLOCK_BYTES;
+     char * p_block = malloc(capacity);
+     if (NULL == p_block)
+     {
+         fprintf(stderr, "Memory allocation failed\n");
+         return -1;
+     }
+ 
+     partition_stats_t stats = { 0, 0 }; // counted either way, handed back if asked for
+     partition_set_t buckets; // titles per key until they're written
+     init_partitions(&buckets);
+     buckets.p_uring = g_use_uring ? uring_open() : NULL;
+ 
+     size_t kept = 0;     // start of a record the last read cut off
+     int is_header = 1;   // skip header
+     int is_eof = 0;
+     int result = 0;
+ 
+     while (!is_eof)
+     {
+         if (kept == capacity) // one record bigger than the whole block
+         {
+             char * p_grown = realloc(p_block, capacity * 2);
+             if (NULL == p_grown)
+             {
+                 fprintf(stderr, "Memory allocation failed\n");
+                 result = -1;
+                 break;
+             }
+             p_block = p_grown;
+             capacity *= 2;
+         }
+ 
+         ssize_t count = read(fd, p_block + kept, capacity - kept); // read next
+         if (count < 0)
+         {
+             if (EINTR == errno)
+             {
+                 continue;
+             }
+             perror("Error reading file");
+             result = -1;
+             break;
+         }
+         is_eof = (0 == count);
+         stats.bytes += count;
+ 
+         const char * p_curr = p_block;
+         const char * p_end = p_block + kept + count;
+         while (p_curr < p_end)
+         {
+             int in_quotes = 0; // p_curr is always a record start
+             const char * p_line_end = csv_record_end(p_curr, p_end, &in_quotes);
+             if (p_line_end == p_end && !is_eof) // no newline yet, the rest is in the next read
+             {
+                 break;
+             }
+ 
+             if (is_header)
+             {
+                 is_header = 0;
+             }
+             else if (0 == partition_movie_record(&buckets, p_curr, (size_t) (p_line_end - p_curr))) // need title + year
+             {
+                 stats.rows++;
+                 if (buckets.buffered > BUCKET_FLUSH_BYTES && flush_partitions(p_dirname, &buckets) != 0) // too much held, write it all out now
+                 {
+                     result = -1;
+                     break;
+                 }
+             }
+             p_curr = (p_line_end == p_end) ? p_end : p_line_end + 1; // past the newline
+         }
+         if (0 != result) // the split's no good now, no point reading the rest
+         {
+             break;
+         }
+ 
+         kept = (size_t) (p_end - p_curr);
+         memmove(p_block, p_curr, kept);
+     }
+ 
+     if (0 == result && flush_partitions(p_dirname, &buckets) != 0) // the one write per file
+     {
+         result = -1;
+     }
+     if (free_partitions(&buckets) != 0)
+     {
+         result = -1;
+     }
+     free(p_block);
+ 
+     if (NULL != p_stats)
+     {
+         *p_stats = stats;
+     }
+     return result;
+ }
+ 
+ int process_input (const char * p_path) // --input: one csv from a path, a fifo or stdin, no menu
+ {
+     int is_stdin = (0 == strcmp(p_path, "-"));
+     const char * p_name = is_stdin ? "stdin" : p_path;
+ 
+     char * p_staging = create_directory(); // make folder (hidden for now)
+     if (NULL == p_staging)
+     {
+         return EXIT_FAILURE;
+     }
+ 
+     partition_stats_t stats = { 0, 0 };
+     double start = now_seconds();
+     int result = is_stdin ? write_movies_from_fd(STDIN_FILENO, p_staging, &stats)
+                           : write_movies_by_year(p_path, p_staging, &stats);
+ 
+     char * p_dirname = NULL;
+     if (0 == result && 0 == sync_staged(&p_staging, 1))
+     {
+         p_dirname = publish_directory(p_staging); // the one rename
+     }
+     else if (0 != result)
+     {
+         discard_directory(p_staging); // half a split isn't published
+     }
+     else // the sync failed, same as the menu
+     {
+         fprintf(stderr, "the titles are still in %s\n", p_staging);
+     }
+     double elapsed = now_seconds() - start;
+ 
+     if (NULL != p_dirname)
+     {
+         sync_current_directory();
+         printf("%s -> %s: %lld movies, %.1f MB in %.2f s (%.1f MB/s, %.0f movies/s)\n", p_name, p_dirname,
+                stats.rows, stats.bytes / 1e6, elapsed, (elapsed > 0) ? stats.bytes / 1e6 / elapsed : 0.0,
+                (elapsed > 0) ? stats.rows / elapsed : 0.0);
+     }
+     free(p_dirname);
+     free(p_staging);
+     return (NULL != p_dirname) ? EXIT_SUCCESS : EXIT_FAILURE;
+ }
+ 
+ void init_partitions (partition_set_t * p_set) // one empty partition per split in g_partition_mask
+ {
+     memset(p_set, 0, sizeof(*p_set));
+     for (int kind = 0; kind < PART_KIND_COUNT; kind++)
+     {
+         if (g_partition_mask & (1u << kind))
+         {
+             p_set->parts[p_set->part_count++].kind = (partition_kind_t) kind;
+         }
+     }
+ }
+ 
+ int parse_partition_list (const char * p_list) // "year,language" -> g_partition_mask, -1 on a name it doesn't know
+ {
+     unsigned int mask = 0;
+     const char * p_curr = p_list;
+ 
+     while ('\0' != *p_curr)
+     {
+         size_t name_len = strcspn(p_curr, ",");
+         int kind = 0;
+         for (; kind < PART_KIND_COUNT; kind++)
+         {
+             if (strlen(partition_names[kind]) == name_len && 0 == strncmp(p_curr, partition_names[kind], name_len))
+             {
+                 break;
+             }
+         }
+         if (PART_KIND_COUNT == kind)
+         {
+             fprintf(stderr, "--by: don't know how to split by \"%.*s\"\n", (int) name_len, p_curr);
+             return -1;
+         }
+         mask |= 1u << kind;
+         p_curr += name_len + (',' == p_curr[name_len]);
+     }
+ 
+     if (0 == mask)
+     {
+         return -1;
+     }
+     g_partition_mask = mask;
+     return 0;
+ }
+ 
+ // a number field has to be all number: only trailing spaces (or the '\r' of a crlf file) after it
+ static int is_number_end (const char * p_after, const char * p_field)
+ {
+     while (' ' == *p_after || '\t' == *p_after || '\r' == *p_after)
+     {
+         p_after++;
+     }
+     return (p_after != p_field && '\0' == *p_after);
+ }
+ 
+ // a key has to be a safe file name: no '/', doesn't start with '.', fits in MAX_KEY_LEN
+ static int is_usable_key (const char * p_key, size_t key_len)
+ {
+     return key_len > 0 && key_len < MAX_KEY_LEN && '.' != p_key[0] && NULL == memchr(p_key, '/', key_len);
+ }
+ 
+ // same text as "%d", without snprintf's cost on every row
+ static size_t format_int_key (char * p_out, int value)
+ {
+     char digits[12];
+     size_t count = 0;
+     unsigned int magnitude = (value < 0) ? 0u - (unsigned int) value : (unsigned int) value;
+ 
+     do
+     {
+         digits[count++] = (char) ('0' + magnitude % 10);
+         magnitude /= 10;
+     } while (magnitude > 0);
+ 
+     size_t length = 0;
+     if (value < 0)
+     {
+         p_out[length++] = '-';
+     }
+     while (count > 0)
+     {
+         p_out[length++] = digits[--count];
+     }
+     return length;
+ }
+ 
+ // one record into every split. the title gets unescaped once, into the first bucket
+ // that takes it, and copied from there into the rest. -1 if the title is empty or the year isn't a number
+ int partition_movie_record (partition_set_t * p_set, const char * p_line, size_t line_len)
+ {
+     csv_field_t fields[4]; // title, year, lang, rating
+     int field_count = csv_split_record(p_line, line_len, fields, 4);
+     if (field_count < 2 || 0 == fields[0].length || fields[1].length >= 16) // need title + year
+     {
+         return -1;
+     }
+ 
+     char year_str[16] = {0}; // year needs a '\0' for strtol
+     memcpy(year_str, fields[1].p_data, fields[1].length);
+     char * p_year_end = NULL;
+     long year = strtol(year_str, &p_year_end, 10);
+     if (!is_number_end(p_year_end, year_str) || year < INT_MIN || year > INT_MAX) // "", "abc", "2004x"
+     {
+         return -1;
+     }
+ 
+     const char * p_title = NULL; // the unescaped copy in the first bucket, once there is one
+     size_t title_len = 0;
+ 
+     for (int index = 0; index < p_set->part_count; index++)
+     {
+         partition_t * p_part = &p_set->parts[index];
+         char keys[MAX_LANGUAGES][MAX_KEY_LEN]; // a movie can land in more than one bucket (languages)
+         size_t key_lens[MAX_LANGUAGES];
+         int key_count = 0;
+ 
+         if (PART_YEAR == p_part->kind)
+         {
+             key_lens[0] = format_int_key(keys[0], (int) year); // get year
+             key_count = 1;
+         }
+         else if (PART_LANGUAGE == p_part->kind && field_count > 2)
+         {
+             // [English;French] -> English, French
+             const char * p_curr = fields[2].p_data;
+             const char * p_stop = p_curr + fields[2].length;
+             if (p_curr < p_stop && '[' == *p_curr)
+             {
+                 p_curr++;
+             }
+             if (p_stop > p_curr && ']' == p_stop[-1])
+             {
+                 p_stop--;
+             }
+ 
+             while (p_curr < p_stop && key_count < MAX_LANGUAGES)
+             {
+                 const char * p_semi = memchr(p_curr, ';', (size_t) (p_stop - p_curr));
+                 const char * p_lang_end = (NULL == p_semi) ? p_stop : p_semi;
+                 size_t lang_len = (size_t) (p_lang_end - p_curr);
+ 
+                 int is_repeat = 0; // [English;English] still goes in once
+                 for (int seen = 0; seen < key_count; seen++)
+                 {
+                     is_repeat |= (key_lens[seen] == lang_len && 0 == memcmp(keys[seen], p_curr, lang_len));
+                 }
+
+                 if (!is_repeat && is_usable_key(p_curr, lang_len))
+                 {
+                     memcpy(keys[key_count], p_curr, lang_len);
+                     key_lens[key_count++] = lang_len;
+                 }
+                 p_curr = p_lang_end + 1;
+             }
+         }
+         else if (PART_RATING == p_part->kind && field_count > 3 && fields[3].length > 0 && fields[3].length < 16)
+         {
+             char rating_str[16] = {0};
+             memcpy(rating_str, fields[3].p_data, fields[3].length);
+             char * p_rating_end = NULL;
+             double rating = strtod(rating_str, &p_rating_end);
+             // "abc" (no number at all), nan and junk like 1e300 fail this, no file gets named after them
+             if (is_number_end(p_rating_end, rating_str) && rating >= 0.0 && rating <= 10.0)
+             {
+                 key_lens[0] = format_int_key(keys[0], (int) (rating + 1e-9)); // 7.0 up to 7.9 -> 7
+                 key_count = 1;
+             }
+         }
+ 
+         for (int key = 0; key < key_count; key++)
+         {
+             title_bucket_t * p_bucket = get_bucket(p_part, keys[key], key_lens[key]); // where this key's titles wait
+             int result = -1;
+ 
+             if (NULL != p_bucket && NULL == p_title)
+             {
+                 size_t start = p_bucket->used;
+                 result = add_title_to_bucket(p_set, p_bucket, &fields[0]);
+                 if (0 == result) // the rest copy this one, it won't move until this bucket grows
+                 {
+                     p_title = p_bucket->p_data + start;
+                     title_len = p_bucket->used - start;
+                 }
+             }
+             else if (NULL != p_bucket)
+             {
+                 result = append_to_bucket(p_set, p_bucket, p_title, title_len);
+             }
+ 
+             if (0 != result)
+             {
+                 fprintf(stderr, "Out of memory, %.*s.txt would be missing titles\n", (int) key_lens[key], keys[key]);
+                 p_set->is_missing_titles = 1; // the flush reports it
+             }
+         }
+     }
+ 
+     return 0;
+ }
+ 
+ title_bucket_t * get_bucket (partition_t * p_part, const char * p_key, size_t key_len) // binary search, insert if it's new
+ {
+     int low = 0;
+     int high = p_part->count;
+ 
+     while (low < high) // find the first bucket with key >= this one (shorter keys first, so years sort like numbers)
+     {
+         int middle = (low + high) / 2;
+         const title_bucket_t * p_middle = &p_part->p_buckets[middle];
+         int order = (p_middle->key_len != key_len) ? ((p_middle->key_len < key_len) ? -1 : 1)
+                                                    : memcmp(p_middle->key, p_key, key_len);
+         if (order < 0)
+         {
+             low = middle + 1;
+         }
+         else
+         {
+             high = middle;
+         }
+     }
+ 
+     if (low < p_part->count && p_part->p_buckets[low].key_len == key_len
+         && 0 == memcmp(p_part->p_buckets[low].key, p_key, key_len)) // already have it
+     {
+         return &p_part->p_buckets[low];
+     }
+ 
+     if (p_part->count == p_part->capacity) // make room for one more key
+     {
+         int new_capacity = (0 == p_part->capacity) ? 64 : p_part->capacity * 2;
+         title_bucket_t * p_grown = realloc(p_part->p_buckets, new_capacity * sizeof(title_bucket_t));
+         if (NULL == p_grown)
+         {
+             return NULL;
+         }
+         p_part->p_buckets = p_grown;
+         p_part->capacity = new_capacity;
+     }
+ 
+     // shift the later keys up one and put the new bucket in its spot
+     memmove(&p_part->p_buckets[low + 1], &p_part->p_buckets[low], (p_part->count - low) * sizeof(title_bucket_t));
+     memset(&p_part->p_buckets[low], 0, sizeof(title_bucket_t));
+     memcpy(p_part->p_buckets[low].key, p_key, key_len);
+     p_part->p_buckets[low].key_len = key_len;
+     p_part->count++;
+ 
+     return &p_part->p_buckets[low];
+ }
+ 
+ int reserve_bucket (title_bucket_t * p_bucket, size_t extra) // room for extra more bytes, -1 if out of memory
+ {
+     if (p_bucket->used + extra > p_bucket->capacity) // double until it fits
+     {
+         size_t new_capacity = (0 == p_bucket->capacity) ? 4096 : p_bucket->capacity * 2;
+         while (new_capacity < p_bucket->used + extra)
+         {
+             new_capacity *= 2;
+         }
+ 
+         char * p_grown = realloc(p_bucket->p_data, new_capacity);
+         if (NULL == p_grown)
+         {
+             return -1;
+         }
+         p_bucket->p_data = p_grown;
+         p_bucket->capacity = new_capacity;
+     }
+     return 0;
+ }
+ 
+ int add_title_to_bucket (partition_set_t * p_set, title_bucket_t * p_bucket, const csv_field_t * p_title) // title + newline
+ {
+     if (reserve_bucket(p_bucket, p_title->length + 1) != 0)
+     {
+         return -1;
+     }
+ 
+     // "" -> " straight into the bucket, the record itself is left alone
+     char * p_out = p_bucket->p_data + p_bucket->used;
+     size_t title_len = p_title->has_escapes ? csv_unescape(p_title, p_out) : p_title->length;
+     if (!p_title->has_escapes)
+     {
+         memcpy(p_out, p_title->p_data, title_len);
+     }
+     p_out[title_len] = '\n';
+ 
+     p_bucket->used += title_len + 1;
+     p_set->buffered += title_len + 1;
+     return 0;
+ }
+ 
+ int append_to_bucket (partition_set_t * p_set, title_bucket_t * p_bucket, const char * p_data, size_t length) // bytes already in file form
+ {
+     if (reserve_bucket(p_bucket, length) != 0)
+     {
+         return -1;
+     }
+ 
+     memcpy(p_bucket->p_data + p_bucket->used, p_data, length);
+     p_bucket->used += length;
+     p_set->buffered += length;
+     return 0;
+ }
+ 
+ int flush_bucket (const char * p_dirname, partition_t * p_part, title_bucket_t * p_bucket) // writes what's buffered, -1 on failure
+ {
+     if (0 == p_bucket->used) // nothing new for this file
+     {
+         return 0;
+     }
+ 
+     char path[400]; // file path buffer
+     bucket_path(p_dirname, p_part, p_bucket, path, sizeof(path)); // make path
+ 
+     int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, FILE_MODE); // append like "a" did
+     if (fd < 0)
+     {
+         perror(path);
+         p_bucket->used = 0; // drop them, same as when fopen failed before
+         return -1;
+     }
+ 
+     if (!p_bucket->is_created) // permissions once per file, only if the umask got in the way
+     {
+         if (!g_umask_keeps_mode)
+         {
+             fchmod(fd, FILE_MODE);
+         }
+         p_bucket->is_created = 1;
+     }
+ 
+     size_t written = 0;
+     int result = 0;
+     while (written < p_bucket->used) // write can come up short, so loop
+     {
+         ssize_t count = write(fd, p_bucket->p_data + written, p_bucket->used - written);
+         if (count < 0)
+         {
+             if (EINTR == errno)
+             {
+                 continue;
+             }
+             perror(path);
+             result = -1;
+             break;
+         }
+         written += (size_t) count;
+     }
+ 
+     close(fd);
+     p_bucket->used = 0;
+     return result;
+ }
+ 
+ int flush_partitions (const char * p_dirname, partition_set_t * p_set) // every file of every split gets its write, -1 if one didn't
+ {
+     int result = p_set->is_missing_titles ? -1 : 0;
+     if (NULL != p_set->p_uring) // batched, and it doesn't wait for the writes (free_partitions says how those went)
+     {
+         result |= uring_flush_partitions(p_set->p_uring, p_dirname, p_set);
+         p_set->buffered = 0;
+         return result;
+     }
+ 
+     for (int index = 0; index < p_set->part_count; index++)
+     {
+         partition_t * p_part = &p_set->parts[index];
+         for (int slot = 0; slot < p_part->count; slot++)
+         {
+             if (flush_bucket(p_dirname, p_part, &p_part->p_buckets[slot]) != 0)
+             {
+                 result = -1;
+             }
+         }
+     }
+     p_set->buffered = 0;
+     return result;
+ }
+ 
+ int free_partitions (partition_set_t * p_set) // cleanup, -1 if one of the last --uring writes failed
+ {
+     int result = uring_close(p_set->p_uring); // lets the last writes finish
+     for (int index = 0; index < p_set->part_count; index++)
+     {
+         partition_t * p_part = &p_set->parts[index];
+         for (int slot = 0; slot < p_part->count; slot++)
+         {
+             free(p_part->p_buckets[slot].p_data);
+         }
+         free(p_part->p_buckets);
+     }
+     memset(p_set, 0, sizeof(*p_set));
+     return result;
+ }
+ 
+ int bucket_path (const char * p_dirname, partition_t * p_part, const title_bucket_t * p_bucket, char * p_path, size_t path_size) // where a bucket's file goes
+ {
+     const char * p_subdir = partition_subdirs[p_part->kind];
+     if ('\0' != p_subdir[0] && !p_part->is_dir_created) // by_* folder the first time, same perms as ours
+     {
+         snprintf(p_path, path_size, "%s/%s", p_dirname, p_subdir);
+         if (0 == mkdir(p_path, 0750) || EEXIST == errno)
+         {
+             chmod(p_path, 0750);
+         }
+         p_part->is_dir_created = 1;
+     }
+ 
+     if ('\0' == p_subdir[0])
+     {
+         return snprintf(p_path, path_size, "%s/%.*s.txt", p_dirname, (int) p_bucket->key_len, p_bucket->key);
+     }
+     return snprintf(p_path, path_size, "%s/%s/%.*s.txt", p_dirname, p_subdir, (int) p_bucket->key_len, p_bucket->key);
+ }
+ 
+ uring_writer_t * uring_open (void) // io_uring_setup + the three mmaps, NULL (and one note) if any of it fails
+ {
+     static int has_warned = 0;
+     struct io_uring_params params;
+     memset(&params, 0, sizeof(params));
+ 
+     uring_writer_t * p_uring = calloc(1, sizeof(uring_writer_t));
+     int ring_fd = (NULL == p_uring) ? -1 : (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+ 
+     // needs openat/close as ring ops and writes at the file position, both 5.6
+     if (ring_fd >= 0 && (params.features & IORING_FEAT_RW_CUR_POS))
+     {
+         p_uring->ring_fd = ring_fd;
+         p_uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+         p_uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+         if (params.features & IORING_FEAT_SINGLE_MMAP) // one mapping holds both rings
+         {
+             if (p_uring->cq_ring_size > p_uring->sq_ring_size)
+             {
+                 p_uring->sq_ring_size = p_uring->cq_ring_size;
+             }
+             p_uring->cq_ring_size = p_uring->sq_ring_size;
+         }
+ 
+         p_uring->p_sq_ring = mmap(NULL, p_uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                   ring_fd, IORING_OFF_SQ_RING);
+         p_uring->p_cq_ring = p_uring->p_sq_ring;
+         if (MAP_FAILED != p_uring->p_sq_ring && !(params.features & IORING_FEAT_SINGLE_MMAP))
+         {
+             p_uring->p_cq_ring = mmap(NULL, p_uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       ring_fd, IORING_OFF_CQ_RING);
+         }
+         p_uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+         p_uring->p_sqes = mmap(NULL, p_uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring_fd, IORING_OFF_SQES);
+ 
+         if (MAP_FAILED != p_uring->p_sq_ring && MAP_FAILED != p_uring->p_cq_ring && MAP_FAILED != (void *) p_uring->p_sqes)
+         {
+             char * p_sq = p_uring->p_sq_ring;
+             char * p_cq = p_uring->p_cq_ring;
+             p_uring->p_sq_head = (unsigned int *) (p_sq + params.sq_off.head);
+             p_uring->p_sq_tail = (unsigned int *) (p_sq + params.sq_off.tail);
+             p_uring->p_sq_mask = (unsigned int *) (p_sq + params.sq_off.ring_mask);
+             p_uring->p_sq_array = (unsigned int *) (p_sq + params.sq_off.array);
+             p_uring->p_cq_head = (unsigned int *) (p_cq + params.cq_off.head);
+             p_uring->p_cq_tail = (unsigned int *) (p_cq + params.cq_off.tail);
+             p_uring->p_cq_mask = (unsigned int *) (p_cq + params.cq_off.ring_mask);
+             p_uring->p_cqes = (struct io_uring_cqe *) (p_cq + params.cq_off.cqes);
+             return p_uring;
+         }
+ 
+         // half set up: undo whatever did map
+         if (MAP_FAILED != (void *) p_uring->p_sqes)
+         {
+             munmap(p_uring->p_sqes, p_uring->sqes_size);
+         }
+         if (MAP_FAILED != p_uring->p_cq_ring && p_uring->p_cq_ring != p_uring->p_sq_ring)
+         {
+             munmap(p_uring->p_cq_ring, p_uring->cq_ring_size);
+         }
+         if (MAP_FAILED != p_uring->p_sq_ring)
+         {
+             munmap(p_uring->p_sq_ring, p_uring->sq_ring_size);
+         }
+     }
+ 
+     if (ring_fd >= 0)
+     {
+         close(ring_fd);
+     }
+     free(p_uring);
+     if (0 == __atomic_exchange_n(&has_warned, 1, __ATOMIC_RELAXED)) // --all jobs each try, say it once
+     {
+         fprintf(stderr, "io_uring isn't available here, writing the files the usual way\n");
+     }
+     return NULL;
+ }
+ 
+ int uring_close (uring_writer_t * p_uring) // every completion in, then the rings go away. -1 if anything it did failed
+ {
+     if (NULL == p_uring)
+     {
+         return 0;
+     }
+ 
+     while (p_uring->in_flight > 0)
+     {
+         uring_reap(p_uring, NULL);
+     }
+     int result = p_uring->has_failed ? -1 : 0;
+     free(p_uring->p_files);
+     munmap(p_uring->p_sqes, p_uring->sqes_size);
+     if (p_uring->p_cq_ring != p_uring->p_sq_ring)
+     {
+         munmap(p_uring->p_cq_ring, p_uring->cq_ring_size);
+     }
+     munmap(p_uring->p_sq_ring, p_uring->sq_ring_size);
+     close(p_uring->ring_fd);
+     free(p_uring);
+     return result;
+ }
+ 
+ struct io_uring_sqe * uring_get_sqe (uring_writer_t * p_uring) // next free submission slot, zeroed
+ {
+     unsigned int tail = *p_uring->p_sq_tail; // only we move the tail
+     unsigned int index = tail & *p_uring->p_sq_mask;
+     struct io_uring_sqe * p_sqe = &p_uring->p_sqes[index];
+ 
+     memset(p_sqe, 0, sizeof(*p_sqe));
+     p_uring->p_sq_array[index] = index;
+     __atomic_store_n(p_uring->p_sq_tail, tail + 1, __ATOMIC_RELEASE); // kernel sees it at the next enter
+     p_uring->queued++;
+     p_uring->in_flight++;
+     return p_sqe;
+ }
+ 
+ int uring_submit (uring_writer_t * p_uring, unsigned int wait_for) // hands the queued sqes over, -1 on failure
+ {
+     unsigned int flags = (wait_for > 0) ? IORING_ENTER_GETEVENTS : 0;
+ 
+     while (p_uring->queued > 0 || wait_for > 0)
+     {
+         long result = syscall(__NR_io_uring_enter, p_uring->ring_fd, p_uring->queued, wait_for, flags, NULL, 0);
+         if (result < 0)
+         {
+             if (EINTR == errno)
+             {
+                 continue;
+             }
+             perror("io_uring_enter");
+             return -1;
+         }
+         p_uring->queued -= (unsigned int) result;
+         wait_for = 0; // the kernel waited for them along with the submit
+     }
+     return 0;
+ }
+ 
+ // user_data: file index << 2 | what it was
+ #define URING_OPEN 0
+ #define URING_WRITE 1
+ #define URING_CLOSE 2
+ 
+ void uring_reap (uring_writer_t * p_uring, int * p_opens_left) // takes every completion there is, waits for one if there are none
+ {
+     unsigned int head = *p_uring->p_cq_head;
+     if (head == __atomic_load_n(p_uring->p_cq_tail, __ATOMIC_ACQUIRE) && uring_submit(p_uring, 1) != 0)
+     {
+         p_uring->in_flight = 0; // the ring is broken, don't spin on it
+         p_uring->has_failed = 1;
+         return;
+     }
+ 
+     while (head != __atomic_load_n(p_uring->p_cq_tail, __ATOMIC_ACQUIRE))
+     {
+         const struct io_uring_cqe * p_cqe = &p_uring->p_cqes[head & *p_uring->p_cq_mask];
+         uring_file_t * p_file = &p_uring->p_files[p_cqe->user_data >> 2];
+         int result = p_cqe->res;
+         head++;
+         p_uring->in_flight--;
+ 
+         switch (p_cqe->user_data & 3)
+         {
+             case URING_OPEN:
+                 p_file->fd = result; // -errno if it failed, the flush deals with it
+                 p_uring->open_files += (result >= 0);
+                 if (NULL != p_opens_left)
+                 {
+                     (*p_opens_left)--;
+                 }
+                 break;
+ 
+             case URING_WRITE:
+                 if (result >= 0 && (size_t) result < p_file->length) // short: the rest the usual way
+                 {
+                     int fd = open(p_file->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+                     size_t written = (size_t) result;
+                     while (fd >= 0 && written < p_file->length)
+                     {
+                         ssize_t count = write(fd, p_file->p_data + written, p_file->length - written);
+                         if (count < 0 && EINTR != errno)
+                         {
+                             break;
+                         }
+                         written += (count > 0) ? (size_t) count : 0;
+                     }
+                     result = (written == p_file->length) ? 0 : -errno;
+                     if (fd >= 0)
+                     {
+                         close(fd);
+                     }
+                 }
+                 if (result < 0)
+                 {
+                     errno = -result;
+                     perror(p_file->path);
+                     p_uring->has_failed = 1;
+                 }
+                 free(p_file->p_data); // the kernel's done with it
+                 p_file->p_data = NULL;
+                 break;
+ 
+             default: // close: the fd's free again
+                 p_uring->open_files--;
+                 break;
+         }
+     }
+ 
+     __atomic_store_n(p_uring->p_cq_head, head, __ATOMIC_RELEASE);
+ }
+ 
+ // the --uring flush. the last flush's writes get finished first (they had the parse in between to
+ // get done), then in batches of URING_BATCH: submit the opens and wait for the fds, then submit each
+ // write with its close hard-linked behind it (the close runs even if the write fails) and move on.
+ // -1 once anything has failed, this flush or an earlier one's writes
+ int uring_flush_partitions (uring_writer_t * p_uring, const char * p_dirname, partition_set_t * p_set)
+ {
+     while (p_uring->in_flight > 0)
+     {
+         uring_reap(p_uring, NULL);
+     }
+     p_uring->file_count = 0;
+     if (p_uring->has_failed) // the last flush's writes didn't all make it, the split's already lost
+     {
+         return -1;
+     }
+ 
+     for (int part = 0; part < p_set->part_count; part++)
+     {
+         partition_t * p_part = &p_set->parts[part];
+         int slot = 0;
+ 
+         while (slot < p_part->count)
+         {
+             // room for a whole batch up front: the sqes point into p_files, so it can't move once they're queued
+             if (p_uring->file_count + g_uring_batch > p_uring->file_capacity)
+             {
+                 int new_capacity = (0 == p_uring->file_capacity) ? URING_BATCH : p_uring->file_capacity * 2;
+                 uring_file_t * p_grown = realloc(p_uring->p_files, new_capacity * sizeof(uring_file_t));
+                 if (NULL == p_grown)
+                 {
+                     fprintf(stderr, "Memory allocation failed\n");
+                     p_uring->has_failed = 1;
+                     return -1;
+                 }
+                 p_uring->p_files = p_grown;
+                 p_uring->file_capacity = new_capacity;
+             }
+ 
+             // the completion queue is twice URING_ENTRIES: keep what's left from the last batch
+             // small enough that this batch's opens, writes and closes still fit. and no more than
+             // one batch of files still waiting on their close, so two batches is all that's ever open
+             while (p_uring->in_flight > 0 && (p_uring->in_flight > URING_ENTRIES || p_uring->open_files > g_uring_batch))
+             {
+                 uring_reap(p_uring, NULL);
+             }
+ 
+             // this batch's opens
+             int first = p_uring->file_count;
+             title_bucket_t * p_batch[URING_BATCH];
+             int batch_count = 0;
+ 
+             for (; slot < p_part->count && batch_count < g_uring_batch; slot++)
+             {
+                 title_bucket_t * p_bucket = &p_part->p_buckets[slot];
+                 if (0 == p_bucket->used) // nothing new for this file
+                 {
+                     continue;
+                 }
+ 
+                 uring_file_t * p_file = &p_uring->p_files[p_uring->file_count];
+                 bucket_path(p_dirname, p_part, p_bucket, p_file->path, sizeof(p_file->path));
+                 p_file->p_data = NULL;
+                 p_file->fd = -1;
+ 
+                 struct io_uring_sqe * p_sqe = uring_get_sqe(p_uring);
+                 p_sqe->opcode = IORING_OP_OPENAT;
+                 p_sqe->fd = AT_FDCWD;
+                 p_sqe->addr = (uint64_t) (uintptr_t) p_file->path;
+                 p_sqe->len = FILE_MODE;
+                 p_sqe->open_flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC; // append like "a" did
+                 p_sqe->user_data = ((uint64_t) p_uring->file_count << 2) | URING_OPEN;
+ 
+                 p_batch[batch_count++] = p_bucket;
+                 p_uring->file_count++;
+             }
+             if (0 == batch_count)
+             {
+                 break;
+             }
+ 
+             int opens_left = batch_count;
+             if (uring_submit(p_uring, (unsigned int) batch_count) != 0)
+             {
+                 p_uring->in_flight = 0;
+                 p_uring->has_failed = 1;
+                 return -1;
+             }
+             while (opens_left > 0)
+             {
+                 uring_reap(p_uring, &opens_left);
+             }
+ 
+             // the writes, each bucket's buffer going with its write
+             for (int index = 0; index < batch_count; index++)
+             {
+                 title_bucket_t * p_bucket = p_batch[index];
+                 uring_file_t * p_file = &p_uring->p_files[first + index];
+ 
+                 if (p_file->fd < 0)
+                 {
+                     errno = -p_file->fd;
+                     perror(p_file->path);
+                     p_bucket->used = 0; // drop them, same as the plain path
+                     p_uring->has_failed = 1;
+                     continue;
+                 }
+                 if (!p_bucket->is_created) // permissions once per file, only if the umask got in the way
+                 {
+                     if (!g_umask_keeps_mode)
+                     {
+                         fchmod(p_file->fd, FILE_MODE);
+                     }
+                     p_bucket->is_created = 1;
+                 }
+ 
+                 p_file->p_data = p_bucket->p_data;
+                 p_file->length = p_bucket->used;
+                 p_bucket->p_data = NULL; // a fresh one next time, this one's the kernel's now
+                 p_bucket->used = 0;
+                 p_bucket->capacity = 0;
+ 
+                 struct io_uring_sqe * p_sqe = uring_get_sqe(p_uring);
+                 p_sqe->opcode = IORING_OP_WRITE;
+                 p_sqe->fd = p_file->fd;
+                 p_sqe->addr = (uint64_t) (uintptr_t) p_file->p_data;
+                 p_sqe->len = (uint32_t) p_file->length;
+                 p_sqe->off = (uint64_t) -1; // the file position, O_APPEND puts it at the end
+                 p_sqe->flags = IOSQE_IO_HARDLINK;
+                 p_sqe->user_data = ((uint64_t) (first + index) << 2) | URING_WRITE;
+ 
+                 p_sqe = uring_get_sqe(p_uring);
+                 p_sqe->opcode = IORING_OP_CLOSE;
+                 p_sqe->fd = p_file->fd;
+                 p_sqe->user_data = ((uint64_t) (first + index) << 2) | URING_CLOSE;
+             }
+             if (uring_submit(p_uring, 0) != 0)
+             {
+                 p_uring->in_flight = 0;
+                 p_uring->has_failed = 1;
+                 return -1;
+             }
+         }
+     }
+     return p_uring->has_failed ? -1 : 0;
+ }
+ 
+ // each job gets an even share of the open file limit (less the 16 kept for everything else), its own
+ // FDS_PER_JOB come out of that, and half of what's left is a batch since two batches can be open at once
+ void fit_uring_batch (int job_count)
+ {
+     struct rlimit fd_limit;
+     g_uring_batch = URING_BATCH;
+     if (g_use_uring && 0 == getrlimit(RLIMIT_NOFILE, &fd_limit) && RLIM_INFINITY != fd_limit.rlim_cur)
+     {
+         rlim_t share = (fd_limit.rlim_cur > 16) ? (fd_limit.rlim_cur - 16) / (rlim_t) job_count : 0;
+         rlim_t batch = (share > FDS_PER_JOB) ? (share - FDS_PER_JOB) / 2 : 1;
+         g_uring_batch = (batch < 1) ? 1 : ((batch < URING_BATCH) ? (int) batch : URING_BATCH);
+     }
+ }
+ 
+ void * split_chunk_worker (void * p_arg) // sorts one piece of the mapping into its own buckets
+ {
+     split_chunk_t * p_chunk = p_arg;
+     const char * p_curr = p_chunk->p_begin;
+ 
+     while (p_curr < p_chunk->p_end)
+     {
+         int in_quotes = 0; // every piece starts on a record
+         const char * p_line_end = csv_record_end(p_curr, p_chunk->p_end, &in_quotes);
+         if (p_line_end > p_curr && 0 == partition_movie_record(&p_chunk->buckets, p_curr, (size_t) (p_line_end - p_curr)))
+         {
+             p_chunk->rows++;
+         }
+ 
+         p_curr = p_line_end + 1;
+     }
+ 
+     return NULL;
+ }
+ 
+ // the threaded split. rounds of thread_count pieces, CHUNK_BYTES each, so memory stays
+ // bounded however big the file is; after each round the pieces' buckets are appended to
+ // the real ones in piece order. 1 if the file can't be mapped (do it on one thread instead),
+ // -1 if a file didn't get all its titles
+ int write_movies_by_year_parallel (const char * p_filename, const char * p_dirname, int thread_count, partition_stats_t * p_stats)
+ {
+     int fd = open(p_filename, O_RDONLY | O_CLOEXEC);
+     struct stat file_stat;
+     if (fd < 0 || fstat(fd, &file_stat) != 0)
+     {
+         if (fd >= 0)
+         {
+             close(fd);
+         }
+         return 1;
+     }
+ 
+     size_t length = (size_t) file_stat.st_size;
+     const char * p_map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+     close(fd); // the mapping keeps the file around
+     if (MAP_FAILED == (void *) p_map)
+     {
+         return 1;
+     }
+     madvise((void *) p_map, length, MADV_SEQUENTIAL);
+ 
+     split_chunk_t chunks[MAX_SPLIT_THREADS];
+     pthread_t threads[MAX_SPLIT_THREADS];
+     int started[MAX_SPLIT_THREADS];
+     memset(chunks, 0, sizeof(chunks));
+     for (int index = 0; index < thread_count; index++)
+     {
+         init_partitions(&chunks[index].buckets);
+     }
+ 
+     partition_set_t buckets; // the real ones, same as the one-thread split
+     init_partitions(&buckets);
+     buckets.p_uring = g_use_uring ? uring_open() : NULL;
+     long long rows = 0;
+     int result = 0;
+     const char * p_end = p_map + length;
+     int in_quotes = 0;
+     const char * p_newline = csv_record_end(p_map, p_end, &in_quotes); // skip header
+     const char * p_cut = (p_newline == p_end) ? p_end : p_newline + 1;
+ 
+     while (0 == result && p_cut < p_end)
+     {
+         // next CHUNK_BYTES per thread, each pushed forward to a record start.
+         // a newline inside quotes doesn't end a record, so count the quotes since the last cut
+         int chunk_count = 0;
+         while (chunk_count < thread_count && p_cut < p_end)
+         {
+             const char * p_next = ((size_t) (p_end - p_cut) > CHUNK_BYTES) ? p_cut + CHUNK_BYTES : p_end;
+             if (p_next < p_end)
+             {
+                 in_quotes = (int) (csv_count_quotes(p_cut, (size_t) (p_next - p_cut)) & 1);
+                 p_newline = csv_record_end(p_next, p_end, &in_quotes);
+                 p_next = (p_newline == p_end) ? p_end : p_newline + 1;
+             }
+ 
+             chunks[chunk_count].p_begin = p_cut;
+             chunks[chunk_count].p_end = p_next;
+             chunks[chunk_count].rows = 0;
+             chunk_count++;
+             p_cut = p_next;
+         }
+ 
+         for (int index = 0; index < chunk_count; index++)
+         {
+             started[index] = (0 == pthread_create(&threads[index], NULL, split_chunk_worker, &chunks[index]));
+         }
+         for (int index = 0; index < chunk_count; index++) // a thread that didn't start gets done right here
+         {
+             if (started[index])
+             {
+                 pthread_join(threads[index], NULL);
+             }
+             else
+             {
+                 split_chunk_worker(&chunks[index]);
+             }
+         }
+ 
+         // merge in piece order, so each file's titles stay in file order.
+         // both sets list the same splits in the same order (init_partitions)
+         for (int index = 0; index < chunk_count; index++)
+         {
+             partition_set_t * p_local = &chunks[index].buckets;
+ 
+             for (int part = 0; part < p_local->part_count; part++)
+             {
+                 partition_t * p_from_part = &p_local->parts[part];
+ 
+                 for (int slot = 0; slot < p_from_part->count; slot++)
+                 {
+                     title_bucket_t * p_from = &p_from_part->p_buckets[slot];
+                     title_bucket_t * p_to = get_bucket(&buckets.parts[part], p_from->key, p_from->key_len);
+ 
+                     if (NULL == p_to || append_to_bucket(&buckets, p_to, p_from->p_data, p_from->used) != 0)
+                     {
+                         fprintf(stderr, "Out of memory, %.*s.txt would be missing titles\n", (int) p_from->key_len, p_from->key);
+                         result = -1;
+                     }
+                     p_from->used = 0; // the buffer gets reused next round
+                 }
+             }
+             p_local->buffered = 0;
+             rows += chunks[index].rows;
+             if (p_local->is_missing_titles) // a thread ran out of memory partway through its piece
+             {
+                 result = -1;
+             }
+         }
+ 
+         if (0 == result && buckets.buffered > BUCKET_FLUSH_BYTES && flush_partitions(p_dirname, &buckets) != 0) // too much held, write it all out now
+         {
+             result = -1;
+         }
+     }
+ 
+     if (0 == result && flush_partitions(p_dirname, &buckets) != 0) // the one write per file
+     {
+         result = -1;
+     }
+     if (free_partitions(&buckets) != 0)
+     {
+         result = -1;
+     }
+     for (int index = 0; index < thread_count; index++)
+     {
+         free_partitions(&chunks[index].buckets);
+     }
+     munmap((void *) p_map, length);
+ 
+     if (NULL != p_stats)
+     {
+         p_stats->rows = rows;
+         p_stats->bytes = (long long) length;
+     }
+     return result;
+ }
+ 
+ double now_seconds (void) // monotonic clock, for the throughput numbers
+ {
+     struct timespec now;
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return now.tv_sec + now.tv_nsec / 1e9;
+ }
+ 
+ char ** list_movie_files (int * p_count) // every movies_*.csv in this folder, biggest first, NULL if none
+ {
+     candidate_cache_t * p_cache = get_movie_candidates(); // same scan the menu uses
+     char ** pp_files = NULL;
+     int count = 0;
+ 
+     *p_count = 0;
+     if (NULL == p_cache || 0 == p_cache->count)
+     {
+         return NULL;
+     }
+ 
+     pp_files = malloc(p_cache->count * sizeof(char *));
+     if (NULL == pp_files)
+     {
+         return NULL;
+     }
+ 
+     // biggest first, so the pool doesn't end waiting on one huge file started last
+     for (int index = p_cache->count - 1; index >= 0; index--)
+     {
+         pp_files[count] = strdup(p_cache->p_names + p_cache->p_list[index].name_offset);
+         if (NULL != pp_files[count])
+         {
+             count++;
+         }
+     }
+ 
+     *p_count = count;
+     return pp_files;
+ }
+ 
+ void * batch_worker (void * p_arg) // takes the next file until there are none left
+ {
+     batch_run_t * p_run = p_arg;
+ 
+     while (1)
+     {
+         pthread_mutex_lock(&p_run->lock);
+         int index = p_run->next_file++;
+         pthread_mutex_unlock(&p_run->lock);
+         if (index >= p_run->file_count)
+         {
+             return NULL;
+         }
+ 
+         const char * p_filename = p_run->pp_files[index];
+         partition_stats_t stats = { 0, 0 };
+         double start = now_seconds();
+         char * p_staging = create_directory(); // own folder per file, same as the menu
+         int result = (NULL == p_staging) ? -1 : write_movies_by_year(p_filename, p_staging, &stats);
+         double elapsed = now_seconds() - start;
+ 
+         if (0 == result) // published with the rest once they're all done
+         {
+             p_run->pp_staged[index] = p_staging;
+         }
+         else if (NULL != p_staging)
+         {
+             discard_directory(p_staging); // half a split isn't published
+             free(p_staging);
+         }
+ 
+         pthread_mutex_lock(&p_run->lock); // progress line and totals together so the counts stay in order
+         p_run->done_count++;
+         if (0 == result)
+         {
+             p_run->rows += stats.rows;
+             p_run->bytes += stats.bytes;
+             printf("[%d/%d] %s: %lld movies, %.1f MB in %.2f s\n", p_run->done_count, p_run->file_count,
+                    p_filename, stats.rows, stats.bytes / 1e6, elapsed);
+         }
+         else
+         {
+             p_run->failed_count++;
+             printf("[%d/%d] %s failed\n", p_run->done_count, p_run->file_count, p_filename);
+         }
+         fflush(stdout);
+         pthread_mutex_unlock(&p_run->lock);
+     }
+ }
+ 
+ int process_all_files (int job_count) // --all: split every file with a pool of job_count threads
+ {
+     batch_run_t run;
+     memset(&run, 0, sizeof(run));
+     pthread_mutex_init(&run.lock, NULL);
+ 
+     run.pp_files = list_movie_files(&run.file_count);
+     if (0 == run.file_count)
+     {
+         printf("No %s*%s files here\n", PREFIX, EXT);
+         return EXIT_SUCCESS;
+     }
+     run.pp_staged = calloc(run.file_count, sizeof(char *));
+     if (NULL == run.pp_staged)
+     {
+         fprintf(stderr, "Memory allocation failed\n");
+         return EXIT_FAILURE;
+     }
+ 
+     // one per cpu unless told otherwise, and never so many that the open file limit runs out.
+     // --uring jobs need room for at least two files of their own on top (one opening, one closing)
+     if (job_count <= 0)
+     {
+         job_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+     }
+     int fds_per_job = FDS_PER_JOB + (g_use_uring ? 2 : 0);
+     struct rlimit fd_limit;
+     if (0 == getrlimit(RLIMIT_NOFILE, &fd_limit) && RLIM_INFINITY != fd_limit.rlim_cur
+         && (rlim_t) job_count * fds_per_job + 16 > fd_limit.rlim_cur)
+     {
+         job_count = (fd_limit.rlim_cur > 16 + (rlim_t) fds_per_job) ? (int) ((fd_limit.rlim_cur - 16) / fds_per_job) : 1;
+     }
+     if (job_count > MAX_JOBS)
+     {
+         job_count = MAX_JOBS;
+     }
+     if (job_count > run.file_count)
+     {
+         job_count = run.file_count;
+     }
+     if (job_count < 1)
+     {
+         job_count = 1;
+     }
+     fit_uring_batch(job_count);
+ 
+     printf("Splitting %d files, %d at a time\n", run.file_count, job_count);
+     fflush(stdout);
+ 
+     pthread_t threads[MAX_JOBS];
+     int started = 0;
+     double start = now_seconds();
+     for (int index = 0; index < job_count; index++)
+     {
+         if (0 == pthread_create(&threads[started], NULL, batch_worker, &run))
+         {
+             started++;
+         }
+     }
+     if (0 == started) // no threads at all, do it on this one
+     {
+         batch_worker(&run);
+     }
+     for (int index = 0; index < started; index++)
+     {
+         pthread_join(threads[index], NULL);
+     }
+
+     // one sync for every staged folder, then every rename, then one fsync for the renames
+     char ** pp_publish = calloc(run.file_count, sizeof(char *));
+     int publish_count = 0;
+     for (int index = 0; NULL != pp_publish && index < run.file_count; index++)
+     {
+         if (NULL != run.pp_staged[index])
+         {
+             pp_publish[publish_count++] = run.pp_staged[index];
+         }
+     }
+     int is_synced = (NULL != pp_publish && 0 == sync_staged(pp_publish, publish_count));
+     free(pp_publish);
+ 
+     for (int index = 0; index < run.file_count; index++)
+     {
+         if (NULL == run.pp_staged[index])
+         {
+             continue;
+         }
+         char * p_dirname = is_synced ? publish_directory(run.pp_staged[index]) : NULL;
+         if (NULL == p_dirname)
+         {
+             run.failed_count++; // its titles stay in the staging folder
+             if (!is_synced) // publish_directory says so itself when the rename is what failed
+             {
+                 fprintf(stderr, "the titles from %s are still in %s\n", run.pp_files[index], run.pp_staged[index]);
+             }
+         }
+         else
+         {
+             printf("%s -> %s\n", run.pp_files[index], p_dirname);
+         }
+         free(p_dirname);
+         free(run.pp_staged[index]);
+     }
+     sync_current_directory();
+     double elapsed = now_seconds() - start;
+ 
+     printf("Split %d of %d files: %lld movies, %.1f MB in %.2f s (%.1f files/s, %.1f MB/s)\n",
+            run.file_count - run.failed_count, run.file_count, run.rows, run.bytes / 1e6, elapsed,
+            (elapsed > 0) ? run.file_count / elapsed : 0.0, (elapsed > 0) ? run.bytes / 1e6 / elapsed : 0.0);
+ 
+     for (int index = 0; index < run.file_count; index++)
+     {
+         free(run.pp_files[index]);
+     }
+     free(run.pp_files);
+     free(run.pp_staged);
+     pthread_mutex_destroy(&run.lock);
+     return (0 == run.failed_count) ? EXIT_SUCCESS : EXIT_FAILURE;
  }
  
  int starts_with (const char * p_str, const char * p_prefix) // check prefix match